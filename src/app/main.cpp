@@ -3,6 +3,7 @@
 #include <QLoggingCategory>
 #include <QStandardPaths>
 #include <QSettings>
+#include <algorithm>
 
 #include "nv/main_window.h"
 #include "nv/application_controller.h"
@@ -29,6 +30,7 @@ int main(int argc, char *argv[])
     const QString notesDir = appState.notesDirectory();
     QDir().mkpath(notesDir);
     auto storage = std::make_unique<nv::LocalStorage>(notesDir);
+    storage->setBodyCacheBudget(size_t(std::max(0, appState.bodyCacheMegabytes())) << 20);
 
     // Create note store
     auto noteStore = std::make_unique<nv::NoteStore>();
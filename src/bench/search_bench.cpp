@@ -0,0 +1,379 @@
+// nv_search_bench: SearchIndex throughput and latency on a synthetic corpus.
+//
+// The corpus is generated from a seed, so two runs with the same options
+// search the same notes with the same queries and their numbers can be
+// compared directly (e.g. before and after a change to the index).
+
+#include "nv/note_model.h"
+#include "nv/search_index.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace nv {
+namespace {
+
+struct BenchOptions {
+    size_t notes = 10000;
+    size_t bodyWords = 120;     // average; actual lengths vary by +-50%
+    size_t vocabulary = 50000;
+    double skew = 1.0;          // Zipf exponent of word frequencies
+    size_t queries = 500;       // per query class
+    size_t rankLimit = 0;
+    bool substring = false;
+    int fuzzy = 0;
+    uint32_t seed = 42;
+};
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --notes N       notes in the corpus (default 10000)\n"
+              << "  --words N       average body length in words (default 120)\n"
+              << "  --vocabulary N  distinct words (default 50000)\n"
+              << "  --skew S        Zipf exponent of word frequencies (default 1.0)\n"
+              << "  --queries N     queries per class (default 500)\n"
+              << "  --rank K        rank the top K results (default 0: unranked)\n"
+              << "  --substring     enable substring matching\n"
+              << "  --fuzzy N       enable fuzzy matching with up to N edits\n"
+              << "  --seed N        corpus and query seed (default 42)\n";
+}
+
+bool parseOptions(int argc, char* argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            std::exit(0);
+        }
+        if (arg == "--substring") {
+            options.substring = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Error: unknown option or missing value: " << arg << "\n";
+            return false;
+        }
+
+        const char* value = argv[++i];
+        if (arg == "--notes") {
+            options.notes = std::strtoull(value, nullptr, 10);
+        } else if (arg == "--words") {
+            options.bodyWords = std::strtoull(value, nullptr, 10);
+        } else if (arg == "--vocabulary") {
+            options.vocabulary = std::max<size_t>(1, std::strtoull(value, nullptr, 10));
+        } else if (arg == "--skew") {
+            options.skew = std::strtod(value, nullptr);
+        } else if (arg == "--queries") {
+            options.queries = std::strtoull(value, nullptr, 10);
+        } else if (arg == "--rank") {
+            options.rankLimit = std::strtoull(value, nullptr, 10);
+        } else if (arg == "--fuzzy") {
+            options.fuzzy = std::atoi(value);
+        } else if (arg == "--seed") {
+            options.seed = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else {
+            std::cerr << "Error: unknown option " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reproducible notes over a Zipf-distributed vocabulary of made-up words,
+// so that common words have long posting lists and rare words short ones,
+// like in real text.
+class SyntheticCorpus {
+public:
+    explicit SyntheticCorpus(const BenchOptions& options)
+        : options_(options)
+        , rng_(options.seed) {
+        makeVocabulary();
+    }
+
+    std::vector<std::shared_ptr<const Note>> generateNotes() {
+        std::vector<std::shared_ptr<const Note>> notes;
+        notes.reserve(options_.notes);
+        const auto now = std::chrono::system_clock::now();
+        const size_t minWords = std::max<size_t>(1, options_.bodyWords / 2);
+        std::uniform_int_distribution<size_t> bodyLength(minWords, minWords + options_.bodyWords);
+        std::uniform_int_distribution<size_t> titleLength(1, 6);
+        // Modified within the last year; every fourth note is a checklist
+        std::uniform_int_distribution<int> age(0, 365 * 24);
+
+        for (size_t i = 0; i < options_.notes; ++i) {
+            std::string title = sentence(titleLength(rng_));
+            std::string body = sentence(bodyLength(rng_));
+            const auto modified = now - std::chrono::hours(age(rng_));
+            auto note = std::make_shared<Note>(NoteUUID::generate(), std::move(title), std::move(body),
+                                               modified, modified);
+            if (i % 4 == 0) {
+                note->setNoteType(NoteType::CHECKLIST);
+            }
+            notes.push_back(std::move(note));
+        }
+        return notes;
+    }
+
+    // A frequency-weighted word, as users tend to search for common words
+    const std::string& word() { return vocabulary_[sampleRank()]; }
+
+    // The first 2-4 characters of a word: what a search looks like while
+    // the user is still typing it
+    std::string prefix() {
+        const std::string& w = word();
+        std::uniform_int_distribution<size_t> length(2, 4);
+        return w.substr(0, std::min(w.size(), length(rng_)));
+    }
+
+    // Two or three words from one note, so the query has hits
+    std::string multiWord(const std::vector<std::shared_ptr<const Note>>& notes) {
+        std::uniform_int_distribution<size_t> pick(0, notes.size() - 1);
+        const auto words = QueryParser::tokenize(*notes[pick(rng_)]->body());
+        std::uniform_int_distribution<size_t> count(2, 3);
+        std::uniform_int_distribution<size_t> at(0, words.size() - 1);
+        std::string query;
+        for (size_t n = count(rng_); n > 0; --n) {
+            query += words[at(rng_)] + " ";
+        }
+        return query;
+    }
+
+    // A prefix scoped by a field or combined with a type or date filter
+    std::string filtered() {
+        static const char* const kFilters[] = {"title:", "type:checklist ", "modified:30d ", "modified:>2000-01-01 "};
+        std::uniform_int_distribution<size_t> pick(0, std::size(kFilters) - 1);
+        return kFilters[pick(rng_)] + prefix();
+    }
+
+private:
+    void makeVocabulary() {
+        // Words of 3-10 letters; duplicates are harmless, they just merge
+        // two ranks.
+        std::uniform_int_distribution<int> letter('a', 'z');
+        std::uniform_int_distribution<size_t> length(3, 10);
+        vocabulary_.reserve(options_.vocabulary);
+        for (size_t i = 0; i < options_.vocabulary; ++i) {
+            std::string w(length(rng_), 'a');
+            for (auto& c : w) {
+                c = static_cast<char>(letter(rng_));
+            }
+            vocabulary_.push_back(std::move(w));
+        }
+
+        // Cumulative Zipf weights: rank r has weight 1 / r^skew
+        cumulative_.reserve(options_.vocabulary);
+        double total = 0.0;
+        for (size_t r = 1; r <= options_.vocabulary; ++r) {
+            total += 1.0 / std::pow(static_cast<double>(r), options_.skew);
+            cumulative_.push_back(total);
+        }
+    }
+
+    size_t sampleRank() {
+        std::uniform_real_distribution<double> uniform(0.0, cumulative_.back());
+        auto it = std::lower_bound(cumulative_.begin(), cumulative_.end(), uniform(rng_));
+        return std::min(static_cast<size_t>(it - cumulative_.begin()), vocabulary_.size() - 1);
+    }
+
+    std::string sentence(size_t words) {
+        std::string s;
+        for (size_t i = 0; i < words; ++i) {
+            if (i > 0) {
+                s += ' ';
+            }
+            s += word();
+        }
+        return s;
+    }
+
+    const BenchOptions& options_;
+    std::mt19937 rng_;
+    std::vector<std::string> vocabulary_;
+    std::vector<double> cumulative_;
+};
+
+// Resident set size in bytes, or 0 where it can't be read
+size_t residentBytes() {
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident = 0;
+    if (statm >> pages >> resident) {
+        return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    }
+#endif
+    return 0;
+}
+
+using Clock = std::chrono::steady_clock;
+
+double millisSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+double percentile(std::vector<double> sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    const size_t index = static_cast<size_t>(std::ceil(p * static_cast<double>(sorted.size()))) - 1;
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+void reportLatency(const char* name, const SearchIndex& index, const std::vector<std::string>& queries,
+                   const SearchOptions& options) {
+    std::vector<double> latencies;
+    latencies.reserve(queries.size());
+    size_t hits = 0;
+    for (const auto& query : queries) {
+        const auto start = Clock::now();
+        hits += index.filter(query, options).size();
+        latencies.push_back(millisSince(start));
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    double mean = 0.0;
+    for (double ms : latencies) {
+        mean += ms;
+    }
+    mean /= std::max<size_t>(1, latencies.size());
+
+    std::printf("  %-10s p50 %9.3f ms   p99 %9.3f ms   max %9.3f ms   mean %9.3f ms   avg hits %zu\n",
+                name, percentile(latencies, 0.50), percentile(latencies, 0.99),
+                latencies.empty() ? 0.0 : latencies.back(), mean,
+                hits / std::max<size_t>(1, queries.size()));
+}
+
+int run(const BenchOptions& options) {
+    std::printf("corpus: %zu notes, ~%zu words each, vocabulary %zu, skew %.2f, seed %u\n",
+                options.notes, options.bodyWords, options.vocabulary, options.skew, options.seed);
+
+    SyntheticCorpus corpus(options);
+    auto start = Clock::now();
+    auto notes = corpus.generateNotes();
+    size_t textBytes = 0;
+    for (const auto& note : notes) {
+        textBytes += note->title().size() + note->body()->size();
+    }
+    std::printf("generated in %.1f ms (%.1f MB of text)\n", millisSince(start), textBytes / 1e6);
+
+    // Indexing: the startup path (one batch), then single-note edits
+    SearchIndex index;
+    index.setSubstringMatching(options.substring);
+    // Measure evaluation, not cache hits; see the "repeated" class below
+    index.setResultCacheCapacity(0);
+    index.setFuzzyMatching(options.fuzzy);
+
+    const size_t rssBefore = residentBytes();
+    start = Clock::now();
+    index.indexNotes(notes);
+    const double batchMs = millisSince(start);
+    const size_t rssAfter = residentBytes();
+
+    std::printf("\nindexing\n");
+    std::printf("  batch      %.1f ms   %.0f notes/s   %.1f MB/s\n", batchMs,
+                notes.size() / (batchMs / 1000.0), textBytes / 1e6 / (batchMs / 1000.0));
+    if (rssBefore > 0 && rssAfter >= rssBefore) {
+        std::printf("  memory     %.1f MB index, %.0f bytes/note (resident set growth)\n",
+                    (rssAfter - rssBefore) / 1e6,
+                    static_cast<double>(rssAfter - rssBefore) / std::max<size_t>(1, notes.size()));
+    }
+    const IndexMemoryUsage usage = index.memoryUsage();
+    const std::pair<const char*, size_t> parts[] = {
+        {"term arena", usage.termArena},
+        {"term tables", usage.termTables},
+        {"postings", usage.postings},
+        {"trigrams", usage.trigramPostings},
+        {"filters", usage.filters},
+        {"note terms", usage.noteTerms},
+        {"positions", usage.notePositions},
+        {"note tables", usage.noteTables},
+    };
+    std::printf("  accounted  %.1f MB, %.0f bytes/note\n", usage.total() / 1e6,
+                static_cast<double>(usage.total()) / std::max<size_t>(1, notes.size()));
+    for (const auto& [name, bytes] : parts) {
+        std::printf("    %-11s %8.1f MB  %5.1f%%\n", name, bytes / 1e6,
+                    100.0 * static_cast<double>(bytes) / std::max<size_t>(1, usage.total()));
+    }
+
+    const size_t edits = std::min<size_t>(notes.size(), 1000);
+    std::vector<double> updateLatencies;
+    updateLatencies.reserve(edits);
+    for (size_t i = 0; i < edits; ++i) {
+        auto& note = notes[(i * 7919) % notes.size()];
+        auto edited = std::make_shared<Note>(*note);
+        edited->setBody(*note->body() + " " + corpus.word());
+        note = edited;
+        const auto updateStart = Clock::now();
+        index.updateNote(note);
+        updateLatencies.push_back(millisSince(updateStart));
+    }
+    std::sort(updateLatencies.begin(), updateLatencies.end());
+    if (!updateLatencies.empty()) {
+        std::printf("  update     p50 %9.3f ms   p99 %9.3f ms\n", percentile(updateLatencies, 0.50),
+                    percentile(updateLatencies, 0.99));
+    }
+
+    // Queries are drawn up front so every class is measured on its own
+    std::vector<std::string> prefixQueries;
+    std::vector<std::string> multiQueries;
+    std::vector<std::string> filteredQueries;
+    for (size_t i = 0; i < options.queries; ++i) {
+        prefixQueries.push_back(corpus.prefix());
+        multiQueries.push_back(corpus.multiWord(notes));
+        filteredQueries.push_back(corpus.filtered());
+    }
+    const std::vector<std::string> emptyQueries(std::max<size_t>(1, options.queries / 10), "");
+
+    SearchOptions searchOptions;
+    searchOptions.rankLimit = options.rankLimit;
+    std::printf("\nfilter latency (%zu queries per class, rank limit %zu)\n", options.queries,
+                options.rankLimit);
+    reportLatency("prefix", index, prefixQueries, searchOptions);
+    reportLatency("multi", index, multiQueries, searchOptions);
+    reportLatency("filtered", index, filteredQueries, searchOptions);
+    reportLatency("empty", index, emptyQueries, searchOptions);
+
+    // Users keep returning to a few queries, which the result cache answers
+    // while the index is unchanged
+    std::vector<std::string> repeatedQueries;
+    for (size_t i = 0; i < options.queries; ++i) {
+        repeatedQueries.push_back(prefixQueries[i % std::min<size_t>(8, prefixQueries.size())]);
+    }
+    index.setResultCacheCapacity(QueryResultCache::kDefaultCapacity);
+    reportLatency("repeated", index, repeatedQueries, searchOptions);
+    const QueryCacheStats cache = index.resultCacheStats();
+    std::printf("  cache      %llu hits, %llu misses\n", static_cast<unsigned long long>(cache.hits),
+                static_cast<unsigned long long>(cache.misses));
+    return 0;
+}
+
+} // namespace
+} // namespace nv
+
+int main(int argc, char* argv[]) {
+    nv::BenchOptions options;
+    if (!nv::parseOptions(argc, argv, options)) {
+        return 1;
+    }
+    if (options.notes == 0) {
+        std::cerr << "Error: --notes must be at least 1\n";
+        return 1;
+    }
+    return nv::run(options);
+}
@@ -14,6 +14,14 @@ public:
     [[nodiscard]] int autoSaveDelay() const;
     [[nodiscard]] int fontSize() const;
     [[nodiscard]] bool showPreviews() const;
+    // Match search terms anywhere inside words, not just at their start
+    [[nodiscard]] bool substringSearch() const;
+    // Typos tolerated per search word (0-2), see SearchIndex::setFuzzyMatching
+    [[nodiscard]] int fuzzySearchEdits() const;
+    // Recent queries whose results are kept (0 disables the cache)
+    [[nodiscard]] int searchCacheSize() const;
+    // Note bodies kept in memory, in megabytes (see NoteBodyCache)
+    [[nodiscard]] int bodyCacheMegabytes() const;
     
     // Layout mode: 0 = vertical (default), 1 = horizontal (landscape)
     [[nodiscard]] int layoutMode() const;
@@ -46,6 +54,10 @@ private:
     int auto_save_delay_;
     int font_size_;
     bool show_previews_;
+    bool substring_search_;
+    int fuzzy_search_edits_;
+    int search_cache_size_;
+    int body_cache_megabytes_;
     int layout_mode_;
     int theme_;
     QByteArray splitter_state_;
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <QString>
+#include <memory>
+#include <vector>
+
+#include "note_model.h"
+#include "search_index.h"
+
+namespace nv {
+
+// On-disk copy of a SearchIndex, kept in the notes directory. At startup the
+// file is memory-mapped and restored, so only notes that changed since the
+// last run are tokenized again.
+class IndexSnapshot {
+public:
+    explicit IndexSnapshot(const QString& notesDirectory);
+
+    // Restores index from the snapshot, matched against the notes just read
+    // from storage. Returns the notes that still need indexing: all of them
+    // if there is no usable snapshot.
+    std::vector<std::shared_ptr<const Note>> load(SearchIndex& index,
+                                                  const std::vector<std::shared_ptr<const Note>>& notes) const;
+    bool save(const SearchIndex& index) const;
+
+    [[nodiscard]] const QString& path() const { return path_; }
+
+private:
+    QString path_;
+};
+
+} // namespace nv
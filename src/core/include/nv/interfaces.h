@@ -8,8 +8,8 @@
 
 namespace nv {
 
-using SearchResultCallback = std::function<void(const std::vector<std::shared_ptr<Note>>&)>;
-using NoteSelectionCallback = std::function<void(std::shared_ptr<Note>)>;
+using SearchResultCallback = std::function<void(const std::vector<std::shared_ptr<const Note>>&)>;
+using NoteSelectionCallback = std::function<void(std::shared_ptr<const Note>)>;
 
 class ISearchController {
 public:
@@ -17,7 +17,7 @@ public:
     virtual void setSearchQuery(const std::string& query) = 0;
     virtual void selectNote(size_t index) = 0;
     virtual void createNewNote(const std::string& title, const std::string& body) = 0;
-    virtual std::vector<std::shared_ptr<Note>> getFilteredNotes() = 0;
+    virtual std::vector<std::shared_ptr<const Note>> getFilteredNotes() = 0;
     virtual void addSearchObserver(SearchResultCallback cb) = 0;
     virtual void addSelectionObserver(NoteSelectionCallback cb) = 0;
 };
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nv {
+
+// Accepts the strings that have a prefix within max edits (insertions,
+// deletions, substitutions, swaps of adjacent characters) of a word, so a
+// partially typed, misspelled word still matches as a prefix. A state is
+// one row of the edit distance table against the word, with entries capped
+// at max + 1; swaps also look at the row before.
+class LevenshteinAutomaton {
+public:
+    LevenshteinAutomaton(std::string word, int maxEdits);
+
+    // Entries per state
+    size_t width() const { return word_.size() + 1; }
+    void start(uint8_t* state) const;
+    // parent/previous: the state and character before state (nullptr and
+    // ignored at the start)
+    void step(const uint8_t* parent, char previous, const uint8_t* state, char c, uint8_t* next) const;
+    // The characters consumed so far are within reach of the word
+    bool isMatch(const uint8_t* state) const { return state[word_.size()] <= max_; }
+    // Some continuation can still match
+    bool canMatch(const uint8_t* state) const;
+
+    // Visits the entries of the sorted range [first, last) whose key
+    // (keyOf(it), viewable as a std::string_view) is accepted, as
+    // f(it, matchLength). Runs the automaton along the keys, sharing the
+    // rows of common prefixes, and uses seek(key) (the first entry not less
+    // than key) to skip every key below a dead prefix, so it only touches
+    // the part of the dictionary that can match. Stops early if f returns
+    // false.
+    template <typename It, typename KeyOf, typename Seek, typename F>
+    void forEachMatch(It first, It last, KeyOf keyOf, Seek seek, F f) const;
+
+private:
+    std::string word_;
+    uint8_t max_;
+};
+
+template <typename It, typename KeyOf, typename Seek, typename F>
+void LevenshteinAutomaton::forEachMatch(It first, It last, KeyOf keyOf, Seek seek, F f) const {
+    const size_t w = width();
+    std::vector<uint8_t> rows(w);  // row i: state after prefix[0, i)
+    std::string prefix;
+    start(rows.data());
+
+    It it = first;
+    while (it != last) {
+        const std::string_view key = keyOf(it);
+
+        // Keep the rows of the prefix shared with the previous key
+        size_t depth = 0;
+        while (depth < prefix.size() && depth < key.size() && prefix[depth] == key[depth]) {
+            ++depth;
+        }
+        prefix.resize(depth);
+        rows.resize((depth + 1) * w);
+
+        bool dead = false;
+        while (!isMatch(&rows[depth * w]) && depth < key.size()) {
+            prefix.push_back(key[depth]);
+            rows.resize((depth + 2) * w);
+            step(depth > 0 ? &rows[(depth - 1) * w] : nullptr, depth > 0 ? key[depth - 1] : '\0',
+                 &rows[depth * w], key[depth], &rows[(depth + 1) * w]);
+            ++depth;
+            if (!canMatch(&rows[depth * w])) {
+                dead = true;
+                break;
+            }
+        }
+
+        if (dead) {
+            // No key starting with prefix can match: seek to the first key
+            // after all of them.
+            std::string next = prefix;
+            while (!next.empty() && static_cast<unsigned char>(next.back()) == 0xff) {
+                next.pop_back();
+            }
+            if (next.empty()) {
+                return;
+            }
+            next.back() = static_cast<char>(static_cast<unsigned char>(next.back()) + 1);
+            it = seek(next);
+            continue;
+        }
+
+        if (!isMatch(&rows[depth * w])) {
+            ++it;
+            continue;
+        }
+
+        // prefix is accepted, so is every key that starts with it
+        const size_t length = depth;
+        do {
+            if (!f(it, length)) {
+                return;
+            }
+            ++it;
+        } while (it != last && keyOf(it).compare(0, length, prefix) == 0);
+    }
+}
+
+} // namespace nv
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace nv {
+
+class NoteBodySource;
+
+// Counters for tuning the budget
+struct NoteBodyCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+    size_t budget = 0;
+};
+
+// Least-recently-used note bodies, keyed by the source that loaded them,
+// up to a budget of body bytes. Evicting only drops the cache's reference:
+// a body still held elsewhere (by the editor, or a note being indexed)
+// stays alive until that holder lets go. Thread-safe.
+class NoteBodyCache {
+public:
+    static constexpr size_t kDefaultBudget = 64 * 1024 * 1024;
+
+    explicit NoteBodyCache(size_t budget = kDefaultBudget);
+    NoteBodyCache(const NoteBodyCache&) = delete;
+    NoteBodyCache& operator=(const NoteBodyCache&) = delete;
+
+    // The body cached for source, or nullptr
+    std::shared_ptr<const std::string> find(const NoteBodySource* source);
+    // A body larger than the whole budget isn't kept
+    void insert(const NoteBodySource* source, std::shared_ptr<const std::string> body);
+    // Called when source goes away
+    void erase(const NoteBodySource* source);
+    // Zero disables caching: every access loads the body again
+    void setBudget(size_t bytes);
+    NoteBodyCacheStats stats() const;
+
+private:
+    struct Entry {
+        const NoteBodySource* source;
+        std::shared_ptr<const std::string> body;
+    };
+
+    void evict();
+
+    mutable std::mutex mutex_;
+    std::list<Entry> entries_;  // most recently used first
+    std::unordered_map<const NoteBodySource*, std::list<Entry>::iterator> lookup_;
+    size_t budget_;
+    size_t bytes_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+};
+
+} // namespace nv
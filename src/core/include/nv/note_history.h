@@ -0,0 +1,98 @@
+#pragma once
+
+#include <QString>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "note_model.h"
+#include "storage.h"
+
+namespace nv {
+
+// Which saved versions of a note are kept. The newest version is always
+// kept.
+struct HistoryRetention {
+    // Every version saved within this time
+    std::chrono::hours keepAll{24};
+    // Older versions are thinned to the last one of each day (UTC), up to
+    // this age; anything older goes
+    std::chrono::hours keepDaily{24 * 90};
+    // At most this many versions, dropping the oldest first
+    size_t maxVersions = 500;
+};
+
+// One saved version of a note
+struct NoteVersion {
+    NoteTimestamp saved;
+    uint64_t size = 0;  // bytes of text
+};
+
+// Edit script that turns one text into another: ranges copied from the
+// old text and inserted bytes. An edit between two autosaves usually
+// encodes as a copied prefix, the typed bytes and a copied suffix.
+class TextDelta {
+public:
+    static std::string encode(const std::string& from, const std::string& to);
+    // nullopt if delta is damaged or wasn't made against from
+    static std::optional<std::string> apply(const std::string& from, const char* delta, size_t size);
+};
+
+// Earlier versions of every note, one append-only file per note in
+// .nv_history inside the notes directory. A version is stored as a delta
+// against the one before it, with a full snapshot every few versions so
+// reading one back stays cheap; the retention policy is applied as
+// versions accumulate and, for deleted notes, by pruneDeleted(). Entirely
+// local, so restoring needs no network.
+// Thread-safe.
+class NoteHistory {
+public:
+    explicit NoteHistory(const QString& notesDirectory, HistoryRetention retention = {});
+
+    // Appends text (the note file's content: title line, then body) as the
+    // newest version of the note, unless it equals the current newest
+    VoidResult record(const NoteUUID& uuid, const std::string& text, NoteTimestamp saved);
+    // Oldest first; empty if the note has no history
+    Result<std::vector<NoteVersion>> versions(const NoteUUID& uuid) const;
+    // The text of versions(uuid)[index]
+    Result<std::string> text(const NoteUUID& uuid, size_t index) const;
+    bool contains(const NoteUUID& uuid) const;
+    // Applies the retention policy now rather than at the next append
+    VoidResult prune(const NoteUUID& uuid);
+    // Applies it to the history of every note not in live: deleted notes
+    // get no more appends, so their histories would never age otherwise.
+    // Histories changed within the keepAll period are skipped.
+    VoidResult pruneDeleted(const std::unordered_set<NoteUUID>& live);
+    VoidResult remove(const NoteUUID& uuid);
+
+    [[nodiscard]] const QString& directory() const { return directory_; }
+
+private:
+    // The newest version of a note recently appended to, so autosaves
+    // don't reread and replay its file
+    struct Tail {
+        NoteUUID uuid;
+        qint64 fileSize = 0;
+        std::string text;
+        size_t versions = 0;
+        size_t sinceSnapshot = 0;  // deltas after the last snapshot
+    };
+
+    QString path(const NoteUUID& uuid) const;
+    VoidResult pruneLocked(const NoteUUID& uuid, NoteTimestamp now);
+    // The note's tail, moved to the front of tails_, or nullptr
+    Tail* findTail(const NoteUUID& uuid);
+    void dropTail(const NoteUUID& uuid);
+
+    QString directory_;
+    HistoryRetention retention_;
+    mutable std::mutex mutex_;
+    std::list<Tail> tails_;  // most recently used first; guarded by mutex_
+};
+
+} // namespace nv
@@ -1,13 +1,52 @@
 #pragma once
 
 #include <string>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <memory>
 #include <optional>
+#include <functional>
 
 namespace nv {
 
-using NoteUUID = std::string;
+// 128-bit note id, compared and hashed as two words. Notes created here get
+// random (version 4) UUIDs. Text only appears at the storage boundary:
+// file names and the sync format (fromString, toString).
+class NoteUUID {
+public:
+    // The nil UUID
+    NoteUUID() = default;
+    NoteUUID(uint64_t high, uint64_t low) : high_(high), low_(low) {}
+
+    // Canonical lowercase text (8-4-4-4-12 hex digits) is parsed. Any other
+    // text, e.g. a note file the user named, maps to an id derived from it
+    // (isNamed); the same text always gives the same id. toString() can't
+    // recover that text, so storage keeps it (Note::storageName).
+    static NoteUUID fromString(const std::string& text);
+    // Random version 4 UUID from a generator local to the calling thread
+    static NoteUUID generate();
+
+    // Always canonical text
+    [[nodiscard]] std::string toString() const;
+    [[nodiscard]] bool isNil() const { return high_ == 0 && low_ == 0; }
+    // Derived from non-canonical text by fromString
+    [[nodiscard]] bool isNamed() const;
+    // Big-endian halves: high() holds the first eight bytes of the text form
+    [[nodiscard]] uint64_t high() const { return high_; }
+    [[nodiscard]] uint64_t low() const { return low_; }
+
+    bool operator==(const NoteUUID& other) const { return high_ == other.high_ && low_ == other.low_; }
+    bool operator!=(const NoteUUID& other) const { return !(*this == other); }
+    bool operator<(const NoteUUID& other) const {
+        return high_ != other.high_ ? high_ < other.high_ : low_ < other.low_;
+    }
+
+private:
+    uint64_t high_ = 0;
+    uint64_t low_ = 0;
+};
+
 using NoteTimestamp = std::chrono::system_clock::time_point;
 
 enum class NoteType {
@@ -15,6 +54,20 @@ enum class NoteType {
     CHECKLIST
 };
 
+// Supplies the body of a note that isn't kept in memory, e.g. from its
+// file (see LocalStorage). Called from any thread.
+class NoteBodySource {
+public:
+    virtual ~NoteBodySource() = default;
+    // Empty if the body can't be read any more
+    virtual std::shared_ptr<const std::string> load() const = 0;
+    // Bytes the body takes where it is stored, known without loading it.
+    // May count characters load() drops, such as '\r'.
+    virtual uint64_t storedSize() const = 0;
+};
+
+// Setters are for building a note or a new version of one (see NoteStore);
+// a note that is shared as std::shared_ptr<const Note> never changes.
 class Note {
 public:
     Note(NoteUUID uuid, std::string title, std::string body,
@@ -26,10 +79,35 @@ public:
          std::string deviceId);
     
     [[nodiscard]] const NoteUUID& uuid() const;
+    // The name the note is stored under (file name without extension, sync
+    // id): the text its id was parsed from if that wasn't canonical,
+    // otherwise uuid().toString()
+    [[nodiscard]] std::string storageName() const;
+    // Only kept for named ids (NoteUUID::isNamed); copied to new versions
+    void setStorageName(const std::string& name);
     [[nodiscard]] const std::string& title() const;
-    [[nodiscard]] std::string& title();
-    [[nodiscard]] const std::string& body() const;
-    [[nodiscard]] std::string& body();
+    // Loaded from the note's body source each time unless kept in memory
+    // (set as a string). Hold the result only while using it, so bodies
+    // the source evicts can be freed.
+    [[nodiscard]] std::shared_ptr<const std::string> body() const;
+    // The start of the body shown next to the title: its first line, at
+    // most 50 bytes, without trailing whitespace. Never loads the body.
+    [[nodiscard]] const std::string& preview() const;
+    // The body's size in memory, or in its source's storage while it is
+    // loaded on demand (see NoteBodySource::storedSize). Never loads it.
+    [[nodiscard]] uint64_t storedBodySize() const;
+    void setTitle(std::string title);
+    void setBody(std::string body);
+    // Body loaded on demand; preview is previewOf the body's start. A
+    // known (non-zero) bodyHash saves loading the body to hash it.
+    void setBody(std::shared_ptr<const NoteBodySource> source, std::string preview, uint64_t bodyHash = 0);
+    static std::string previewOf(const std::string& body);
+    // Fast 64-bit hashes of the title, the body and both (not
+    // cryptographic). Each field's hash is cached until that field changes,
+    // so a title edit doesn't rehash the body.
+    [[nodiscard]] uint64_t titleHash() const;
+    [[nodiscard]] uint64_t bodyHash() const;
+    [[nodiscard]] uint64_t contentHash() const;
     [[nodiscard]] NoteTimestamp created() const;
     [[nodiscard]] NoteTimestamp modified() const;
     void setModified(NoteTimestamp t);
@@ -47,9 +125,26 @@ public:
     void setDeviceId(const std::string& id);
     
 private:
+    // Zero until computed (a computed hash is never zero). Atomic because
+    // const notes are hashed from several threads, e.g. by the index.
+    struct CachedHash {
+        std::atomic<uint64_t> value{0};
+
+        CachedHash() = default;
+        CachedHash(const CachedHash& other) : value(other.value.load(std::memory_order_relaxed)) {}
+        CachedHash& operator=(const CachedHash& other) {
+            value.store(other.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            return *this;
+        }
+        void reset() { value.store(0, std::memory_order_relaxed); }
+    };
+
     NoteUUID uuid_;
+    std::string storage_name_;                         // empty unless uuid_ is named
     std::string title_;
-    std::string body_;
+    std::shared_ptr<const std::string> body_;          // nullptr if loaded on demand
+    std::shared_ptr<const NoteBodySource> body_source_;
+    std::string preview_;
     NoteTimestamp created_;
     NoteTimestamp modified_;
     
@@ -59,6 +154,20 @@ private:
     int64_t createdAtMillis_;
     int64_t updatedAtMillis_;
     std::string deviceId_;
+
+    mutable CachedHash title_hash_;
+    mutable CachedHash body_hash_;
 };
 
 } // namespace nv
+
+namespace std {
+template <>
+struct hash<nv::NoteUUID> {
+    // Random ids need little mixing; this also spreads hand-made ones
+    size_t operator()(const nv::NoteUUID& uuid) const noexcept {
+        const uint64_t h = (uuid.high() ^ (uuid.low() * 0x9e3779b97f4a7c15ull)) * 0xbf58476d1ce4e5b9ull;
+        return static_cast<size_t>(h ^ (h >> 31));
+    }
+};
+} // namespace std
@@ -3,45 +3,192 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <map>
 #include <mutex>
 #include <memory>
+#include <functional>
 
 #include "note_model.h"
 
 namespace nv {
 
+// Notes are shared immutably: to edit one, copy it, change the copy and
+// pass it to the store as the note's new version. Whoever still holds the
+// old version keeps reading it unchanged.
+using NoteList = std::vector<std::shared_ptr<const Note>>;
+
+// Changes applied to a store as one unit: adds first, then updates, then
+// deletes. Observers get the net effect, e.g. a note added and deleted in
+// the same set isn't reported at all.
+struct NoteChangeSet {
+    std::vector<std::shared_ptr<const Note>> added;
+    std::vector<std::shared_ptr<const Note>> updated;
+    std::vector<NoteUUID> deleted;
+
+    bool empty() const { return added.empty() && updated.empty() && deleted.empty(); }
+};
+
+// Net effect of several change sets in a row, e.g. an update followed by
+// a delete is just the delete, and a delete followed by an add of the same
+// uuid an update.
+class NoteChangeQueue {
+public:
+    // One change each; updates and deletes are of notes that existed
+    void add(std::shared_ptr<const Note> note);
+    void update(std::shared_ptr<const Note> note);
+    void remove(const NoteUUID& uuid);
+    void append(const NoteChangeSet& changes);
+    bool empty() const { return touched_.empty(); }
+    // The net change since the last take(), in first-touched order
+    NoteChangeSet take();
+
+private:
+    struct Touched {
+        NoteUUID uuid;
+        std::shared_ptr<const Note> note;  // nullptr while deleted
+        bool existed;                // before the first queued change
+    };
+    // existed only counts for a uuid's first change
+    void touch(const NoteUUID& uuid, std::shared_ptr<const Note> note, bool existed);
+
+    std::unordered_map<NoteUUID, size_t> index_;
+    std::vector<Touched> touched_;
+};
+
+// Numbers every change to a store's notes, so a consumer can catch up from
+// the last sequence number it saw instead of comparing every note. Only a
+// note's latest change is kept, which gives the net effect since any
+// cursor (like NoteChangeQueue). Deleted notes are remembered up to
+// kMaxDeleted; beyond that the oldest deletions are forgotten.
+class NoteChangeJournal {
+public:
+    static constexpr size_t kMaxDeleted = 4096;
+
+    struct Entry {
+        uint64_t sequence;
+        NoteUUID uuid;
+        bool deleted;
+    };
+
+    // Assigns the next sequence number to a change of uuid
+    uint64_t record(const NoteUUID& uuid, bool deleted);
+    // The latest sequence number handed out, 0 before any change
+    uint64_t sequence() const { return sequence_; }
+    // Notes changed after sequence, oldest change first
+    std::vector<Entry> since(uint64_t sequence) const;
+    // False if a deletion after sequence has been forgotten
+    bool covers(uint64_t sequence) const { return sequence >= forgotten_; }
+
+private:
+    struct Change {
+        NoteUUID uuid;
+        bool deleted;
+    };
+
+    std::map<uint64_t, Change> changes_;             // by sequence
+    std::unordered_map<NoteUUID, uint64_t> latest_;  // into changes_
+    uint64_t sequence_ = 0;
+    uint64_t forgotten_ = 0;  // latest sequence of a forgotten deletion
+    size_t deleted_ = 0;      // deletions in changes_
+};
+
+// A note changed after a journal cursor
+struct NoteJournalEntry {
+    uint64_t sequence = 0;
+    NoteUUID uuid;
+    std::shared_ptr<const Note> note;  // current version, nullptr if deleted
+};
+
+// What changed since a cursor, see INoteStore::changesSince
+struct NoteJournalChanges {
+    std::vector<NoteJournalEntry> entries;  // oldest change first
+    uint64_t sequence = 0;                  // cursor for the next read
+    // False if some deletions after the cursor were forgotten: notes the
+    // consumer knows that aren't in getAllNotes() are gone
+    bool complete = true;
+};
+
 class NoteStoreObserver {
 public:
-    virtual void onNoteAdded(std::shared_ptr<Note> note) = 0;
-    virtual void onNoteUpdated(std::shared_ptr<Note> note) = 0;
+    virtual void onNoteAdded(std::shared_ptr<const Note> note) = 0;
+    virtual void onNoteUpdated(std::shared_ptr<const Note> note) = 0;
     virtual void onNoteDeleted(const NoteUUID& uuid) = 0;
+    // Called with the net change since the previous call (see
+    // NoteChangeQueue); never with an empty set. By default it calls the
+    // per-note methods above, so observers only override it to handle a
+    // set at once.
+    virtual void onNotesChanged(const NoteChangeSet& changes);
 };
 
+// Runs an observer's delivery task, e.g. by posting it to the observer's
+// thread. Tasks from one store never run concurrently for one observer.
+using NoteEventDispatcher = std::function<void(std::function<void()>)>;
+
 class INoteStore {
 public:
     virtual ~INoteStore() = default;
-    virtual void addObserver(NoteStoreObserver* obs) = 0;
+    // Observers are notified after the change is committed and the store
+    // unlocked, so they may read the store (and other threads aren't held
+    // up by them). Without a dispatcher, the mutating thread delivers the
+    // change before the mutator returns. Remove an observer on the thread
+    // its notifications run on.
+    virtual void addObserver(NoteStoreObserver* obs, NoteEventDispatcher dispatcher = {}) = 0;
     virtual void removeObserver(NoteStoreObserver* obs) = 0;
-    virtual void addNote(std::shared_ptr<Note> note) = 0;
-    virtual void updateNote(std::shared_ptr<Note> note) = 0;
+    virtual void addNote(std::shared_ptr<const Note> note) = 0;
+    virtual void updateNote(std::shared_ptr<const Note> note) = 0;
     virtual void deleteNote(const NoteUUID& uuid) = 0;
-    virtual std::shared_ptr<Note> getNote(const NoteUUID& uuid) = 0;
-    virtual std::vector<std::shared_ptr<Note>> getAllNotes() = 0;
+    // Applies many changes with one observer notification, e.g. when
+    // loading or syncing; updates and deletes of unknown notes are ignored
+    virtual void applyChanges(const NoteChangeSet& changes) = 0;
+    virtual std::shared_ptr<const Note> getNote(const NoteUUID& uuid) = 0;
+    // Snapshot of every note in no particular order; later changes don't
+    // affect it
+    virtual std::shared_ptr<const NoteList> getAllNotes() = 0;
+    // Every note added, updated or deleted after the journal sequence
+    // number since, with its state now. A consumer keeps the returned
+    // sequence as its cursor; 0 gets every note in the store. Numbering
+    // starts over with each store, so cursors aren't meant to be persisted.
+    virtual NoteJournalChanges changesSince(uint64_t since) = 0;
 };
 
 class NoteStore : public INoteStore {
 public:
-    void addObserver(NoteStoreObserver* obs) override;
+    void addObserver(NoteStoreObserver* obs, NoteEventDispatcher dispatcher = {}) override;
     void removeObserver(NoteStoreObserver* obs) override;
-    void addNote(std::shared_ptr<Note> note) override;
-    void updateNote(std::shared_ptr<Note> note) override;
+    void addNote(std::shared_ptr<const Note> note) override;
+    void updateNote(std::shared_ptr<const Note> note) override;
     void deleteNote(const NoteUUID& uuid) override;
-    std::shared_ptr<Note> getNote(const NoteUUID& uuid) override;
-    std::vector<std::shared_ptr<Note>> getAllNotes() override;
+    void applyChanges(const NoteChangeSet& changes) override;
+    std::shared_ptr<const Note> getNote(const NoteUUID& uuid) override;
+    // Shares the store's list without copying; the next change copies it
+    // instead if the snapshot is still held
+    std::shared_ptr<const NoteList> getAllNotes() override;
+    NoteJournalChanges changesSince(uint64_t since) override;
     
 private:
-    std::unordered_map<NoteUUID, std::shared_ptr<Note>> notes_;
-    std::vector<NoteStoreObserver*> observers_;
+    // Defined in note_store.cpp
+    struct Subscription;
+
+    // Records changes in the journal and queues them for every observer;
+    // mutex_ must be held. Returns the subscriptions that need a delivery
+    // task (none scheduled yet).
+    std::vector<std::shared_ptr<Subscription>> enqueue(const NoteChangeSet& changes);
+    // Schedules deliveries; called after mutex_ is released
+    static void dispatch(const std::vector<std::shared_ptr<Subscription>>& subscriptions);
+
+    // The list to change in place, copied first if a snapshot of it is
+    // still in use; mutex_ must be held
+    NoteList& writableNotes();
+    // Inserts or replaces; false if the note wasn't stored yet
+    bool putNote(std::shared_ptr<const Note> note);
+    // Only replaces a stored note; false if there was none
+    bool replaceNote(std::shared_ptr<const Note> note);
+    bool eraseNote(const NoteUUID& uuid);
+
+    std::shared_ptr<NoteList> notes_ = std::make_shared<NoteList>();
+    std::unordered_map<NoteUUID, size_t> positions_;  // into *notes_
+    std::vector<std::shared_ptr<Subscription>> observers_;
+    NoteChangeJournal journal_;
     mutable std::mutex mutex_;
 };
 
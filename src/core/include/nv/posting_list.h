@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nv {
+
+// Dense per-index note number. Posting lists store these instead of Note*
+// so they can be kept as sorted, contiguous arrays.
+using NoteOrdinal = uint32_t;
+using PostingList = std::vector<NoteOrdinal>;
+
+// Non-owning view of a sorted, duplicate-free run of ordinals.
+struct PostingSpan {
+    const NoteOrdinal* data = nullptr;
+    size_t size = 0;
+
+    PostingSpan() = default;
+    PostingSpan(const NoteOrdinal* d, size_t n) : data(d), size(n) {}
+    PostingSpan(const PostingList& list) : data(list.data()), size(list.size()) {}
+};
+
+// Intersects two sorted posting lists into out (out is overwritten, but its
+// capacity is reused). Picks galloping search when one side is much smaller
+// than the other and a SIMD block kernel otherwise.
+void intersectPostings(PostingSpan a, PostingSpan b, PostingList& out);
+
+// Merges several sorted posting lists into their sorted union. universe is an
+// upper bound on the ordinals involved and lets dense unions use a bitmap.
+void unionPostings(const std::vector<PostingSpan>& lists, NoteOrdinal universe, PostingList& out);
+
+// Ordinals of a that are not in b, into out (overwritten). Used to apply
+// exclusions; gallops through b when it is much longer than a.
+void differencePostings(PostingSpan a, PostingSpan b, PostingList& out);
+
+// Immutable posting lists packed into one byte buffer. Each list is cut
+// into blocks of up to kBlockSize ordinals: a skip entry holds the block's
+// first ordinal, the gaps to the following ones are stored as varints. A
+// list takes one or two bytes per ordinal instead of four, and a reader
+// looking for particular ordinals only decodes the blocks that can hold
+// them.
+class CompressedPostings {
+public:
+    static constexpr size_t kBlockSize = 128;
+
+    // Appends a sorted list; lists are numbered from 0 in append order
+    uint32_t append(PostingSpan list);
+    void shrinkToFit();
+
+    size_t size() const { return lists_.size(); }
+    size_t count(uint32_t list) const { return lists_[list].count; }
+    // All ordinals of list, into out (overwritten)
+    void decode(uint32_t list, PostingList& out) const;
+    // The ordinals of list that are also in within, into out (overwritten)
+    void intersect(uint32_t list, PostingSpan within, PostingList& out) const;
+
+    size_t memoryUsage() const;
+
+private:
+    struct Block {
+        NoteOrdinal first;
+        uint32_t offset;  // of the block's gaps in bytes_
+    };
+    struct List {
+        uint32_t block;  // first block in blocks_
+        uint32_t count;
+    };
+
+    size_t blockCount(const List& list) const { return (list.count + kBlockSize - 1) / kBlockSize; }
+    // Decodes block b (index into blocks_) holding count ordinals into out
+    void decodeBlock(size_t b, size_t count, NoteOrdinal* out) const;
+
+    std::vector<uint8_t> bytes_;
+    std::vector<Block> blocks_;
+    std::vector<List> lists_;
+};
+
+} // namespace nv
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "note_model.h"
+
+namespace nv {
+
+// Counters for tuning the cache size
+struct QueryCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;    // including entries found stale
+    size_t entries = 0;
+    size_t capacity = 0;
+};
+
+// Least-recently-used cache of search results. An entry remembers the
+// index generation it was computed at and only answers lookups for that
+// generation, so any change to the index invalidates every entry at once
+// without visiting them; stale entries are dropped when looked up or
+// evicted. Thread-safe.
+class QueryResultCache {
+public:
+    using Results = std::vector<std::shared_ptr<const Note>>;
+
+    static constexpr size_t kDefaultCapacity = 32;
+
+    explicit QueryResultCache(size_t capacity = kDefaultCapacity);
+    QueryResultCache(const QueryResultCache&) = delete;
+    QueryResultCache& operator=(const QueryResultCache&) = delete;
+
+    // The results stored for key at generation, or nullptr
+    std::shared_ptr<const Results> find(const std::string& key, uint64_t generation);
+    void insert(const std::string& key, uint64_t generation, const Results& results);
+    // Zero disables caching (and counting)
+    void setCapacity(size_t capacity);
+    QueryCacheStats stats() const;
+
+    // Collapses whitespace runs to single spaces and trims the ends, which
+    // never changes what a query matches
+    static std::string normalize(const std::string& query);
+
+private:
+    struct Entry {
+        std::string key;
+        uint64_t generation;
+        std::shared_ptr<const Results> results;
+    };
+
+    void evict();
+
+    mutable std::mutex mutex_;
+    std::list<Entry> entries_;  // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> lookup_;
+    size_t capacity_;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+};
+
+} // namespace nv
@@ -2,36 +2,241 @@
 
 #include <string>
 #include <vector>
-#include <unordered_map>
 #include <mutex>
+#include <atomic>
 #include <memory>
+#include <optional>
+#include <limits>
 
 #include "note_model.h"
+#include "posting_list.h"
+#include "query_cache.h"
 
 namespace nv {
 
+struct SearchOptions {
+    // Polled while searching; once set, the search stops early and returns
+    // an empty (meaningless) result. Used to abandon superseded queries.
+    const std::atomic<bool>* cancelled = nullptr;
+    // When non-zero, the best rankLimit matches (BM25 with a title boost)
+    // come first, best to worst, followed by the remaining matches in index
+    // order. Zero keeps index order for everything.
+    size_t rankLimit = 0;
+};
+
+// Identifies the content a note was indexed from: modification time,
+// stored size (title, newline and Note::storedBodySize) and the title and
+// body hashes (Note::titleHash, bodyHash). A snapshot entry is reused at
+// startup while the metadata still matches the loaded note; that check
+// never loads a body, so the snapshot's body hash is trusted.
+struct NoteFingerprint {
+    int64_t modifiedMillis = 0;
+    uint64_t size = 0;
+    uint64_t titleHash = 0;
+    uint64_t bodyHash = 0;
+
+    static NoteFingerprint of(const Note& note);
+    // Everything but bodyHash, which stays 0
+    static NoteFingerprint metadataOf(const Note& note);
+    bool sameMetadata(const NoteFingerprint& other) const {
+        return modifiedMillis == other.modifiedMillis && size == other.size && titleHash == other.titleHash;
+    }
+    bool sameContent(const NoteFingerprint& other) const {
+        return size == other.size && titleHash == other.titleHash && bodyHash == other.bodyHash;
+    }
+    bool operator==(const NoteFingerprint& other) const {
+        return modifiedMillis == other.modifiedMillis && sameContent(other);
+    }
+    bool operator!=(const NoteFingerprint& other) const { return !(*this == other); }
+};
+
+// Occurrences of a term in each field of one note
+struct TermFrequency {
+    uint32_t title = 0;
+    uint32_t body = 0;
+};
+
+// A matched range of a note field, in bytes
+struct MatchSpan {
+    uint32_t offset = 0;
+    uint32_t length = 0;
+};
+
+// Where a query matched inside a note; spans are sorted and don't overlap
+struct NoteMatches {
+    std::vector<MatchSpan> title;
+    std::vector<MatchSpan> body;
+};
+
+// Approximate heap bytes held by the current index version, by structure
+struct IndexMemoryUsage {
+    size_t termArena = 0;        // interned term text and its lookup table
+    size_t termTables = 0;       // sorted term ids of each segment (all and title)
+    size_t postings = 0;         // compressed term posting lists (all and title)
+    size_t trigramPostings = 0;  // trigram keys and lists (substring matching)
+    size_t filters = 0;          // type/checklist bitmaps, modification times
+    size_t noteTerms = 0;        // per-note term id arrays
+    size_t notePositions = 0;    // per-note term frequencies and offsets
+    size_t noteTables = 0;       // note records, uuid lookup, deleted bitmap
+
+    size_t total() const {
+        return termArena + termTables + postings + trigramPostings + filters + noteTerms + notePositions +
+               noteTables;
+    }
+};
+
+// Searches never block on writers: every change publishes a new immutable
+// version of the index, and a search keeps using the version it started
+// with. Writers are serialized among themselves.
 class SearchIndex {
 public:
-    void indexNote(std::shared_ptr<Note> note);
+    SearchIndex();
+    ~SearchIndex();
+
+    void indexNote(std::shared_ptr<const Note> note);
+    // Indexes many notes as a single change (one new version instead of
+    // one per note), e.g. when loading the notes directory. Large batches
+    // are tokenized on all cores before the write lock is taken.
+    void indexNotes(const std::vector<std::shared_ptr<const Note>>& notes);
+    void indexNotes(const std::shared_ptr<const Note>* notes, size_t count);
     void removeNote(const NoteUUID& uuid);
-    void updateNote(std::shared_ptr<Note> note);
-    std::vector<std::shared_ptr<Note>> filter(const std::string& query) const;
+    // Only the changed fields are tokenized again: a note whose title and
+    // body hashes match its indexed entry keeps the entry's terms, and a
+    // title edit keeps the body's. An update racing a removal of the note,
+    // or a newer version of it (by modified()), is dropped.
+    void updateNote(std::shared_ptr<const Note> note);
+    // Results are cached per query and rankLimit (see QueryResultCache)
+    // until the next change to the index.
+    std::vector<std::shared_ptr<const Note>> filter(const std::string& query,
+                                                    const SearchOptions& options = {}) const;
+    // Re-checks only the given candidates (typically the results of a query
+    // that this one refines, see QueryParser::isRefinementOf) instead of
+    // searching the whole index. Candidates no longer indexed are dropped.
+    std::vector<std::shared_ptr<const Note>> refine(const std::string& query,
+                                                    const std::vector<std::shared_ptr<const Note>>& candidates,
+                                                    const SearchOptions& options = {}) const;
+    // Where query matches inside note (a search hit), for highlighting.
+    // Looked up from term offsets recorded at indexing time, so the note
+    // text isn't scanned again. Empty if the note isn't indexed.
+    NoteMatches matchSpans(const std::string& query, const Note& note) const;
+    // Like QueryParser::isRefinementOf, but also accounts for the active
+    // matching mode.
+    bool canRefine(const std::string& query, const std::string& previous) const;
+    // Enables infix matching: query tokens of three or more characters match
+    // anywhere inside a term ("base" finds "database"). Candidates come from
+    // a trigram index that is only built while this is on.
+    void setSubstringMatching(bool enabled);
+    bool substringMatching() const;
+    // Enables typo tolerance: query words of four or more characters also
+    // match terms within one edit (insertion, deletion, substitution), words
+    // of eight or more within two, capped at maxEdits (0 turns it off).
+    // Such terms rank below exact matches.
+    void setFuzzyMatching(int maxEdits);
+    int fuzzyMatching() const;
     void clear();
-    static std::string generateUUID();
-    
+    // Binary snapshot of the term dictionary, posting lists and per-note
+    // fingerprints (see IndexSnapshot). Removed notes are left out.
+    std::string serialize() const;
+    // Replaces the index with a snapshot produced by serialize(), keeping
+    // only entries whose note is in notes with unchanged fingerprint
+    // metadata. Reads no note bodies.
+    // Returns the notes that still have to be indexed, or nullopt (and an
+    // empty index) if data is not a usable snapshot.
+    std::optional<std::vector<std::shared_ptr<const Note>>> restore(
+        const char* data, size_t size, const std::vector<std::shared_ptr<const Note>>& notes);
+    // Where the index's memory goes; takes the write lock while counting
+    IndexMemoryUsage memoryUsage() const;
+    // Incremented by every change that can affect search results. Writes
+    // that change nothing (removing an unknown note, re-indexing an
+    // unchanged one) keep it.
+    uint64_t generation() const;
+    void setResultCacheCapacity(size_t capacity);
+    QueryCacheStats resultCacheStats() const;
+
 private:
-    void indexNoteInternal(std::shared_ptr<Note> note);
-    void removeNoteInternal(const NoteUUID& uuid);
-    std::vector<std::string> tokenize(const std::string& s) const;
-    std::unordered_map<std::string, std::vector<Note*>> terms_to_notes_;
-    std::unordered_map<Note*, std::vector<std::string>> note_to_terms_;
-    std::vector<std::shared_ptr<Note>> all_notes_;
-    mutable std::mutex mutex_;
+    // Defined in search_index.cpp
+    struct TokenizedNotes;
+    struct IndexedNote;
+    struct Segment;
+    struct Version;
+    struct Transaction;
+
+    std::shared_ptr<const Version> current() const;
+    void publish(Transaction& txn);
+    void indexTokenized(Transaction& txn, TokenizedNotes& notes);
+    void indexNoteInternal(Transaction& txn, std::shared_ptr<const IndexedNote> entry);
+    // False if the note wasn't indexed
+    bool removeNoteInternal(Transaction& txn, const NoteUUID& uuid);
+
+    // Only replaced while holding write_mutex_; always read and written
+    // with std::atomic_load / std::atomic_store.
+    std::shared_ptr<const Version> current_;
+    mutable std::mutex write_mutex_;
+    uint64_t generation_ = 0;  // guarded by write_mutex_
+    mutable QueryResultCache result_cache_;
+};
+
+// Parsed search query. Words match like single-word queries (as prefixes,
+// or as substrings in substring mode).
+struct QueryNode {
+    enum class Kind {
+        Term,      // words[0]
+        Phrase,    // words, as consecutive tokens of one field
+        And,       // every child
+        Or,        // any child
+        Not,       // not children[0]
+        Type,      // notes of type noteType
+        Has,       // notes with a checklist item in state item
+        Modified   // notes modified in [modifiedFrom, modifiedTo)
+    };
+    // Where a Term or Phrase has to occur
+    enum class Field { Any, Title, Body };
+    enum class Item { Unchecked, Checked };
+
+    struct Word {
+        std::string text;
+        Field field = Field::Any;
+    };
+
+    Kind kind = Kind::Term;
+    std::vector<std::string> words;
+    std::vector<QueryNode> children;
+    Field field = Field::Any;
+    NoteType noteType = NoteType::TEXT;
+    Item item = Item::Unchecked;
+    // Milliseconds since the epoch
+    int64_t modifiedFrom = std::numeric_limits<int64_t>::min();
+    int64_t modifiedTo = std::numeric_limits<int64_t>::max();
+    // Set if the range is relative to the time of parsing (modified:7d)
+    bool relativeTime = false;
+
+    // Words that must or may match (everything outside Not), e.g. for
+    // ranking and highlighting
+    void collectWords(std::vector<Word>& out) const;
 };
 
 class QueryParser {
 public:
     static std::vector<std::string> tokenize(const std::string& s);
+    // Parses whitespace-separated words (all required), "quoted phrases",
+    // -excluded words, phrases or groups, OR between alternatives and
+    // (parentheses), plus these filters:
+    //   title:word, body:word, title:"phrase"  match in one field only
+    //   type:checklist, type:text              by note type
+    //   has:unchecked, has:checked             by checklist item state
+    //   modified:7d (also h, w)                changed within that time
+    //   modified:>2026-01-01 (>, >=, <, <=)    relative to a local date
+    //   modified:2026-01-01                    changed on that day
+    // A filter with an unknown value is an ordinary word. Never fails:
+    // unbalanced quotes and parentheses are closed at the end, stray
+    // operators are ignored. Returns nullopt if the query has no words or
+    // filters at all.
+    static std::optional<QueryNode> parse(const std::string& query);
+    // True if query only appends characters to previous and uses no
+    // operators or filters (field-scoped words are fine). Such a query can
+    // only narrow the result set, so it may be answered by refining
+    // previous results.
+    static bool isRefinementOf(const std::string& query, const std::string& previous);
 };
 
 } // namespace nv
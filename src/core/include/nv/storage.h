@@ -4,6 +4,9 @@
 #include <variant>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <optional>
 #include <filesystem>
 #include <QString>
 #include <QNetworkAccessManager>
@@ -12,6 +15,7 @@
 #include <QUrl>
 
 #include "note_model.h"
+#include "note_body_cache.h"
 
 namespace nv {
 
@@ -68,25 +72,74 @@ inline const T& getSuccess(const WebDAVResult<T>& r) {
     return std::get<T>(r);
 }
 
+class NoteHistory;
+class FileBody;
+
 class IStorage {
 public:
     virtual ~IStorage() = default;
-    virtual Result<std::vector<std::shared_ptr<Note>>> readAllNotes() = 0;
+    virtual Result<std::vector<std::shared_ptr<const Note>>> readAllNotes() = 0;
     virtual VoidResult writeNote(const Note& note) = 0;
     virtual VoidResult deleteNote(const NoteUUID& uuid) = 0;
+    // After writeNote(note) succeeded: an equivalent version of note whose
+    // body is read back from storage when needed rather than kept in
+    // memory, to replace note in the store. nullptr if there is none.
+    virtual std::shared_ptr<const Note> storedVersion(const Note& /*note*/) { return nullptr; }
 };
 
 class LocalStorage : public IStorage {
 public:
     explicit LocalStorage(const QString& directory);
-    Result<std::vector<std::shared_ptr<Note>>> readAllNotes() override;
+    ~LocalStorage() override;
+    // Reads titles, previews and metadata only; each body is loaded from
+    // its file when first needed and then kept in the body cache
+    Result<std::vector<std::shared_ptr<const Note>>> readAllNotes() override;
+    // Skips the write if the file still holds note's content (same content
+    // hash as last read or written here, and untouched since). Every write
+    // is recorded in history(), and so is the file's previous content if
+    // the history doesn't have it yet.
     VoidResult writeNote(const Note& note) override;
+    // The note's history is kept, so a deleted note can still be restored
     VoidResult deleteNote(const NoteUUID& uuid) override;
+    // Reads the body from the note's file (through the body cache), as long
+    // as the file still holds note's content
+    std::shared_ptr<const Note> storedVersion(const Note& note) override;
+    NoteHistory& history() { return *history_; }
+    // Body bytes kept in memory for notes read from files (see NoteBodyCache)
+    void setBodyCacheBudget(size_t bytes);
+    NoteBodyCacheStats bodyCacheStats() const;
     
 private:
+    // A note file as last read or written by this storage
+    struct StoredFile {
+        uint64_t contentHash = 0;  // 0 if not known (body not read yet)
+        qint64 size = 0;
+        qint64 modifiedMillis = 0;
+        bool recorded = false;  // content is the newest version in history()
+    };
+
     QString directory_;
-    QString notePath(const NoteUUID& uuid) const;
-    std::string readFile(const QString& path) const;
+    std::mutex stored_mutex_;
+    std::unordered_map<NoteUUID, StoredFile> stored_;
+    // The body each note file was read into, until the file is rewritten
+    std::unordered_map<NoteUUID, std::weak_ptr<FileBody>> file_bodies_;
+    // File names (Note::storageName) of notes with named ids
+    std::unordered_map<NoteUUID, std::string> names_;
+    std::shared_ptr<NoteBodyCache> body_cache_;
+    std::unique_ptr<NoteHistory> history_;
+    void remember(const NoteUUID& uuid, uint64_t contentHash, const QString& path, bool recorded = false);
+    // The file as last read or written here, if it hasn't changed since
+    std::optional<StoredFile> unchangedFile(const NoteUUID& uuid, const QString& path);
+    bool isStored(const NoteUUID& uuid, uint64_t contentHash, const QString& path);
+    // Records the file's current content as a version of the note, unless
+    // it's known to be recorded already
+    void recordFileVersion(const NoteUUID& uuid, const QString& path);
+    // Keeps the body read from the note's file in memory before the file
+    // is rewritten or removed, for versions of the note still using it
+    void pinFileBody(const NoteUUID& uuid);
+    QString notePath(const NoteUUID& uuid);
+    // Also remembers the note's file name for later calls by id
+    QString notePath(const Note& note);
     void writeFile(const QString& path, const std::string& content) const;
 };
 
@@ -95,7 +148,7 @@ public:
     WebDAVStorage(const QString& serverAddress, const QString& username, const QString& password);
     ~WebDAVStorage() override;
     
-    Result<std::vector<std::shared_ptr<Note>>> readAllNotes() override;
+    Result<std::vector<std::shared_ptr<const Note>>> readAllNotes() override;
     VoidResult writeNote(const Note& note) override;
     VoidResult deleteNote(const NoteUUID& uuid) override;
     
@@ -110,6 +163,9 @@ private:
     QString username_;
     QString password_;
     mutable QNetworkAccessManager* manager_;
+    // File names (Note::storageName) of notes with named ids, as listed or
+    // written
+    std::unordered_map<NoteUUID, std::string> names_;
     
     QString buildUrl(const QString& fileName) const;
     std::string sendRequest(const QString& url, const QString& method, 
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace nv {
+
+using TermId = uint32_t;
+
+// Every distinct term an index has seen, stored once in large character
+// blocks. Ids are handed out in insertion order and never change, so notes
+// and posting lists refer to terms by id instead of holding copies.
+//
+// Only one thread interns at a time (the index writer). Other threads may
+// call term() concurrently for any id that was handed to them through a
+// synchronizing publish, since interning never moves stored terms. Terms
+// are never removed; a new arena is started when the index is cleared or
+// restored, or when it compacts away the terms no note uses any more.
+class TermArena {
+public:
+    TermArena() = default;
+    TermArena(const TermArena&) = delete;
+    TermArena& operator=(const TermArena&) = delete;
+
+    // The id of term, adding it if it is new
+    TermId intern(std::string_view term);
+    std::string_view term(TermId id) const {
+        const size_t v = static_cast<size_t>(id) + kFirstChunkTerms;
+        const int chunk = highestBit(v) - kFirstChunkBits;
+        const Entry& entry = chunks_[chunk][v - (size_t{1} << (chunk + kFirstChunkBits))];
+        return std::string_view(entry.data, entry.size);
+    }
+    size_t size() const { return size_; }
+
+    size_t memoryUsage() const;
+
+private:
+    struct Entry {
+        const char* data;
+        uint32_t size;
+    };
+
+    // Entry chunks double in size, so a fixed directory covers every id and
+    // existing entries never move.
+    static constexpr int kFirstChunkBits = 10;
+    static constexpr size_t kFirstChunkTerms = size_t{1} << kFirstChunkBits;
+    static constexpr int kMaxChunks = 32 - kFirstChunkBits + 1;
+    static constexpr size_t kCharBlockSize = 256 * 1024;
+    static constexpr TermId kEmptySlot = ~TermId{0};
+
+    static int highestBit(size_t v) {
+#if defined(_MSC_VER)
+        int bit = 0;
+        while (v >>= 1) {
+            ++bit;
+        }
+        return bit;
+#else
+        return 63 - __builtin_clzll(static_cast<unsigned long long>(v));
+#endif
+    }
+    static uint64_t hash(std::string_view s);
+
+    const char* store(std::string_view term);
+    void grow();
+
+    std::array<std::unique_ptr<Entry[]>, kMaxChunks> chunks_;
+    size_t size_ = 0;
+    // Character storage; blocks are only ever added
+    std::vector<std::unique_ptr<char[]>> char_blocks_;
+    size_t char_block_bytes_ = 0;  // total allocated
+    char* free_ = nullptr;
+    size_t free_size_ = 0;
+    // Open-addressing table of ids, for intern() only
+    std::vector<TermId> slots_;
+};
+
+} // namespace nv
@@ -40,15 +40,18 @@ public:
     void triggerSyncOnSearch();  // Sync when user stops typing (debounced)
     
     // Sync direction
-    void uploadNote(const Note& note);  // Upload single note to WebDAV
+    bool uploadNote(const Note& note);  // Upload single note to WebDAV; false on failure
     void downloadNotes();  // Download all notes from WebDAV
     
     // Conflict resolution
     static bool resolveConflict(const Note& localNote, const Note& remoteNote);
+    // Same title, body (by content hash) and type: nothing to transfer,
+    // whatever the timestamps say
+    static bool sameContent(const Note& localNote, const Note& remoteNote);
     
     // File listing
-    std::vector<std::shared_ptr<Note>> listRemoteNotes();
-    std::unordered_map<std::string, NoteTimestamp> getRemoteNoteTimestamps();
+    std::vector<std::shared_ptr<const Note>> listRemoteNotes();
+    std::unordered_map<NoteUUID, NoteTimestamp> getRemoteNoteTimestamps();
     
     // Check if a file is a valid note file
     static bool isNoteFile(const QString& fileName);
@@ -56,20 +59,20 @@ public:
     // Check if a note has a newer version on WebDAV
     // Returns true if WebDAV has a newer version, false otherwise
     // Note: This is a blocking call that performs network I/O
-    bool checkRemoteNoteForUpdate(const std::string& uuid);
+    bool checkRemoteNoteForUpdate(const NoteUUID& uuid);
     
     // Download and update a note from WebDAV if remote is newer
-    void downloadNoteIfRemoteNewer(const std::string& uuid);
+    void downloadNoteIfRemoteNewer(const NoteUUID& uuid);
 
 signals:
     void syncStarted();
     void syncFinished(bool success);
     void syncError(const QString& error);
-    void noteUploaded(std::shared_ptr<Note> note);
-    void noteDownloaded(std::shared_ptr<Note> note);
+    void noteUploaded(std::shared_ptr<const Note> note);
+    void noteDownloaded(std::shared_ptr<const Note> note);
     
     // Emitted after checking a remote note
-    void remoteNoteChecked(std::shared_ptr<Note> localNote, std::shared_ptr<Note> remoteNote, bool isRemoteNewer);
+    void remoteNoteChecked(std::shared_ptr<const Note> localNote, std::shared_ptr<const Note> remoteNote, bool isRemoteNewer);
 
 private slots:
     void onSyncTimerTimeout();
@@ -85,11 +88,15 @@ private:
     
     // Sync helpers
     void performSync();
-    void downloadMissingOrUpdatedNotes(const std::unordered_map<std::string, NoteTimestamp>& remoteNotes);
-    void uploadChangedNotes();
+    // remoteNotes is the remote listing with content, as read by
+    // performSync before either step
+    void downloadMissingOrUpdatedNotes(const std::unordered_map<NoteUUID, std::shared_ptr<const Note>>& remoteNotes);
+    // Uploads notes changed since upload_cursor_ and notes the remote
+    // doesn't have
+    void uploadChangedNotes(const std::unordered_map<NoteUUID, std::shared_ptr<const Note>>& remoteNotes);
     
     // PROPFIND response parsing
-    std::unordered_map<std::string, NoteTimestamp> parsePropfindResponse(const std::string& xmlResponse);
+    std::unordered_map<NoteUUID, NoteTimestamp> parsePropfindResponse(const std::string& xmlResponse);
     
     // XML helpers
     std::string extractTagContent(const std::string& xml, const std::string& tag) const;
@@ -107,6 +114,9 @@ private:
     std::unique_ptr<WebDAVStorage> webdav_storage_;
     INoteStore* note_store_;
     IStorage* storage_;
+    // Note store journal sequence up to which every change was uploaded;
+    // reset whenever the remote changes
+    uint64_t upload_cursor_ = 0;
     
     // Timers
     QTimer sync_timer_;
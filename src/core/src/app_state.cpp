@@ -14,6 +14,10 @@ ApplicationState::ApplicationState()
     , auto_save_delay_(500)
     , font_size_(12)
     , show_previews_(false)
+    , substring_search_(true)
+    , fuzzy_search_edits_(1)
+    , search_cache_size_(32)
+    , body_cache_megabytes_(64)
     , layout_mode_(0)
     , theme_(0)
     , splitter_state_(QByteArray())
@@ -25,6 +29,10 @@ ApplicationState::ApplicationState()
     auto_save_delay_ = settings_.value("NV/autoSaveDelay", auto_save_delay_).toInt();
     font_size_ = settings_.value("NV/fontSize", font_size_).toInt();
     show_previews_ = settings_.value("NV/showPreviews", show_previews_).toBool();
+    substring_search_ = settings_.value("NV/substringSearch", substring_search_).toBool();
+    fuzzy_search_edits_ = settings_.value("NV/fuzzySearchEdits", fuzzy_search_edits_).toInt();
+    search_cache_size_ = settings_.value("NV/searchCacheSize", search_cache_size_).toInt();
+    body_cache_megabytes_ = settings_.value("NV/bodyCacheMegabytes", body_cache_megabytes_).toInt();
     layout_mode_ = settings_.value("NV/layoutMode", 0).toInt();
     theme_ = settings_.value("NV/theme", 0).toInt();
     splitter_state_ = settings_.value("NV/splitterState").toByteArray();
@@ -58,6 +66,22 @@ bool ApplicationState::showPreviews() const {
     return show_previews_;
 }
 
+bool ApplicationState::substringSearch() const {
+    return substring_search_;
+}
+
+int ApplicationState::fuzzySearchEdits() const {
+    return fuzzy_search_edits_;
+}
+
+int ApplicationState::searchCacheSize() const {
+    return search_cache_size_;
+}
+
+int ApplicationState::bodyCacheMegabytes() const {
+    return body_cache_megabytes_;
+}
+
 int ApplicationState::layoutMode() const {
     return layout_mode_;
 }
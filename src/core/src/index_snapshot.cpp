@@ -0,0 +1,53 @@
+#include "nv/index_snapshot.h"
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <iostream>
+
+namespace nv {
+
+IndexSnapshot::IndexSnapshot(const QString& notesDirectory)
+    : path_(QDir(notesDirectory).filePath(".nv_index")) {
+}
+
+std::vector<std::shared_ptr<const Note>> IndexSnapshot::load(
+    SearchIndex& index, const std::vector<std::shared_ptr<const Note>>& notes) const {
+    QFile file(path_);
+    if (!file.open(QIODevice::ReadOnly) || file.size() == 0) {
+        return notes;
+    }
+
+    // The mapping only lives for the duration of restore(); the index keeps
+    // its own copies of everything it needs.
+    std::optional<std::vector<std::shared_ptr<const Note>>> stale;
+    if (uchar* mapped = file.map(0, file.size())) {
+        stale = index.restore(reinterpret_cast<const char*>(mapped), static_cast<size_t>(file.size()), notes);
+        file.unmap(mapped);
+    } else {
+        QByteArray data = file.readAll();
+        stale = index.restore(data.constData(), static_cast<size_t>(data.size()), notes);
+    }
+
+    if (!stale) {
+        // Outdated format or damaged file: fall back to a full rebuild
+        std::cerr << "Warning: Ignoring unusable search index snapshot " << path_.toStdString() << std::endl;
+        return notes;
+    }
+    return std::move(*stale);
+}
+
+bool IndexSnapshot::save(const SearchIndex& index) const {
+    const std::string data = index.serialize();
+
+    // Write to a temporary file and rename, so a crash never leaves a
+    // half-written snapshot behind.
+    QSaveFile file(path_);
+    if (!file.open(QIODevice::WriteOnly)) {
+        std::cerr << "Warning: Failed to write search index snapshot " << path_.toStdString() << std::endl;
+        return false;
+    }
+    file.write(data.data(), static_cast<qint64>(data.size()));
+    return file.commit();
+}
+
+} // namespace nv
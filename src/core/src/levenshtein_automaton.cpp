@@ -0,0 +1,40 @@
+#include "nv/levenshtein_automaton.h"
+#include <algorithm>
+
+namespace nv {
+
+LevenshteinAutomaton::LevenshteinAutomaton(std::string word, int maxEdits)
+    : word_(std::move(word))
+    , max_(static_cast<uint8_t>(std::clamp(maxEdits, 0, 254))) {
+}
+
+void LevenshteinAutomaton::start(uint8_t* state) const {
+    // Nothing consumed yet: reaching word[0, j) takes j insertions
+    const size_t cap = max_ + 1;
+    for (size_t j = 0; j < width(); ++j) {
+        state[j] = static_cast<uint8_t>(std::min(j, cap));
+    }
+}
+
+void LevenshteinAutomaton::step(const uint8_t* parent, char previous, const uint8_t* state, char c,
+                                uint8_t* next) const {
+    const int cap = max_ + 1;
+    next[0] = static_cast<uint8_t>(std::min(state[0] + 1, cap));
+    for (size_t j = 1; j < width(); ++j) {
+        const int substitute = state[j - 1] + (word_[j - 1] == c ? 0 : 1);
+        const int skipInput = state[j] + 1;
+        const int skipWord = next[j - 1] + 1;
+        int best = std::min({substitute, skipInput, skipWord, cap});
+        // "porj" for "proj"
+        if (parent && j > 1 && word_[j - 1] == previous && word_[j - 2] == c) {
+            best = std::min(best, parent[j - 2] + 1);
+        }
+        next[j] = static_cast<uint8_t>(best);
+    }
+}
+
+bool LevenshteinAutomaton::canMatch(const uint8_t* state) const {
+    return *std::min_element(state, state + width()) <= max_;
+}
+
+} // namespace nv
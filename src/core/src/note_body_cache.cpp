@@ -0,0 +1,75 @@
+#include "nv/note_body_cache.h"
+
+namespace nv {
+
+NoteBodyCache::NoteBodyCache(size_t budget)
+    : budget_(budget) {
+}
+
+std::shared_ptr<const std::string> NoteBodyCache::find(const NoteBodySource* source) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = lookup_.find(source);
+    if (it == lookup_.end()) {
+        ++misses_;
+        return nullptr;
+    }
+    ++hits_;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->body;
+}
+
+void NoteBodyCache::insert(const NoteBodySource* source, std::shared_ptr<const std::string> body) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (body->size() > budget_) {
+        return;
+    }
+    auto it = lookup_.find(source);
+    if (it != lookup_.end()) {
+        // Two threads loaded the same body; keep the first
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return;
+    }
+    bytes_ += body->size();
+    entries_.push_front(Entry{source, std::move(body)});
+    lookup_[source] = entries_.begin();
+    evict();
+}
+
+void NoteBodyCache::erase(const NoteBodySource* source) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = lookup_.find(source);
+    if (it == lookup_.end()) {
+        return;
+    }
+    bytes_ -= it->second->body->size();
+    entries_.erase(it->second);
+    lookup_.erase(it);
+}
+
+void NoteBodyCache::setBudget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = bytes;
+    evict();
+}
+
+NoteBodyCacheStats NoteBodyCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    NoteBodyCacheStats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    stats.entries = entries_.size();
+    stats.bytes = bytes_;
+    stats.budget = budget_;
+    return stats;
+}
+
+void NoteBodyCache::evict() {
+    while (bytes_ > budget_) {
+        const Entry& oldest = entries_.back();
+        bytes_ -= oldest.body->size();
+        lookup_.erase(oldest.source);
+        entries_.pop_back();
+    }
+}
+
+} // namespace nv
@@ -0,0 +1,529 @@
+#include "nv/note_history.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSaveFile>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace nv {
+
+namespace {
+
+// History file format: kMagic, then one record per version, oldest first:
+//   kind (1 byte), saved time (ms since the epoch), text size, payload
+//   size, payload, checksum of the record so far (4 bytes, little-endian)
+// The payload is the text itself for a snapshot, or a TextDelta against
+// the previous version's text. Integers are LEB128 varints, so files don't
+// depend on the machine's byte order.
+constexpr char kMagic[4] = {'N', 'V', 'H', '1'};
+constexpr uint8_t kSnapshot = 0;
+constexpr uint8_t kDelta = 1;
+// Most deltas in a row before the next snapshot, bounding how many have
+// to be applied to read a version back
+constexpr size_t kSnapshotInterval = 32;
+// Retention is applied each time the version count reaches a multiple of
+// this
+constexpr size_t kPruneInterval = 64;
+// Notes whose newest version is kept in memory for the next append
+constexpr size_t kCachedTails = 8;
+constexpr int64_t kDayMillis = 24 * 60 * 60 * 1000;
+
+// TextDelta operations: varint (length << 1 | kind), followed by the
+// source offset of a copy or the bytes of an insert
+constexpr uint64_t kCopy = 0;
+constexpr uint64_t kInsert = 1;
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool getVarint(const char*& p, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        const uint8_t byte = static_cast<uint8_t>(*p++);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// FNV-1a
+uint32_t checksum(const char* data, size_t size) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        h = (h ^ static_cast<uint8_t>(data[i])) * 16777619u;
+    }
+    return h;
+}
+
+int64_t toMillis(NoteTimestamp t) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(t.time_since_epoch()).count();
+}
+
+NoteTimestamp fromMillis(int64_t millis) {
+    return NoteTimestamp(std::chrono::duration_cast<NoteTimestamp::duration>(std::chrono::milliseconds(millis)));
+}
+
+struct Record {
+    uint8_t kind = kSnapshot;
+    int64_t savedMillis = 0;
+    uint64_t textSize = 0;
+    const char* payload = nullptr;
+    size_t payloadSize = 0;
+};
+
+// The records of a history file up to the first damaged one; a crash while
+// appending can leave a partial record at the end
+struct ParsedHistory {
+    std::vector<Record> records;
+    size_t validBytes = 0;  // magic and intact records
+};
+
+// nullopt if data isn't a history file at all
+std::optional<ParsedHistory> parseHistory(const char* data, size_t size) {
+    ParsedHistory parsed;
+    if (size == 0) {
+        return parsed;
+    }
+    if (size < sizeof(kMagic) || std::memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+        return std::nullopt;
+    }
+    const char* p = data + sizeof(kMagic);
+    const char* end = data + size;
+    parsed.validBytes = sizeof(kMagic);
+    while (p < end) {
+        const char* start = p;
+        Record record;
+        record.kind = static_cast<uint8_t>(*p++);
+        uint64_t saved = 0;
+        uint64_t payloadSize = 0;
+        if ((record.kind != kSnapshot && record.kind != kDelta) ||
+            (record.kind == kDelta && parsed.records.empty()) ||
+            !getVarint(p, end, saved) || !getVarint(p, end, record.textSize) ||
+            !getVarint(p, end, payloadSize) || end - p < 4 || payloadSize > static_cast<uint64_t>(end - p - 4)) {
+            break;
+        }
+        record.savedMillis = static_cast<int64_t>(saved);
+        record.payload = p;
+        record.payloadSize = static_cast<size_t>(payloadSize);
+        p += payloadSize;
+        const uint8_t* sum = reinterpret_cast<const uint8_t*>(p);
+        const uint32_t stored = sum[0] | (sum[1] << 8) | (sum[2] << 16) | (static_cast<uint32_t>(sum[3]) << 24);
+        if (stored != checksum(start, static_cast<size_t>(p - start))) {
+            break;
+        }
+        p += 4;
+        parsed.records.push_back(record);
+        parsed.validBytes = static_cast<size_t>(p - data);
+    }
+    return parsed;
+}
+
+// Reconstructs the texts of records [first, last], calling visit(i, text)
+// for each. first has to be a snapshot. False if a record doesn't decode.
+template<typename Visit>
+bool replay(const std::vector<Record>& records, size_t first, size_t last, Visit&& visit) {
+    std::string text;
+    for (size_t i = first; i <= last; ++i) {
+        const Record& record = records[i];
+        if (record.kind == kSnapshot) {
+            text.assign(record.payload, record.payloadSize);
+        } else {
+            auto next = TextDelta::apply(text, record.payload, record.payloadSize);
+            if (!next) {
+                return false;
+            }
+            text = std::move(*next);
+        }
+        if (text.size() != record.textSize) {
+            return false;
+        }
+        visit(i, text);
+    }
+    return true;
+}
+
+// Encodes text as the version after previous (nullptr for a note's first
+// version), as a delta unless a snapshot is due or the delta wouldn't be
+// much smaller than the text
+std::string encodeVersion(const std::string* previous, size_t& sinceSnapshot, const std::string& text,
+                          int64_t savedMillis) {
+    uint8_t kind = kSnapshot;
+    std::string delta;
+    if (previous && sinceSnapshot < kSnapshotInterval) {
+        delta = TextDelta::encode(*previous, text);
+        if (delta.size() < text.size() / 2) {
+            kind = kDelta;
+        }
+    }
+    const std::string& payload = kind == kDelta ? delta : text;
+    sinceSnapshot = kind == kDelta ? sinceSnapshot + 1 : 0;
+
+    std::string out;
+    out.push_back(static_cast<char>(kind));
+    putVarint(out, static_cast<uint64_t>(std::max<int64_t>(savedMillis, 0)));
+    putVarint(out, text.size());
+    putVarint(out, payload.size());
+    out.append(payload);
+    const uint32_t sum = checksum(out.data(), out.size());
+    for (int shift = 0; shift < 32; shift += 8) {
+        out.push_back(static_cast<char>(sum >> shift));
+    }
+    return out;
+}
+
+// Which records the retention policy keeps
+std::vector<bool> retained(const std::vector<Record>& records, const HistoryRetention& retention,
+                           int64_t nowMillis) {
+    const int64_t keepAll = std::chrono::duration_cast<std::chrono::milliseconds>(retention.keepAll).count();
+    const int64_t keepDaily = std::chrono::duration_cast<std::chrono::milliseconds>(retention.keepDaily).count();
+    std::vector<bool> keep(records.size(), false);
+    keep.back() = true;
+    for (size_t i = 0; i + 1 < records.size(); ++i) {
+        const int64_t age = nowMillis - records[i].savedMillis;
+        if (age <= keepAll) {
+            keep[i] = true;
+        } else if (age <= keepDaily) {
+            keep[i] = records[i].savedMillis / kDayMillis != records[i + 1].savedMillis / kDayMillis;
+        }
+    }
+    size_t kept = 0;
+    const size_t maxVersions = std::max<size_t>(retention.maxVersions, 1);
+    for (size_t i = records.size(); i-- > 0;) {
+        if (keep[i] && kept++ >= maxVersions) {
+            keep[i] = false;
+        }
+    }
+    return keep;
+}
+
+// Reads a history file; an empty array if there is none
+bool readFile(const QString& path, QByteArray& data) {
+    QFile file(path);
+    if (!file.exists()) {
+        data.clear();
+        return true;
+    }
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    data = file.readAll();
+    return true;
+}
+
+} // namespace
+
+std::string TextDelta::encode(const std::string& from, const std::string& to) {
+    const size_t common = std::min(from.size(), to.size());
+    size_t prefix = 0;
+    while (prefix < common && from[prefix] == to[prefix]) {
+        ++prefix;
+    }
+    size_t suffix = 0;
+    while (suffix < common - prefix && from[from.size() - 1 - suffix] == to[to.size() - 1 - suffix]) {
+        ++suffix;
+    }
+
+    std::string out;
+    putVarint(out, to.size());
+    if (prefix > 0) {
+        putVarint(out, prefix << 1 | kCopy);
+        putVarint(out, 0);
+    }
+    const size_t inserted = to.size() - prefix - suffix;
+    if (inserted > 0) {
+        putVarint(out, inserted << 1 | kInsert);
+        out.append(to, prefix, inserted);
+    }
+    if (suffix > 0) {
+        putVarint(out, suffix << 1 | kCopy);
+        putVarint(out, from.size() - suffix);
+    }
+    return out;
+}
+
+std::optional<std::string> TextDelta::apply(const std::string& from, const char* delta, size_t size) {
+    const char* p = delta;
+    const char* end = delta + size;
+    uint64_t targetSize = 0;
+    if (!getVarint(p, end, targetSize)) {
+        return std::nullopt;
+    }
+    std::string out;
+    while (p < end) {
+        uint64_t op = 0;
+        if (!getVarint(p, end, op)) {
+            return std::nullopt;
+        }
+        const uint64_t length = op >> 1;
+        if (length > targetSize - out.size()) {
+            return std::nullopt;
+        }
+        if ((op & 1) == kInsert) {
+            if (static_cast<uint64_t>(end - p) < length) {
+                return std::nullopt;
+            }
+            out.append(p, static_cast<size_t>(length));
+            p += length;
+        } else {
+            uint64_t offset = 0;
+            if (!getVarint(p, end, offset) || offset > from.size() || length > from.size() - offset) {
+                return std::nullopt;
+            }
+            out.append(from, static_cast<size_t>(offset), static_cast<size_t>(length));
+        }
+    }
+    if (out.size() != targetSize) {
+        return std::nullopt;
+    }
+    return out;
+}
+
+NoteHistory::NoteHistory(const QString& notesDirectory, HistoryRetention retention)
+    : directory_(QDir(notesDirectory).filePath(".nv_history"))
+    , retention_(retention) {
+}
+
+QString NoteHistory::path(const NoteUUID& uuid) const {
+    return QDir(directory_).filePath(QString::fromStdString(uuid.toString() + ".hist"));
+}
+
+NoteHistory::Tail* NoteHistory::findTail(const NoteUUID& uuid) {
+    auto it = std::find_if(tails_.begin(), tails_.end(), [&uuid](const Tail& tail) { return tail.uuid == uuid; });
+    if (it == tails_.end()) {
+        return nullptr;
+    }
+    tails_.splice(tails_.begin(), tails_, it);
+    return &tails_.front();
+}
+
+void NoteHistory::dropTail(const NoteUUID& uuid) {
+    tails_.remove_if([&uuid](const Tail& tail) { return tail.uuid == uuid; });
+}
+
+VoidResult NoteHistory::record(const NoteUUID& uuid, const std::string& text, NoteTimestamp saved) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const QString file = path(uuid);
+
+    Tail* cached = findTail(uuid);
+    if (!cached || QFileInfo(file).size() != cached->fileSize) {
+        dropTail(uuid);
+        Tail tail;
+        tail.uuid = uuid;
+        QByteArray data;
+        if (!readFile(file, data)) {
+            return VoidResult{StorageError::ReadFailed};
+        }
+        auto parsed = parseHistory(data.constData(), static_cast<size_t>(data.size()));
+        if (!parsed) {
+            std::cerr << "Warning: Not a note history file: " << file.toStdString() << std::endl;
+            return VoidResult{StorageError::CorruptFile};
+        }
+        const auto& records = parsed->records;
+        if (!records.empty()) {
+            size_t lastSnapshot = 0;
+            const bool decoded = replay(records, 0, records.size() - 1, [&](size_t i, const std::string& version) {
+                if (records[i].kind == kSnapshot) {
+                    lastSnapshot = i;
+                }
+                if (i + 1 == records.size()) {
+                    tail.text = version;
+                }
+            });
+            if (!decoded) {
+                return VoidResult{StorageError::CorruptFile};
+            }
+            tail.versions = records.size();
+            tail.sinceSnapshot = records.size() - 1 - lastSnapshot;
+        }
+        if (parsed->validBytes < static_cast<size_t>(data.size())) {
+            // Drop a partial record left by an interrupted append
+            if (!QFile::resize(file, static_cast<qint64>(parsed->validBytes))) {
+                return VoidResult{StorageError::WriteFailed};
+            }
+        }
+        tail.fileSize = static_cast<qint64>(parsed->validBytes);
+        tails_.push_front(std::move(tail));
+        if (tails_.size() > kCachedTails) {
+            tails_.pop_back();
+        }
+        cached = &tails_.front();
+    }
+    Tail& tail = *cached;
+
+    if (tail.versions > 0 && tail.text == text) {
+        return VoidResult{SuccessType{}};
+    }
+
+    std::string bytes;
+    if (tail.fileSize == 0) {
+        bytes.append(kMagic, sizeof(kMagic));
+    }
+    bytes += encodeVersion(tail.versions > 0 ? &tail.text : nullptr, tail.sinceSnapshot, text,
+                           toMillis(saved));
+
+    QDir().mkpath(directory_);
+    QFile out(file);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Append) ||
+        out.write(bytes.data(), static_cast<qint64>(bytes.size())) != static_cast<qint64>(bytes.size()) ||
+        !out.flush()) {
+        dropTail(uuid);
+        return VoidResult{StorageError::WriteFailed};
+    }
+    out.close();
+    tail.fileSize += static_cast<qint64>(bytes.size());
+    tail.text = text;
+    ++tail.versions;
+
+    if (tail.versions % kPruneInterval == 0) {
+        return pruneLocked(uuid, saved);
+    }
+    return VoidResult{SuccessType{}};
+}
+
+Result<std::vector<NoteVersion>> NoteHistory::versions(const NoteUUID& uuid) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    QByteArray data;
+    if (!readFile(path(uuid), data)) {
+        return Result<std::vector<NoteVersion>>{StorageError::ReadFailed};
+    }
+    auto parsed = parseHistory(data.constData(), static_cast<size_t>(data.size()));
+    if (!parsed) {
+        return Result<std::vector<NoteVersion>>{StorageError::CorruptFile};
+    }
+    std::vector<NoteVersion> result;
+    result.reserve(parsed->records.size());
+    for (const Record& record : parsed->records) {
+        result.push_back(NoteVersion{fromMillis(record.savedMillis), record.textSize});
+    }
+    return Result<std::vector<NoteVersion>>{std::move(result)};
+}
+
+Result<std::string> NoteHistory::text(const NoteUUID& uuid, size_t index) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    QByteArray data;
+    if (!readFile(path(uuid), data)) {
+        return Result<std::string>{StorageError::ReadFailed};
+    }
+    auto parsed = parseHistory(data.constData(), static_cast<size_t>(data.size()));
+    if (!parsed || index >= parsed->records.size()) {
+        return Result<std::string>{StorageError::CorruptFile};
+    }
+    // Only the deltas since the closest snapshot need applying
+    size_t first = index;
+    while (parsed->records[first].kind != kSnapshot) {
+        --first;
+    }
+    std::string text;
+    const bool decoded = replay(parsed->records, first, index, [&](size_t i, const std::string& version) {
+        if (i == index) {
+            text = version;
+        }
+    });
+    if (!decoded) {
+        return Result<std::string>{StorageError::CorruptFile};
+    }
+    return Result<std::string>{std::move(text)};
+}
+
+bool NoteHistory::contains(const NoteUUID& uuid) const {
+    return QFileInfo(path(uuid)).size() > static_cast<qint64>(sizeof(kMagic));
+}
+
+VoidResult NoteHistory::prune(const NoteUUID& uuid) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pruneLocked(uuid, std::chrono::system_clock::now());
+}
+
+VoidResult NoteHistory::pruneDeleted(const std::unordered_set<NoteUUID>& live) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto now = std::chrono::system_clock::now();
+    const QDateTime recent = QDateTime::fromMSecsSinceEpoch(
+        toMillis(now) - std::chrono::duration_cast<std::chrono::milliseconds>(retention_.keepAll).count());
+    VoidResult result{SuccessType{}};
+    const QFileInfoList files = QDir(directory_).entryInfoList({"*.hist"}, QDir::Files);
+    for (const QFileInfo& info : files) {
+        // Nothing in a history changed since then is old enough to drop
+        if (info.lastModified() > recent) {
+            continue;
+        }
+        const NoteUUID uuid = NoteUUID::fromString(info.completeBaseName().toStdString());
+        if (live.count(uuid) == 0) {
+            auto pruned = pruneLocked(uuid, now);
+            if (!isSuccess(pruned)) {
+                result = pruned;
+            }
+        }
+    }
+    return result;
+}
+
+VoidResult NoteHistory::pruneLocked(const NoteUUID& uuid, NoteTimestamp now) {
+    const QString file = path(uuid);
+    QByteArray data;
+    if (!readFile(file, data)) {
+        return VoidResult{StorageError::ReadFailed};
+    }
+    auto parsed = parseHistory(data.constData(), static_cast<size_t>(data.size()));
+    if (!parsed) {
+        return VoidResult{StorageError::CorruptFile};
+    }
+    const auto& records = parsed->records;
+    if (records.empty()) {
+        return VoidResult{SuccessType{}};
+    }
+    const std::vector<bool> keep = retained(records, retention_, toMillis(now));
+    if (std::all_of(keep.begin(), keep.end(), [](bool k) { return k; })) {
+        return VoidResult{SuccessType{}};
+    }
+
+    // Kept versions are encoded again against the kept version before them
+    std::string out(kMagic, sizeof(kMagic));
+    std::string previous;
+    size_t kept = 0;
+    size_t sinceSnapshot = 0;
+    const bool decoded = replay(records, 0, records.size() - 1, [&](size_t i, const std::string& version) {
+        if (!keep[i]) {
+            return;
+        }
+        out += encodeVersion(kept > 0 ? &previous : nullptr, sinceSnapshot, version, records[i].savedMillis);
+        previous = version;
+        ++kept;
+    });
+    if (!decoded) {
+        return VoidResult{StorageError::CorruptFile};
+    }
+
+    // Written aside and renamed, so a crash keeps the old file intact
+    dropTail(uuid);
+    QSaveFile save(file);
+    if (!save.open(QIODevice::WriteOnly)) {
+        return VoidResult{StorageError::WriteFailed};
+    }
+    save.write(out.data(), static_cast<qint64>(out.size()));
+    if (!save.commit()) {
+        return VoidResult{StorageError::WriteFailed};
+    }
+    return VoidResult{SuccessType{}};
+}
+
+VoidResult NoteHistory::remove(const NoteUUID& uuid) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dropTail(uuid);
+    QFile file(path(uuid));
+    if (file.exists() && !file.remove()) {
+        return VoidResult{StorageError::WriteFailed};
+    }
+    return VoidResult{SuccessType{}};
+}
+
+} // namespace nv
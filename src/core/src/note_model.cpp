@@ -1,17 +1,166 @@
 #include "nv/note_model.h"
 #include <random>
-#include <sstream>
-#include <iomanip>
-#include <array>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
 #include <QHostInfo>
 
 namespace nv {
 
+namespace {
+
+inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// MurmurHash3's 64-bit finalizer
+inline uint64_t fmix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+inline uint64_t mixWord(uint64_t h, uint64_t word) {
+    word *= 0x87c37b91114253d5ull;
+    word = rotl(word, 31);
+    word *= 0x4cf5ad432745937full;
+    h ^= word;
+    return rotl(h, 27) * 5 + 0x52dce729;
+}
+
+// Eight bytes per step (native byte order, so hashes are only comparable
+// on one machine); never returns 0, which marks an unset cache
+uint64_t hashText(const std::string& s, uint64_t seed = 0x9e3779b97f4a7c15ull) {
+    const char* p = s.data();
+    size_t n = s.size();
+    uint64_t h = seed ^ (s.size() * 0xc2b2ae3d27d4eb4full);
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        h = mixWord(h, word);
+    }
+    if (n > 0) {
+        uint64_t word = 0;
+        std::memcpy(&word, p, n);
+        h = mixWord(h, word);
+    }
+    h = fmix64(h);
+    return h != 0 ? h : 1;
+}
+
+uint64_t cached(std::atomic<uint64_t>& value, const std::string& s) {
+    uint64_t h = value.load(std::memory_order_relaxed);
+    if (h == 0) {
+        // Racing threads compute the same value
+        h = hashText(s);
+        value.store(h, std::memory_order_relaxed);
+    }
+    return h;
+}
+
+// Ids derived from names carry the reserved variant 111 (RFC 4122), which
+// random ids never use; generate() sets variant 10
+constexpr uint64_t kVariantMask = 0xe0ull << 56;
+constexpr uint64_t kNamedVariant = 0xe0ull << 56;
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// Lowercase 8-4-4-4-12 only, so that toString() reproduces the text and
+// every other spelling is a name
+bool parseCanonical(const std::string& text, uint64_t& high, uint64_t& low) {
+    if (text.size() != 36) {
+        return false;
+    }
+    uint64_t words[2] = {0, 0};
+    int digits = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (i == 8 || i == 13 || i == 18 || i == 23) {
+            if (text[i] != '-') {
+                return false;
+            }
+            continue;
+        }
+        const int value = hexValue(text[i]);
+        if (value < 0) {
+            return false;
+        }
+        uint64_t& word = words[digits / 16];
+        word = (word << 4) | static_cast<uint64_t>(value);
+        ++digits;
+    }
+    high = words[0];
+    low = words[1];
+    return true;
+}
+
+// splitmix64; each thread seeds its own from std::random_device, so
+// generating never locks
+uint64_t nextRandom() {
+    thread_local uint64_t state = [] {
+        std::random_device rd;
+        return (static_cast<uint64_t>(rd()) << 32) ^ rd();
+    }();
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+} // namespace
+
+NoteUUID NoteUUID::fromString(const std::string& text) {
+    uint64_t high = 0;
+    uint64_t low = 0;
+    if (parseCanonical(text, high, low)) {
+        return NoteUUID(high, low);
+    }
+
+    return NoteUUID(hashText(text), (hashText(text, 0xc2b2ae3d27d4eb4full) & ~kVariantMask) | kNamedVariant);
+}
+
+NoteUUID NoteUUID::generate() {
+    // Version 4 in bits 12-15 of time_hi_and_version, variant 10 in the
+    // top bits of clock_seq_hi_and_reserved
+    const uint64_t high = (nextRandom() & ~0xf000ull) | 0x4000ull;
+    const uint64_t low = (nextRandom() & ~(0xc0ull << 56)) | (0x80ull << 56);
+    return NoteUUID(high, low);
+}
+
+bool NoteUUID::isNamed() const {
+    return (low_ & kVariantMask) == kNamedVariant;
+}
+
+std::string NoteUUID::toString() const {
+    static constexpr char kHex[] = "0123456789abcdef";
+    std::string text(36, '-');
+    size_t pos = 0;
+    for (int digit = 0; digit < 32; ++digit) {
+        if (pos == 8 || pos == 13 || pos == 18 || pos == 23) {
+            ++pos;
+        }
+        const uint64_t word = digit < 16 ? high_ : low_;
+        text[pos++] = kHex[(word >> (60 - 4 * (digit % 16))) & 0xf];
+    }
+    return text;
+}
+
 Note::Note(NoteUUID uuid, std::string title, std::string body,
            NoteTimestamp created, NoteTimestamp modified)
     : uuid_(std::move(uuid))
     , title_(std::move(title))
-    , body_(std::move(body))
+    , body_(std::make_shared<const std::string>(std::move(body)))
+    , preview_(previewOf(*body_))
     , created_(created)
     , modified_(modified)
     , noteType_(NoteType::TEXT)
@@ -28,7 +177,8 @@ Note::Note(NoteUUID uuid, std::string title, std::string body,
            std::string deviceId)
     : uuid_(std::move(uuid))
     , title_(std::move(title))
-    , body_(std::move(body))
+    , body_(std::make_shared<const std::string>(std::move(body)))
+    , preview_(previewOf(*body_))
     , created_(created)
     , modified_(modified)
     , noteType_(noteType)
@@ -42,20 +192,82 @@ const NoteUUID& Note::uuid() const {
     return uuid_;
 }
 
+std::string Note::storageName() const {
+    return storage_name_.empty() ? uuid_.toString() : storage_name_;
+}
+
+void Note::setStorageName(const std::string& name) {
+    if (uuid_.isNamed()) {
+        storage_name_ = name;
+    }
+}
+
 const std::string& Note::title() const {
     return title_;
 }
 
-std::string& Note::title() {
-    return title_;
+std::shared_ptr<const std::string> Note::body() const {
+    if (body_) {
+        return body_;
+    }
+    if (auto body = body_source_->load()) {
+        return body;
+    }
+    return std::make_shared<const std::string>();
+}
+
+const std::string& Note::preview() const {
+    return preview_;
+}
+
+uint64_t Note::storedBodySize() const {
+    return body_ ? body_->size() : body_source_->storedSize();
+}
+
+void Note::setTitle(std::string title) {
+    title_ = std::move(title);
+    title_hash_.reset();
+}
+
+void Note::setBody(std::string body) {
+    body_ = std::make_shared<const std::string>(std::move(body));
+    body_source_.reset();
+    preview_ = previewOf(*body_);
+    body_hash_.reset();
+}
+
+void Note::setBody(std::shared_ptr<const NoteBodySource> source, std::string preview, uint64_t bodyHash) {
+    body_.reset();
+    body_source_ = std::move(source);
+    preview_ = std::move(preview);
+    body_hash_.value.store(bodyHash, std::memory_order_relaxed);
+}
+
+std::string Note::previewOf(const std::string& body) {
+    constexpr size_t kMaxPreview = 50;
+    const size_t end = std::min(body.find('\n'), kMaxPreview);
+    std::string preview = body.substr(0, end);
+    while (!preview.empty() && std::isspace(static_cast<unsigned char>(preview.back()))) {
+        preview.pop_back();
+    }
+    return preview;
+}
+
+uint64_t Note::titleHash() const {
+    return cached(title_hash_.value, title_);
 }
 
-const std::string& Note::body() const {
-    return body_;
+uint64_t Note::bodyHash() const {
+    if (uint64_t h = body_hash_.value.load(std::memory_order_relaxed)) {
+        return h;
+    }
+    return cached(body_hash_.value, *body());
 }
 
-std::string& Note::body() {
-    return body_;
+uint64_t Note::contentHash() const {
+    // Order-dependent, so swapping title and body changes it
+    const uint64_t h = fmix64(mixWord(titleHash(), bodyHash()));
+    return h != 0 ? h : 1;
 }
 
 NoteTimestamp Note::created() const {
@@ -111,43 +323,10 @@ void Note::setDeviceId(const std::string& id) {
     deviceId_ = id;
 }
 
-static std::string generateUUID() {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<uint8_t> dis(0, 255);
-    
-    std::array<uint8_t, 16> bytes;
-    for (int i = 0; i < 16; i++) {
-        bytes[i] = dis(gen);
-    }
-    
-    // Set version to 4 (bits 12-15 of time_hi_and_version)
-    bytes[6] = (bytes[6] & 0x0F) | 0x40;
-    
-    // Set variant to RFC 4122 (bits 6-7 of clock_seq_hi_and_reserved)
-    bytes[8] = (bytes[8] & 0x3F) | 0x80;
-    
-    std::stringstream ss;
-    ss << std::hex << std::setfill('0');
-    
-    // Format: 8-4-4-4-12
-    for (int i = 0; i < 4; i++) ss << std::setw(2) << static_cast<int>(bytes[i]);
-    ss << "-";
-    for (int i = 4; i < 6; i++) ss << std::setw(2) << static_cast<int>(bytes[i]);
-    ss << "-";
-    for (int i = 6; i < 8; i++) ss << std::setw(2) << static_cast<int>(bytes[i]);
-    ss << "-";
-    for (int i = 8; i < 10; i++) ss << std::setw(2) << static_cast<int>(bytes[i]);
-    ss << "-";
-    for (int i = 10; i < 16; i++) ss << std::setw(2) << static_cast<int>(bytes[i]);
-    
-    return ss.str();
-}
-
 std::shared_ptr<Note> createNote(const std::string& title, const std::string& body) {
     auto now = std::chrono::system_clock::now();
     return std::make_shared<Note>(
-        generateUUID(),
+        NoteUUID::generate(),
         title,
         body,
         now,
@@ -1,77 +1,350 @@
 #include "nv/note_store.h"
 
 #include <algorithm>
+#include <atomic>
 
 namespace nv {
 
-void NoteStore::addObserver(NoteStoreObserver* obs) {
+void NoteChangeQueue::touch(const NoteUUID& uuid, std::shared_ptr<const Note> note, bool existed) {
+    auto [it, inserted] = index_.try_emplace(uuid, touched_.size());
+    if (inserted) {
+        touched_.push_back(Touched{uuid, std::move(note), existed});
+    } else {
+        touched_[it->second].note = std::move(note);
+    }
+}
+
+void NoteChangeQueue::add(std::shared_ptr<const Note> note) {
+    const NoteUUID& uuid = note->uuid();
+    touch(uuid, std::move(note), false);
+}
+
+void NoteChangeQueue::update(std::shared_ptr<const Note> note) {
+    const NoteUUID& uuid = note->uuid();
+    touch(uuid, std::move(note), true);
+}
+
+void NoteChangeQueue::remove(const NoteUUID& uuid) {
+    touch(uuid, nullptr, true);
+}
+
+void NoteChangeQueue::append(const NoteChangeSet& changes) {
+    for (const auto& note : changes.added) {
+        add(note);
+    }
+    for (const auto& note : changes.updated) {
+        update(note);
+    }
+    for (const auto& uuid : changes.deleted) {
+        remove(uuid);
+    }
+}
+
+NoteChangeSet NoteChangeQueue::take() {
+    NoteChangeSet net;
+    for (auto& entry : touched_) {
+        if (entry.note) {
+            (entry.existed ? net.updated : net.added).push_back(std::move(entry.note));
+        } else if (entry.existed) {
+            net.deleted.push_back(std::move(entry.uuid));
+        }
+    }
+    index_.clear();
+    touched_.clear();
+    return net;
+}
+
+uint64_t NoteChangeJournal::record(const NoteUUID& uuid, bool deleted) {
+    const uint64_t sequence = ++sequence_;
+    auto [it, inserted] = latest_.try_emplace(uuid, sequence);
+    if (!inserted) {
+        auto previous = changes_.find(it->second);
+        if (previous->second.deleted) {
+            --deleted_;
+        }
+        changes_.erase(previous);
+        it->second = sequence;
+    }
+    changes_.emplace_hint(changes_.end(), sequence, Change{uuid, deleted});
+    if (deleted && ++deleted_ > kMaxDeleted) {
+        // Forget a quarter at once, so the scan doesn't run on every
+        // deletion from here on
+        for (auto c = changes_.begin(); c != changes_.end() && deleted_ > kMaxDeleted * 3 / 4;) {
+            if (!c->second.deleted) {
+                ++c;
+                continue;
+            }
+            forgotten_ = c->first;
+            latest_.erase(c->second.uuid);
+            c = changes_.erase(c);
+            --deleted_;
+        }
+    }
+    return sequence;
+}
+
+std::vector<NoteChangeJournal::Entry> NoteChangeJournal::since(uint64_t sequence) const {
+    std::vector<Entry> entries;
+    for (auto it = changes_.upper_bound(sequence); it != changes_.end(); ++it) {
+        entries.push_back(Entry{it->first, it->second.uuid, it->second.deleted});
+    }
+    return entries;
+}
+
+void NoteStoreObserver::onNotesChanged(const NoteChangeSet& changes) {
+    for (const auto& note : changes.added) {
+        onNoteAdded(note);
+    }
+    for (const auto& note : changes.updated) {
+        onNoteUpdated(note);
+    }
+    for (const auto& uuid : changes.deleted) {
+        onNoteDeleted(uuid);
+    }
+}
+
+// One observer's queue of undelivered changes. At most one delivery task
+// is scheduled or running at a time; it keeps delivering until the queue
+// is empty, so changes queued meanwhile are coalesced into its next call.
+struct NoteStore::Subscription {
+    NoteStoreObserver* observer;
+    NoteEventDispatcher dispatcher;
+    std::mutex mutex;
+    NoteChangeQueue pending;   // guarded by mutex
+    bool scheduled = false;    // guarded by mutex
+    bool removed = false;      // guarded by mutex
+
+    void deliver() {
+        for (;;) {
+            NoteChangeSet changes;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (removed || pending.empty()) {
+                    scheduled = false;
+                    return;
+                }
+                changes = pending.take();
+            }
+            if (!changes.empty()) {
+                observer->onNotesChanged(changes);
+            }
+        }
+    }
+};
+
+void NoteStore::addObserver(NoteStoreObserver* obs, NoteEventDispatcher dispatcher) {
+    auto subscription = std::make_shared<Subscription>();
+    subscription->observer = obs;
+    subscription->dispatcher = std::move(dispatcher);
     std::lock_guard<std::mutex> lock(mutex_);
-    observers_.push_back(obs);
+    observers_.push_back(std::move(subscription));
 }
 
 void NoteStore::removeObserver(NoteStoreObserver* obs) {
     std::lock_guard<std::mutex> lock(mutex_);
-    observers_.erase(std::remove(observers_.begin(), observers_.end(), obs), observers_.end());
+    auto it = std::remove_if(observers_.begin(), observers_.end(), [obs](const auto& subscription) {
+        return subscription->observer == obs;
+    });
+    for (auto removed = it; removed != observers_.end(); ++removed) {
+        // A delivery already scheduled finds this and does nothing
+        std::lock_guard<std::mutex> subscriptionLock((*removed)->mutex);
+        (*removed)->removed = true;
+    }
+    observers_.erase(it, observers_.end());
 }
 
-void NoteStore::addNote(std::shared_ptr<Note> note) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    notes_[note->uuid()] = note;
-    
-    for (auto* obs : observers_) {
-        obs->onNoteAdded(note);
+std::vector<std::shared_ptr<NoteStore::Subscription>> NoteStore::enqueue(const NoteChangeSet& changes) {
+    std::vector<std::shared_ptr<Subscription>> toSchedule;
+    if (changes.empty()) {
+        return toSchedule;
+    }
+    for (const auto& note : changes.added) {
+        journal_.record(note->uuid(), false);
+    }
+    for (const auto& note : changes.updated) {
+        journal_.record(note->uuid(), false);
+    }
+    for (const auto& uuid : changes.deleted) {
+        journal_.record(uuid, true);
     }
+    for (const auto& subscription : observers_) {
+        std::lock_guard<std::mutex> lock(subscription->mutex);
+        subscription->pending.append(changes);
+        if (!subscription->scheduled) {
+            subscription->scheduled = true;
+            toSchedule.push_back(subscription);
+        }
+    }
+    return toSchedule;
 }
 
-void NoteStore::updateNote(std::shared_ptr<Note> note) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    auto it = notes_.find(note->uuid());
-    if (it == notes_.end()) {
-        return;
+void NoteStore::dispatch(const std::vector<std::shared_ptr<Subscription>>& subscriptions) {
+    for (const auto& subscription : subscriptions) {
+        if (subscription->dispatcher) {
+            subscription->dispatcher([subscription]() { subscription->deliver(); });
+        } else {
+            subscription->deliver();
+        }
     }
-    
-    it->second = note;
-    
-    for (auto* obs : observers_) {
-        obs->onNoteUpdated(note);
+}
+
+NoteList& NoteStore::writableNotes() {
+    // Snapshots are only handed out under mutex_, so a count of one can't
+    // grow while it is held
+    if (notes_.use_count() > 1) {
+        notes_ = std::make_shared<NoteList>(*notes_);
+    } else {
+        // Pairs with the release of the last snapshot's reference
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *notes_;
+}
+
+bool NoteStore::putNote(std::shared_ptr<const Note> note) {
+    auto [it, inserted] = positions_.try_emplace(note->uuid(), notes_->size());
+    NoteList& notes = writableNotes();
+    if (inserted) {
+        notes.push_back(std::move(note));
+    } else {
+        notes[it->second] = std::move(note);
     }
+    return inserted;
+}
+
+bool NoteStore::replaceNote(std::shared_ptr<const Note> note) {
+    auto it = positions_.find(note->uuid());
+    if (it == positions_.end()) {
+        return false;
+    }
+    writableNotes()[it->second] = std::move(note);
+    return true;
+}
+
+bool NoteStore::eraseNote(const NoteUUID& uuid) {
+    auto it = positions_.find(uuid);
+    if (it == positions_.end()) {
+        return false;
+    }
+    const size_t position = it->second;
+    positions_.erase(it);
+
+    // Move the last note into the gap
+    NoteList& notes = writableNotes();
+    if (position + 1 != notes.size()) {
+        notes[position] = std::move(notes.back());
+        positions_[notes[position]->uuid()] = position;
+    }
+    notes.pop_back();
+    return true;
+}
+
+void NoteStore::addNote(std::shared_ptr<const Note> note) {
+    std::vector<std::shared_ptr<Subscription>> toSchedule;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        NoteChangeSet changes;
+        (putNote(note) ? changes.added : changes.updated).push_back(std::move(note));
+        toSchedule = enqueue(changes);
+    }
+    dispatch(toSchedule);
+}
+
+void NoteStore::updateNote(std::shared_ptr<const Note> note) {
+    std::vector<std::shared_ptr<Subscription>> toSchedule;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        if (!replaceNote(note)) {
+            return;
+        }
+        
+        NoteChangeSet changes;
+        changes.updated.push_back(std::move(note));
+        toSchedule = enqueue(changes);
+    }
+    dispatch(toSchedule);
 }
 
 void NoteStore::deleteNote(const NoteUUID& uuid) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    auto it = notes_.find(uuid);
-    if (it == notes_.end()) {
-        return;
+    std::vector<std::shared_ptr<Subscription>> toSchedule;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        if (!eraseNote(uuid)) {
+            return;
+        }
+        
+        NoteChangeSet changes;
+        changes.deleted.push_back(uuid);
+        toSchedule = enqueue(changes);
     }
-    
-    notes_.erase(it);
-    
-    for (auto* obs : observers_) {
-        obs->onNoteDeleted(uuid);
+    dispatch(toSchedule);
+}
+
+void NoteStore::applyChanges(const NoteChangeSet& changes) {
+    std::vector<std::shared_ptr<Subscription>> toSchedule;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // Applied one by one; the queue reduces them to the net change
+        NoteChangeQueue net;
+        for (const auto& note : changes.added) {
+            if (putNote(note)) {
+                net.add(note);
+            } else {
+                net.update(note);
+            }
+        }
+        for (const auto& note : changes.updated) {
+            if (replaceNote(note)) {
+                net.update(note);
+            }
+        }
+        for (const auto& uuid : changes.deleted) {
+            if (eraseNote(uuid)) {
+                net.remove(uuid);
+            }
+        }
+        toSchedule = enqueue(net.take());
     }
+    dispatch(toSchedule);
 }
 
-std::shared_ptr<Note> NoteStore::getNote(const NoteUUID& uuid) {
+std::shared_ptr<const Note> NoteStore::getNote(const NoteUUID& uuid) {
     std::lock_guard<std::mutex> lock(mutex_);
     
-    auto it = notes_.find(uuid);
-    if (it == notes_.end()) {
+    auto it = positions_.find(uuid);
+    if (it == positions_.end()) {
         return nullptr;
     }
     
-    return it->second;
+    return (*notes_)[it->second];
 }
 
-std::vector<std::shared_ptr<Note>> NoteStore::getAllNotes() {
+std::shared_ptr<const NoteList> NoteStore::getAllNotes() {
     std::lock_guard<std::mutex> lock(mutex_);
-    
-    std::vector<std::shared_ptr<Note>> result;
-    for (const auto& pair : notes_) {
-        result.push_back(pair.second);
+    return notes_;
+}
+
+NoteJournalChanges NoteStore::changesSince(uint64_t since) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    NoteJournalChanges result;
+    result.sequence = journal_.sequence();
+    if (since > result.sequence) {
+        // A cursor from another store: start over
+        since = 0;
+        result.complete = false;
+    } else {
+        result.complete = journal_.covers(since);
+    }
+    for (const auto& entry : journal_.since(since)) {
+        NoteJournalEntry change{entry.sequence, entry.uuid, nullptr};
+        if (!entry.deleted) {
+            change.note = (*notes_)[positions_.at(entry.uuid)];
+        }
+        result.entries.push_back(std::move(change));
     }
-    
     return result;
 }
 
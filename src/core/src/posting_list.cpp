@@ -0,0 +1,314 @@
+#include "nv/posting_list.h"
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define NV_POSTINGS_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace nv {
+
+namespace {
+
+// Above this size ratio the smaller list probes the larger one with
+// exponential search instead of walking both lists block by block.
+constexpr size_t kGallopRatio = 32;
+
+inline int lowestSetBit(uint64_t w) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, w);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(w);
+#endif
+}
+
+void intersectScalar(const NoteOrdinal* a, size_t na, size_t i,
+                     const NoteOrdinal* b, size_t nb, size_t j,
+                     PostingList& out) {
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            ++i;
+        } else if (b[j] < a[i]) {
+            ++j;
+        } else {
+            out.push_back(a[i]);
+            ++i;
+            ++j;
+        }
+    }
+}
+
+// small is expected to be much shorter than large.
+void intersectGalloping(const NoteOrdinal* small, size_t ns,
+                        const NoteOrdinal* large, size_t nl,
+                        PostingList& out) {
+    size_t j = 0;
+    for (size_t i = 0; i < ns && j < nl; ++i) {
+        const NoteOrdinal x = small[i];
+        if (large[j] < x) {
+            // Double the step until we overshoot x, then binary search the
+            // last interval.
+            size_t lo = j;
+            size_t step = 1;
+            while (lo + step < nl && large[lo + step] < x) {
+                lo += step;
+                step <<= 1;
+            }
+            const size_t hi = std::min(lo + step + 1, nl);
+            j = static_cast<size_t>(std::lower_bound(large + lo, large + hi, x) - large);
+            if (j == nl) {
+                break;
+            }
+        }
+        if (large[j] == x) {
+            out.push_back(x);
+            ++j;
+        }
+    }
+}
+
+// Compares each element of a against a whole block of b at once. Blocks of b
+// whose maximum is below the current element are skipped without touching
+// the individual values.
+void intersectBlocks(const NoteOrdinal* a, size_t na,
+                     const NoteOrdinal* b, size_t nb,
+                     PostingList& out) {
+    size_t i = 0;
+    size_t j = 0;
+#if defined(__AVX2__)
+    constexpr size_t kWidth = 8;
+    while (i < na && j + kWidth <= nb) {
+        const NoteOrdinal x = a[i];
+        if (b[j + kWidth - 1] < x) {
+            j += kWidth;
+            continue;
+        }
+        const __m256i needle = _mm256_set1_epi32(static_cast<int>(x));
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(needle, block)) != 0) {
+            out.push_back(x);
+        }
+        ++i;
+    }
+#elif defined(NV_POSTINGS_SSE2)
+    constexpr size_t kWidth = 4;
+    while (i < na && j + kWidth <= nb) {
+        const NoteOrdinal x = a[i];
+        if (b[j + kWidth - 1] < x) {
+            j += kWidth;
+            continue;
+        }
+        const __m128i needle = _mm_set1_epi32(static_cast<int>(x));
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(needle, block)) != 0) {
+            out.push_back(x);
+        }
+        ++i;
+    }
+#endif
+    intersectScalar(a, na, i, b, nb, j, out);
+}
+
+} // namespace
+
+void intersectPostings(PostingSpan a, PostingSpan b, PostingList& out) {
+    out.clear();
+    if (a.size == 0 || b.size == 0) {
+        return;
+    }
+    if (a.size > b.size) {
+        std::swap(a, b);
+    }
+    // Disjoint ranges can't intersect.
+    if (a.data[a.size - 1] < b.data[0] || b.data[b.size - 1] < a.data[0]) {
+        return;
+    }
+    if (out.capacity() < a.size) {
+        out.reserve(a.size);
+    }
+    if (a.size * kGallopRatio < b.size) {
+        intersectGalloping(a.data, a.size, b.data, b.size, out);
+    } else {
+        intersectBlocks(a.data, a.size, b.data, b.size, out);
+    }
+}
+
+void unionPostings(const std::vector<PostingSpan>& lists, NoteOrdinal universe, PostingList& out) {
+    out.clear();
+    size_t total = 0;
+    for (const auto& list : lists) {
+        total += list.size;
+    }
+    if (total == 0) {
+        return;
+    }
+    if (lists.size() == 1) {
+        out.assign(lists[0].data, lists[0].data + lists[0].size);
+        return;
+    }
+
+    if (total * 8 >= universe) {
+        // Dense: mark a bitmap and read it back in order. The bitmap is kept
+        // per thread so repeated searches don't reallocate it.
+        thread_local std::vector<uint64_t> bits;
+        bits.assign((static_cast<size_t>(universe) + 63) / 64, 0);
+        for (const auto& list : lists) {
+            for (size_t k = 0; k < list.size; ++k) {
+                const NoteOrdinal ord = list.data[k];
+                bits[ord >> 6] |= uint64_t{1} << (ord & 63);
+            }
+        }
+        out.reserve(total);
+        for (size_t word = 0; word < bits.size(); ++word) {
+            uint64_t w = bits[word];
+            while (w != 0) {
+                const int bit = lowestSetBit(w);
+                out.push_back(static_cast<NoteOrdinal>(word * 64 + bit));
+                w &= w - 1;
+            }
+        }
+        return;
+    }
+
+    out.reserve(total);
+    for (const auto& list : lists) {
+        out.insert(out.end(), list.data, list.data + list.size);
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void differencePostings(PostingSpan a, PostingSpan b, PostingList& out) {
+    out.clear();
+    if (out.capacity() < a.size) {
+        out.reserve(a.size);
+    }
+    const bool gallop = a.size * kGallopRatio < b.size;
+    size_t j = 0;
+    for (size_t i = 0; i < a.size; ++i) {
+        const NoteOrdinal x = a.data[i];
+        if (gallop) {
+            j = static_cast<size_t>(std::lower_bound(b.data + j, b.data + b.size, x) - b.data);
+        } else {
+            while (j < b.size && b.data[j] < x) {
+                ++j;
+            }
+        }
+        if (j == b.size || b.data[j] != x) {
+            out.push_back(x);
+        }
+    }
+}
+
+uint32_t CompressedPostings::append(PostingSpan list) {
+    lists_.push_back(List{static_cast<uint32_t>(blocks_.size()), static_cast<uint32_t>(list.size)});
+    for (size_t i = 0; i < list.size; ++i) {
+        if (i % kBlockSize == 0) {
+            blocks_.push_back(Block{list.data[i], static_cast<uint32_t>(bytes_.size())});
+            continue;
+        }
+        // LEB128 varint of the gap to the previous ordinal
+        uint32_t gap = list.data[i] - list.data[i - 1];
+        while (gap >= 0x80) {
+            bytes_.push_back(static_cast<uint8_t>(gap | 0x80));
+            gap >>= 7;
+        }
+        bytes_.push_back(static_cast<uint8_t>(gap));
+    }
+    return static_cast<uint32_t>(lists_.size() - 1);
+}
+
+void CompressedPostings::shrinkToFit() {
+    bytes_.shrink_to_fit();
+    blocks_.shrink_to_fit();
+    lists_.shrink_to_fit();
+}
+
+void CompressedPostings::decodeBlock(size_t b, size_t count, NoteOrdinal* out) const {
+    const uint8_t* p = bytes_.data() + blocks_[b].offset;
+    NoteOrdinal value = blocks_[b].first;
+    out[0] = value;
+    for (size_t i = 1; i < count; ++i) {
+        uint32_t gap = 0;
+        int shift = 0;
+        uint8_t byte;
+        do {
+            byte = *p++;
+            gap |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        value += gap;
+        out[i] = value;
+    }
+}
+
+void CompressedPostings::decode(uint32_t list, PostingList& out) const {
+    const List& l = lists_[list];
+    out.resize(l.count);
+    for (size_t k = 0; k < blockCount(l); ++k) {
+        const size_t count = std::min(kBlockSize, l.count - k * kBlockSize);
+        decodeBlock(l.block + k, count, out.data() + k * kBlockSize);
+    }
+}
+
+void CompressedPostings::intersect(uint32_t list, PostingSpan within, PostingList& out) const {
+    const List& l = lists_[list];
+    out.clear();
+    if (within.size == 0 || l.count == 0) {
+        return;
+    }
+
+    // Against a comparable or larger set, decoding everything and merging
+    // is cheaper than seeking block by block.
+    if (within.size * 8 >= l.count) {
+        thread_local PostingList decoded;
+        decode(list, decoded);
+        intersectPostings(decoded, within, out);
+        return;
+    }
+
+    NoteOrdinal block[kBlockSize];
+    const Block* first = blocks_.data() + l.block;
+    const Block* last = first + blockCount(l);
+    const Block* current = nullptr;
+    size_t count = 0;
+    size_t pos = 0;
+    for (size_t i = 0; i < within.size; ++i) {
+        const NoteOrdinal x = within.data[i];
+        // The last block starting at or before x is the only one that can
+        // hold it
+        const Block* candidate = std::upper_bound(current ? current : first, last, x,
+            [](NoteOrdinal value, const Block& b) { return value < b.first; });
+        if (candidate == first) {
+            continue;
+        }
+        --candidate;
+        if (candidate != current) {
+            current = candidate;
+            const size_t k = static_cast<size_t>(current - first);
+            count = std::min(kBlockSize, l.count - k * kBlockSize);
+            decodeBlock(l.block + k, count, block);
+            pos = 0;
+        }
+        while (pos < count && block[pos] < x) {
+            ++pos;
+        }
+        if (pos < count && block[pos] == x) {
+            out.push_back(x);
+        }
+    }
+}
+
+size_t CompressedPostings::memoryUsage() const {
+    return bytes_.capacity() + blocks_.capacity() * sizeof(Block) + lists_.capacity() * sizeof(List);
+}
+
+} // namespace nv
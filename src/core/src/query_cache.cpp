@@ -0,0 +1,102 @@
+#include "nv/query_cache.h"
+#include <cctype>
+
+namespace nv {
+
+QueryResultCache::QueryResultCache(size_t capacity)
+    : capacity_(capacity) {
+}
+
+std::shared_ptr<const QueryResultCache::Results> QueryResultCache::find(const std::string& key,
+                                                                        uint64_t generation) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity_ == 0) {
+        return nullptr;
+    }
+    auto it = lookup_.find(key);
+    if (it == lookup_.end()) {
+        ++misses_;
+        return nullptr;
+    }
+    if (it->second->generation != generation) {
+        entries_.erase(it->second);
+        lookup_.erase(it);
+        ++misses_;
+        return nullptr;
+    }
+    ++hits_;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->results;
+}
+
+void QueryResultCache::insert(const std::string& key, uint64_t generation, const Results& results) {
+    {
+        // Don't pay for the copy while disabled
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (capacity_ == 0) {
+            return;
+        }
+    }
+    auto shared = std::make_shared<const Results>(results);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity_ == 0) {
+        return;
+    }
+    auto it = lookup_.find(key);
+    if (it != lookup_.end()) {
+        // A search that started on an older version may finish last
+        if (it->second->generation > generation) {
+            return;
+        }
+        it->second->generation = generation;
+        it->second->results = std::move(shared);
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return;
+    }
+    entries_.push_front(Entry{key, generation, std::move(shared)});
+    lookup_[key] = entries_.begin();
+    evict();
+}
+
+void QueryResultCache::setCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+    evict();
+}
+
+QueryCacheStats QueryResultCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    QueryCacheStats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    stats.entries = entries_.size();
+    stats.capacity = capacity_;
+    return stats;
+}
+
+std::string QueryResultCache::normalize(const std::string& query) {
+    std::string normalized;
+    normalized.reserve(query.size());
+    bool space = false;
+    for (char c : query) {
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            space = !normalized.empty();
+            continue;
+        }
+        if (space) {
+            normalized += ' ';
+            space = false;
+        }
+        normalized += c;
+    }
+    return normalized;
+}
+
+void QueryResultCache::evict() {
+    while (entries_.size() > capacity_) {
+        lookup_.erase(entries_.back().key);
+        entries_.pop_back();
+    }
+}
+
+} // namespace nv
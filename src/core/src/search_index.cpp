@@ -1,214 +1,3018 @@
 #include "nv/search_index.h"
+#include "nv/levenshtein_automaton.h"
+#include "nv/term_arena.h"
 #include <algorithm>
 #include <cctype>
-#include <set>
+#include <chrono>
+#include <ctime>
+#include <cmath>
 #include <array>
-#include <random>
-#include <sstream>
-#include <iomanip>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 
 namespace nv {
 
-void SearchIndex::indexNoteInternal(std::shared_ptr<Note> note) {
-    // This version does NOT lock the mutex - caller must lock if needed
-    
-    // Remove existing note from index
-    auto it = std::find_if(all_notes_.begin(), all_notes_.end(),
-        [&note](const std::shared_ptr<Note>& n) { return n->uuid() == note->uuid(); });
-    
-    if (it != all_notes_.end()) {
-        Note* notePtr = it->get();
-        
-        // Remove from all_notes_
-        all_notes_.erase(it);
-        
-        // Remove from note_to_terms_
-        auto noteTermsIt = note_to_terms_.find(notePtr);
-        if (noteTermsIt != note_to_terms_.end()) {
-            for (const auto& term : noteTermsIt->second) {
-                auto& notes = terms_to_notes_[term];
-                notes.erase(std::remove(notes.begin(), notes.end(), notePtr), notes.end());
-                if (notes.empty()) {
-                    terms_to_notes_.erase(term);
+namespace {
+
+// Once removed notes outnumber live ones (and there are enough of them to be
+// worth the pass), ordinals are renumbered to keep posting lists dense.
+constexpr size_t kMinCompactionHoles = 1024;
+
+// Likewise, once terms no live note uses make up most of the term arena
+// (every autosave interns the partial words typed since the last one), the
+// live terms are moved to a fresh arena when the delta is folded.
+constexpr size_t kMinCompactionTerms = 4096;
+
+// How many notes are visited between checks of the cancellation flag.
+constexpr size_t kCancelCheckInterval = 1024;
+
+bool isCancelled(const SearchOptions& options) {
+    return options.cancelled && options.cancelled->load(std::memory_order_relaxed);
+}
+
+// Batches are split across threads in slices of at least this many notes,
+// so small batches don't pay for starting threads.
+constexpr size_t kMinNotesPerThread = 512;
+
+// Once the delta segment holds this many notes (live or removed), it is
+// folded into a new base segment.
+constexpr size_t kMaxDeltaNotes = 256;
+
+size_t bitmapWords(size_t bits) {
+    return (bits + 63) / 64;
+}
+
+bool testBit(const std::vector<uint64_t>& bits, NoteOrdinal ordinal) {
+    return (bits[ordinal >> 6] >> (ordinal & 63)) & 1;
+}
+
+void setBit(std::vector<uint64_t>& bits, NoteOrdinal ordinal) {
+    bits[ordinal >> 6] |= uint64_t{1} << (ordinal & 63);
+}
+
+inline int lowestSetBit(uint64_t w) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, w);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(w);
+#endif
+}
+
+// Notes of a segment with some attribute (type:, has:), one bit per
+// ordinal - first
+struct AttributeBitmap {
+    std::vector<uint64_t> bits;
+    size_t count = 0;
+
+    void add(NoteOrdinal offset) {
+        setBit(bits, offset);
+        ++count;
+    }
+    size_t memoryUsage() const { return bits.capacity() * sizeof(uint64_t); }
+};
+
+// NoteType::TEXT and NoteType::CHECKLIST
+constexpr size_t kNoteTypeCount = 2;
+
+// UUID -> ordinal lookup for one segment: open addressing over 8-byte
+// (hash tag, ordinal) slots, so no uuid is copied and nothing is allocated
+// per note. A tag hit is confirmed by the caller against the note's own
+// uuid. Slots are never removed; lookups skip those whose note was removed
+// (or re-added under a later ordinal) the same way.
+class OrdinalTable {
+public:
+    static uint32_t tag(const NoteUUID& uuid) {
+        const uint64_t h = std::hash<NoteUUID>{}(uuid);
+        return static_cast<uint32_t>(h ^ (h >> 32));
+    }
+
+    size_t size() const { return size_; }
+    void clear() {
+        slots_.clear();
+        size_ = 0;
+    }
+    void reserve(size_t count) {
+        if (count * 2 > slots_.size()) {
+            rehash(count * 2);
+        }
+    }
+    void insert(uint32_t tag, NoteOrdinal ordinal) {
+        reserve(size_ + 1);
+        place(Slot{tag, ordinal});
+        ++size_;
+    }
+    // The first ordinal stored under tag that matches(ordinal) accepts
+    template<typename Matches>
+    std::optional<NoteOrdinal> find(uint32_t tag, Matches&& matches) const {
+        if (slots_.empty()) {
+            return std::nullopt;
+        }
+        const size_t mask = slots_.size() - 1;
+        for (size_t i = tag & mask; slots_[i].ordinal != kEmpty; i = (i + 1) & mask) {
+            if (slots_[i].tag == tag && matches(slots_[i].ordinal)) {
+                return slots_[i].ordinal;
+            }
+        }
+        return std::nullopt;
+    }
+    size_t memoryUsage() const { return slots_.capacity() * sizeof(Slot); }
+
+private:
+    static constexpr NoteOrdinal kEmpty = ~NoteOrdinal{0};
+    struct Slot {
+        uint32_t tag = 0;
+        NoteOrdinal ordinal = kEmpty;
+    };
+
+    void place(Slot slot) {
+        const size_t mask = slots_.size() - 1;
+        size_t i = slot.tag & mask;
+        while (slots_[i].ordinal != kEmpty) {
+            i = (i + 1) & mask;
+        }
+        slots_[i] = slot;
+    }
+    void rehash(size_t minimum) {
+        size_t capacity = 16;
+        while (capacity < minimum) {
+            capacity *= 2;
+        }
+        std::vector<Slot> old(capacity);
+        old.swap(slots_);
+        for (const Slot& slot : old) {
+            if (slot.ordinal != kEmpty) {
+                place(slot);
+            }
+        }
+    }
+
+    std::vector<Slot> slots_;  // power-of-two size, at most half full
+    size_t size_ = 0;
+};
+
+// Length of the n-grams used for substring matching. Shorter query tokens
+// keep using prefix matching.
+constexpr size_t kNgramSize = 3;
+
+using Trigram = uint32_t;
+
+Trigram packTrigram(const char* p) {
+    return (static_cast<Trigram>(static_cast<unsigned char>(p[0])) << 16)
+         | (static_cast<Trigram>(static_cast<unsigned char>(p[1])) << 8)
+         | static_cast<Trigram>(static_cast<unsigned char>(p[2]));
+}
+
+void appendTrigrams(std::string_view term, std::vector<Trigram>& out) {
+    for (size_t i = 0; i + kNgramSize <= term.size(); ++i) {
+        out.push_back(packTrigram(term.data() + i));
+    }
+}
+
+// BM25 parameters. Title occurrences count kTitleBoost times as much as body
+// occurrences (BM25F-style field weighting).
+constexpr double kBm25K1 = 1.2;
+constexpr double kBm25B = 0.75;
+constexpr double kTitleBoost = 2.0;
+
+// Fuzzy matching: words this long may be one or two edits off. Terms only
+// reached through an edit count this much of an exact occurrence.
+constexpr size_t kMinLengthOneEdit = 4;
+constexpr size_t kMinLengthTwoEdits = 8;
+constexpr double kFuzzyWeight = 0.5;
+
+bool startsWith(std::string_view term, std::string_view prefix) {
+    return term.compare(0, prefix.size(), prefix) == 0;
+}
+
+// The first of ids (sorted by term text) whose term is not less than key
+std::vector<TermId>::const_iterator lowerBoundTerm(const std::vector<TermId>& ids, const TermArena& arena,
+                                                   std::string_view key) {
+    return std::lower_bound(ids.begin(), ids.end(), key,
+                            [&arena](TermId id, std::string_view k) { return arena.term(id) < k; });
+}
+
+// Calls f(index, matchLength) for the terms of a sorted term list that the
+// automaton accepts; f returns false to stop.
+template<typename F>
+void forEachFuzzyTerm(const std::vector<TermId>& terms, const TermArena& arena,
+                      const LevenshteinAutomaton& automaton, F&& f) {
+    using Iterator = std::vector<TermId>::const_iterator;
+    automaton.forEachMatch(
+        terms.begin(), terms.end(),
+        [&arena](Iterator it) { return arena.term(*it); },
+        [&terms, &arena](const std::string& key) { return lowerBoundTerm(terms, arena, key); },
+        [&terms, &f](Iterator it, size_t length) {
+            return f(static_cast<size_t>(it - terms.begin()), length);
+        });
+}
+
+// One posting list of a segment
+struct PostingRef {
+    const CompressedPostings* postings;
+    uint32_t list;
+
+    size_t size() const { return postings->count(list); }
+};
+
+// The ordinals of ref, only those also in within if given, into out
+void readPostings(const PostingRef& ref, const PostingSpan* within, PostingList& out) {
+    if (within) {
+        ref.postings->intersect(ref.list, *within, out);
+    } else {
+        ref.postings->decode(ref.list, out);
+    }
+}
+
+bool isTokenChar(char c) {
+    return std::isalnum(c) || std::ispunct(c);
+}
+
+// isTokenChar and std::tolower for every byte, looked up once per batch
+// instead of once per character
+struct CharClasses {
+    std::array<bool, 256> token;
+    std::array<char, 256> lower;
+
+    CharClasses() {
+        for (int i = 0; i < 256; ++i) {
+            const char c = static_cast<char>(i);
+            token[i] = isTokenChar(c);
+            lower[i] = static_cast<char>(std::tolower(c));
+        }
+    }
+};
+
+// A token and the byte offset where it starts in its field. key holds the
+// first eight bytes big-endian, so most comparisons while sorting never
+// look at the text.
+struct PositionedToken {
+    uint64_t key;
+    std::string_view text;
+    uint32_t offset;
+
+    bool operator<(const PositionedToken& other) const {
+        if (key != other.key) {
+            return key < other.key;
+        }
+        const int order = text.compare(other.text);
+        return order != 0 ? order < 0 : offset < other.offset;
+    }
+};
+
+uint64_t prefixKey(std::string_view s) {
+    uint64_t key = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        key = key << 8 | (i < s.size() ? static_cast<unsigned char>(s[i]) : 0);
+    }
+    return key;
+}
+
+// Calls f(token, offset) for every lower-cased token of s
+template<typename F>
+void forEachToken(const std::string& s, F&& f) {
+    std::string token;
+    size_t start = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        const char c = s[i];
+        if (isTokenChar(c)) {
+            if (token.empty()) {
+                start = i;
+            }
+            token += std::tolower(c);
+        } else if (!token.empty()) {
+            f(token, start);
+            token.clear();
+        }
+    }
+    if (!token.empty()) {
+        f(token, start);
+    }
+}
+
+// The tokens of s, sorted, as views into lowered (a lower-cased copy of s
+// made here), so that indexing doesn't allocate a string per token
+std::vector<PositionedToken> positionedTokens(const std::string& s, const CharClasses& classes,
+                                              std::string& lowered) {
+    lowered.resize(s.size());
+    std::vector<PositionedToken> tokens;
+    size_t start = 0;
+    for (size_t i = 0; i <= s.size(); ++i) {
+        if (i < s.size()) {
+            const auto c = static_cast<unsigned char>(s[i]);
+            if (classes.token[c]) {
+                lowered[i] = classes.lower[c];
+                continue;
+            }
+        }
+        if (i > start) {
+            const std::string_view token(lowered.data() + start, i - start);
+            tokens.push_back(PositionedToken{prefixKey(token), token, static_cast<uint32_t>(start)});
+        }
+        start = i + 1;
+    }
+    std::sort(tokens.begin(), tokens.end());
+    return tokens;
+}
+
+// Merges the sorted title and body tokens into unique terms (as ids in
+// dictionary, in text order) plus per-field occurrence counts and offsets
+// (title offsets first, then body offsets).
+void buildTermTable(const std::vector<PositionedToken>& titleTokens,
+                    const std::vector<PositionedToken>& bodyTokens,
+                    TermArena& dictionary,
+                    std::vector<TermId>& terms,
+                    std::vector<TermFrequency>& frequencies,
+                    std::vector<uint32_t>& positions,
+                    std::vector<uint32_t>& positionStarts) {
+    size_t i = 0;
+    size_t j = 0;
+    while (i < titleTokens.size() || j < bodyTokens.size()) {
+        const std::string_view next = (j == bodyTokens.size() ||
+                                       (i < titleTokens.size() && titleTokens[i].text <= bodyTokens[j].text))
+            ? titleTokens[i].text : bodyTokens[j].text;
+        positionStarts.push_back(static_cast<uint32_t>(positions.size()));
+        TermFrequency freq;
+        while (i < titleTokens.size() && titleTokens[i].text == next) {
+            positions.push_back(titleTokens[i].offset);
+            ++freq.title;
+            ++i;
+        }
+        while (j < bodyTokens.size() && bodyTokens[j].text == next) {
+            positions.push_back(bodyTokens[j].offset);
+            ++freq.body;
+            ++j;
+        }
+        terms.push_back(dictionary.intern(next));
+        frequencies.push_back(freq);
+    }
+    positionStarts.push_back(static_cast<uint32_t>(positions.size()));
+}
+
+// Whether body has unchecked ("[ ]") and checked ("[x]") checklist items,
+// i.e. lines starting with one of those markers
+std::pair<bool, bool> checklistItems(const std::string& body) {
+    bool unchecked = false;
+    bool checked = false;
+    size_t line = 0;
+    while (line < body.size() && !(unchecked && checked)) {
+        size_t i = line;
+        while (i < body.size() && (body[i] == ' ' || body[i] == '\t')) {
+            ++i;
+        }
+        if (body.compare(i, 3, "[ ]") == 0) {
+            unchecked = true;
+        } else if (body.compare(i, 3, "[x]") == 0) {
+            checked = true;
+        }
+        const size_t next = body.find('\n', i);
+        line = next == std::string::npos ? body.size() : next + 1;
+    }
+    return {unchecked, checked};
+}
+
+// Whether node has a modified: range relative to the current time
+bool dependsOnTime(const QueryNode& node) {
+    return node.relativeTime || std::any_of(node.children.begin(), node.children.end(),
+                                            [](const QueryNode& child) { return dependsOnTime(child); });
+}
+
+// Whether a term with these frequencies occurs in field
+bool occursIn(const TermFrequency& freq, QueryNode::Field field) {
+    switch (field) {
+    case QueryNode::Field::Title:
+        return freq.title > 0;
+    case QueryNode::Field::Body:
+        return freq.body > 0;
+    case QueryNode::Field::Any:
+        break;
+    }
+    return true;
+}
+
+// Sorts spans and joins overlapping ones
+void normalizeSpans(std::vector<MatchSpan>& spans) {
+    std::sort(spans.begin(), spans.end(), [](const MatchSpan& a, const MatchSpan& b) {
+        return a.offset < b.offset || (a.offset == b.offset && a.length > b.length);
+    });
+    size_t out = 0;
+    for (size_t i = 0; i < spans.size(); ++i) {
+        if (out > 0 && spans[i].offset <= spans[out - 1].offset + spans[out - 1].length) {
+            const uint32_t end = std::max(spans[out - 1].offset + spans[out - 1].length,
+                                          spans[i].offset + spans[i].length);
+            spans[out - 1].length = end - spans[out - 1].offset;
+        } else {
+            spans[out++] = spans[i];
+        }
+    }
+    spans.resize(out);
+}
+
+// On-disk snapshot format. Values are stored in native byte order: a
+// snapshot is a startup cache for this machine, not an exchange format.
+// Bump kSnapshotVersion whenever the layout or the tokenizer changes.
+constexpr uint32_t kSnapshotMagic = 0x5849564e;  // "NVIX"
+constexpr uint32_t kSnapshotVersion = 5;
+
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(std::string& out) : out_(out) {}
+
+    template<typename T>
+    void write(T value) {
+        out_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    void writeString(const std::string& s) {
+        write(static_cast<uint32_t>(s.size()));
+        out_.append(s);
+    }
+
+private:
+    std::string& out_;
+};
+
+// Bounds-checked reads; the mapped file may be truncated or corrupt, and
+// values may be unaligned, so everything goes through memcpy.
+class SnapshotReader {
+public:
+    SnapshotReader(const char* data, size_t size) : pos_(data), end_(data + size) {}
+
+    template<typename T>
+    bool read(T& value) {
+        if (static_cast<size_t>(end_ - pos_) < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, pos_, sizeof(T));
+        pos_ += sizeof(T);
+        return true;
+    }
+    bool readString(std::string& s) {
+        uint32_t size = 0;
+        if (!read(size) || static_cast<size_t>(end_ - pos_) < size) {
+            return false;
+        }
+        s.assign(pos_, size);
+        pos_ += size;
+        return true;
+    }
+    // Points at count values of T without copying them
+    template<typename T>
+    bool readArray(uint32_t count, const char*& data) {
+        if (static_cast<size_t>(end_ - pos_) / sizeof(T) < count) {
+            return false;
+        }
+        data = pos_;
+        pos_ += static_cast<size_t>(count) * sizeof(T);
+        return true;
+    }
+    bool atEnd() const { return pos_ == end_; }
+
+private:
+    const char* pos_;
+    const char* end_;
+};
+
+// Defined with the query lexer below
+std::vector<std::string> queryWords(const std::string& query);
+
+} // namespace
+
+NoteFingerprint NoteFingerprint::metadataOf(const Note& note) {
+    NoteFingerprint fingerprint;
+    fingerprint.modifiedMillis = std::chrono::duration_cast<std::chrono::milliseconds>(
+        note.modified().time_since_epoch()).count();
+    fingerprint.size = note.title().size() + 1 + note.storedBodySize();
+    fingerprint.titleHash = note.titleHash();
+    return fingerprint;
+}
+
+NoteFingerprint NoteFingerprint::of(const Note& note) {
+    NoteFingerprint fingerprint = metadataOf(note);
+    fingerprint.bodyHash = note.bodyHash();
+    return fingerprint;
+}
+
+// One note as the index sees it. Shared by every version that contains the
+// note and never modified once built.
+struct SearchIndex::IndexedNote {
+    std::shared_ptr<const Note> note;
+    std::vector<TermId> terms;               // unique, sorted by term text
+    std::vector<TermFrequency> frequencies;  // parallel to terms
+    // Byte offsets of every occurrence of terms[i]:
+    // positions[position_starts[i] .. position_starts[i + 1]), the
+    // frequencies[i].title title offsets first, then the body offsets
+    std::vector<uint32_t> positions;
+    std::vector<uint32_t> position_starts;   // terms.size() + 1 entries
+    uint32_t length = 0;                     // title + body tokens
+    NoteFingerprint fingerprint;
+    // As of indexing, for the type: and has: filters (modified: uses
+    // fingerprint.modifiedMillis)
+    NoteType type = NoteType::TEXT;
+    bool unchecked = false;
+    bool checked = false;
+
+    // Takes the filter attributes from note
+    void setAttributes(const Note& note) {
+        type = note.noteType();
+        std::tie(unchecked, checked) = checklistItems(*note.body());
+    }
+
+    // Replaces the title occurrences with those of title and keeps the
+    // body ones, so a title edit doesn't tokenize the body again. Term ids
+    // are in arena, which the new title terms are interned into.
+    void replaceTitle(const std::string& title, TermArena& arena) {
+        static const CharClasses classes;
+        std::string lowered;
+        auto titleTokens = positionedTokens(title, classes, lowered);
+        // Terms are sorted by text and offsets ascend within a term, so
+        // these come out sorted too
+        std::vector<PositionedToken> bodyTokens;
+        for (size_t k = 0; k < terms.size(); ++k) {
+            const std::string_view text = arena.term(terms[k]);
+            const uint64_t key = prefixKey(text);
+            for (uint32_t p = position_starts[k] + frequencies[k].title; p < position_starts[k + 1]; ++p) {
+                bodyTokens.push_back(PositionedToken{key, text, positions[p]});
+            }
+        }
+
+        std::vector<TermId> newTerms;
+        std::vector<TermFrequency> newFrequencies;
+        std::vector<uint32_t> newPositions;
+        std::vector<uint32_t> newStarts;
+        newPositions.reserve(titleTokens.size() + bodyTokens.size());
+        buildTermTable(titleTokens, bodyTokens, arena, newTerms, newFrequencies, newPositions, newStarts);
+        newTerms.shrink_to_fit();
+        newFrequencies.shrink_to_fit();
+        newStarts.shrink_to_fit();
+        terms = std::move(newTerms);
+        frequencies = std::move(newFrequencies);
+        positions = std::move(newPositions);
+        position_starts = std::move(newStarts);
+        length = static_cast<uint32_t>(titleTokens.size() + bodyTokens.size());
+    }
+};
+
+// Notes tokenized outside the write lock. Their term ids refer to a
+// private arena until indexTokenized() maps them to the index's own, so
+// batches can be tokenized on several threads without sharing anything.
+struct SearchIndex::TokenizedNotes {
+    CharClasses classes;
+    TermArena terms;
+    std::vector<std::shared_ptr<IndexedNote>> entries;
+
+    void add(std::shared_ptr<const Note> note);
+};
+
+// A slice of the index covering ordinals [first, end()). Ordinals are
+// global, so the posting lists of consecutive segments concatenate into one
+// sorted list. Immutable once published.
+struct SearchIndex::Segment {
+    NoteOrdinal first = 0;
+    // Indexed by ordinal - first; nullptr where a note was removed
+    std::vector<std::shared_ptr<const IndexedNote>> notes;
+    OrdinalTable ordinals;
+    // Terms sorted by text, so a prefix lookup only visits the contiguous
+    // range of terms starting with that prefix; list i of postings belongs
+    // to terms[i].
+    std::vector<TermId> terms;
+    CompressedPostings postings;
+    // Sorted packed 3-byte n-grams; list i of trigram_postings holds the
+    // notes whose terms contain trigrams[i]
+    std::vector<Trigram> trigrams;
+    CompressedPostings trigram_postings;
+    // The same for title occurrences only, for title: words
+    std::vector<TermId> title_terms;
+    CompressedPostings title_postings;
+    // Filter indexes, see buildAttributes()
+    std::array<AttributeBitmap, kNoteTypeCount> types;  // by NoteType
+    AttributeBitmap unchecked;
+    AttributeBitmap checked;
+    // (modification time, ordinal) of every note, sorted, so a modified:
+    // range is one binary search away
+    std::vector<std::pair<int64_t, NoteOrdinal>> by_modified;
+
+    NoteOrdinal end() const { return first + static_cast<NoteOrdinal>(notes.size()); }
+    const IndexedNote* entry(NoteOrdinal ordinal) const { return notes[ordinal - first].get(); }
+    // Registers the note at ordinal with ordinals
+    void addOrdinal(NoteOrdinal ordinal) {
+        ordinals.insert(OrdinalTable::tag(entry(ordinal)->note->uuid()), ordinal);
+    }
+    // The dictionary and posting lists words in field are looked up in
+    const std::vector<TermId>& termsFor(QueryNode::Field field) const {
+        return field == QueryNode::Field::Title ? title_terms : terms;
+    }
+    const CompressedPostings& postingsFor(QueryNode::Field field) const {
+        return field == QueryNode::Field::Title ? title_postings : postings;
+    }
+    // Indices into termsFor(field) of the terms starting with prefix
+    std::pair<size_t, size_t> prefixRange(const TermArena& arena, std::string_view prefix,
+                                          QueryNode::Field field) const;
+    std::optional<PostingRef> trigramPostings(Trigram gram) const;
+    // The bitmap a type: or has: filter selects
+    const AttributeBitmap& attribute(const QueryNode& filter) const;
+    // Notes modified in [from, to), as a range of by_modified
+    std::pair<size_t, size_t> modifiedRange(int64_t from, int64_t to) const;
+
+    // Posting lists of notes, over candidates: term ids sorted by text that
+    // include every term of notes. Candidates no note has are left out.
+    // previous, if given, is an earlier build over a prefix of notes whose
+    // trigram lists are reused.
+    static std::shared_ptr<Segment> build(NoteOrdinal first,
+                                          std::vector<std::shared_ptr<const IndexedNote>> notes,
+                                          OrdinalTable ordinals,
+                                          const std::vector<TermId>& candidates,
+                                          const TermArena& arena, bool withTrigrams,
+                                          const Segment* previous = nullptr);
+    void buildTrigrams(const TermArena& arena, const Segment* previous = nullptr);
+    // Type and checklist bitmaps and by_modified, from notes
+    void buildAttributes();
+    // Live notes of base and delta, renumbered densely from 0
+    static std::shared_ptr<Segment> merge(const Segment& base, const Segment& delta,
+                                          const std::vector<uint64_t>& deleted,
+                                          const TermArena& arena, bool withTrigrams);
+};
+
+// A term of a note that a query word matches, and which part of it
+struct TermMatch {
+    uint32_t term;    // index into IndexedNote::terms
+    uint32_t offset;  // of the match inside the term
+    uint32_t length;
+    bool exact;       // false if only reached through fuzzy matching
+};
+
+// An immutable version of the index: a large base segment that is rebuilt
+// rarely, a small delta segment with the notes indexed since, and the base
+// notes removed since.
+struct SearchIndex::Version {
+    std::shared_ptr<const Segment> base;
+    std::shared_ptr<const Segment> delta;  // starts at base->end()
+    std::shared_ptr<const std::vector<uint64_t>> deleted;  // bitmap over base ordinals
+    // Shared with later versions, which may add terms to it; this version
+    // only looks up the ids it contains.
+    std::shared_ptr<TermArena> arena;
+    size_t deleted_count = 0;
+    size_t live_count = 0;
+    uint64_t total_length = 0;  // sum of live IndexedNote::length, for BM25
+    bool substring_matching = false;
+    int max_edits = 0;  // fuzzy matching, see SearchIndex::setFuzzyMatching
+    uint64_t generation = 0;  // see SearchIndex::generation()
+
+    NoteOrdinal end() const { return delta->end(); }
+    bool isDeleted(NoteOrdinal ordinal) const {
+        return ordinal < delta->first && testBit(*deleted, ordinal);
+    }
+    // nullptr if the note at ordinal was removed
+    const IndexedNote* entry(NoteOrdinal ordinal) const {
+        if (ordinal >= delta->first) {
+            return delta->entry(ordinal);
+        }
+        return isDeleted(ordinal) ? nullptr : base->entry(ordinal);
+    }
+    std::optional<NoteOrdinal> find(const NoteUUID& uuid) const;
+
+    std::vector<std::shared_ptr<const Note>> filter(const std::optional<QueryNode>& parsed,
+                                                    const SearchOptions& options) const;
+    std::vector<std::shared_ptr<const Note>> refine(const std::string& query,
+                                                    const std::vector<std::shared_ptr<const Note>>& candidates,
+                                                    const SearchOptions& options) const;
+    bool usesSubstringMatch(const std::string& token) const;
+    // Edits a word may be off by; short words always match exactly
+    int editsFor(const std::string& word) const;
+    // Exact (prefix or substring) match against a note's sorted terms
+    bool termsMatch(const std::vector<TermId>& terms, const std::string& token) const;
+    // Exact or, in fuzzy mode, approximate match against a note's terms
+    // that occur in field
+    bool wordMatches(const IndexedNote& note, const std::string& word, QueryNode::Field field) const;
+    // The note's terms that word matches in field, in term order
+    void matchTerms(const IndexedNote& note, const std::string& word, QueryNode::Field field,
+                    std::vector<TermMatch>& out) const;
+    // Ranges of the title dictionaries for Field::Title, of the full ones
+    // otherwise
+    void prefixRanges(const std::string& token, QueryNode::Field field, std::vector<PostingRef>& out) const;
+    // Postings of every term within edits of word (as a prefix), found by
+    // running a Levenshtein automaton over the term dictionaries
+    void fuzzyRanges(const std::string& word, int edits, QueryNode::Field field,
+                     std::vector<PostingRef>& out) const;
+    // Notes containing token, optionally only among within
+    void substringPostings(const std::string& token, const PostingSpan* within, PostingList& out,
+                           const SearchOptions& options) const;
+    // Query evaluation. evaluate() returns the sorted ordinals matching node
+    // (restricted to within, if given); the span points into out or into
+    // within.
+    PostingSpan evaluate(const QueryNode& node, const PostingSpan* within, PostingList& out,
+                         const SearchOptions& options) const;
+    PostingSpan evaluateTerm(const std::string& word, QueryNode::Field field, const PostingSpan* within,
+                             PostingList& out, const SearchOptions& options) const;
+    // type:, has: and modified: filters
+    PostingSpan evaluateFilter(const QueryNode& node, const PostingSpan* within, PostingList& out) const;
+    PostingSpan evaluateAnd(const QueryNode& node, const PostingSpan* within, PostingList& out,
+                            const SearchOptions& options) const;
+    void allOrdinals(const PostingSpan* within, PostingList& out) const;
+    // Estimated number of matching notes, for ordering AND operands
+    double estimate(const QueryNode& node) const;
+    bool matchesNode(const QueryNode& node, const IndexedNote& note) const;
+    bool filterMatches(const QueryNode& node, const IndexedNote& note) const;
+    bool phraseMatches(const IndexedNote& note, const std::vector<std::string>& words,
+                       QueryNode::Field field) const;
+    double documentFrequency(const std::string& token, QueryNode::Field field) const;
+    double weightedFrequency(const IndexedNote& entry, const std::string& token, QueryNode::Field field) const;
+    NoteMatches matchSpans(const std::string& query, const NoteUUID& uuid) const;
+    // Turns sorted matching ordinals into notes, ranking them if requested
+    std::vector<std::shared_ptr<const Note>> collectResults(PostingSpan matches,
+                                                            const std::vector<QueryNode::Word>& tokens,
+                                                            const SearchOptions& options) const;
+};
+
+// A writer's working copy of the current version. The base segment is
+// shared; the delta's notes and the deleted bitmap are private copies, and
+// the delta's posting lists are rebuilt from its notes when publishing.
+struct SearchIndex::Transaction {
+    Transaction() = default;
+    explicit Transaction(const Version& from)
+        : base(from.base)
+        , delta(from.delta)
+        , delta_notes(from.delta->notes)
+        , delta_ordinals(from.delta->ordinals)
+        , delta_terms(from.delta->terms)
+        , deleted(std::make_shared<std::vector<uint64_t>>(*from.deleted))
+        , arena(from.arena)
+        , deleted_count(from.deleted_count)
+        , live_count(from.live_count)
+        , total_length(from.total_length)
+        , substring_matching(from.substring_matching)
+        , max_edits(from.max_edits) {
+    }
+
+    // Starts over from base with an empty delta and nothing deleted
+    void reset(std::shared_ptr<const Segment> newBase) {
+        base = std::move(newBase);
+        auto empty = std::make_shared<Segment>();
+        empty->first = base->end();
+        delta = std::move(empty);
+        delta_notes.clear();
+        delta_ordinals.clear();
+        delta_terms.clear();
+        added_terms.clear();
+        delta_dirty = false;
+        deleted = std::make_shared<std::vector<uint64_t>>(bitmapWords(base->end()), 0);
+        deleted_count = 0;
+    }
+    // The caller adds the note's terms to added_terms (once per batch)
+    void append(std::shared_ptr<const IndexedNote> entry) {
+        const NoteOrdinal ordinal = base->end() + static_cast<NoteOrdinal>(delta_notes.size());
+        delta_ordinals.insert(OrdinalTable::tag(entry->note->uuid()), ordinal);
+        delta_notes.push_back(std::move(entry));
+        delta_dirty = true;
+    }
+    void erase(NoteOrdinal ordinal) {
+        // Leave a hole so other ordinals stay valid; lookups skip it
+        delta_notes[ordinal - base->end()] = nullptr;
+        delta_dirty = true;
+    }
+    void buildDelta();
+    void fold() {
+        buildDelta();
+        const bool holes = std::find(delta_notes.begin(), delta_notes.end(), nullptr) != delta_notes.end();
+        if (base->notes.empty() && !holes) {
+            // Nothing to renumber (e.g. the first load): the delta already
+            // is the new base
+            reset(delta);
+            return;
+        }
+        auto merged = Segment::merge(*base, *delta, *deleted, *arena, substring_matching);
+        compactArena(*merged);
+        reset(std::move(merged));
+    }
+    // Moves the terms of merged, which holds every live note, to a fresh
+    // arena if dead terms make up most of the current one. Entries are
+    // copied with the new ids; earlier versions keep the old arena.
+    void compactArena(Segment& merged) {
+        if (arena->size() < kMinCompactionTerms || merged.terms.size() * 2 > arena->size()) {
+            return;
+        }
+        // merged.terms is sorted by text, so the new ids are in text order
+        auto fresh = std::make_shared<TermArena>();
+        std::vector<TermId> remap(arena->size());
+        for (TermId& term : merged.terms) {
+            const TermId id = fresh->intern(arena->term(term));
+            remap[term] = id;
+            term = id;
+        }
+        for (TermId& term : merged.title_terms) {
+            term = remap[term];
+        }
+        for (auto& entry : merged.notes) {
+            auto copy = std::make_shared<IndexedNote>(*entry);
+            for (TermId& term : copy->terms) {
+                term = remap[term];
+            }
+            entry = std::move(copy);
+        }
+        arena = std::move(fresh);
+    }
+
+    std::shared_ptr<const Segment> base;
+    std::shared_ptr<const Segment> delta;  // stale while delta_dirty
+    std::vector<std::shared_ptr<const IndexedNote>> delta_notes;
+    OrdinalTable delta_ordinals;  // may list removed notes, see OrdinalTable
+    std::vector<TermId> delta_terms;  // of the built delta, sorted by text
+    std::vector<TermId> added_terms;  // of notes appended since, unsorted
+    bool delta_dirty = false;
+    std::shared_ptr<std::vector<uint64_t>> deleted;
+    std::shared_ptr<TermArena> arena;
+    size_t deleted_count = 0;
+    size_t live_count = 0;
+    uint64_t total_length = 0;
+    bool substring_matching = false;
+    int max_edits = 0;
+};
+
+void SearchIndex::TokenizedNotes::add(std::shared_ptr<const Note> note) {
+    // Tokenize title and body separately so ranking can weight the title
+    std::string title;
+    std::string body;
+    const Note& source = *note;
+    auto titleTokens = positionedTokens(source.title(), classes, title);
+    auto bodyTokens = positionedTokens(*source.body(), classes, body);
+
+    auto entry = std::make_shared<IndexedNote>();
+    entry->length = static_cast<uint32_t>(titleTokens.size() + bodyTokens.size());
+    entry->positions.reserve(entry->length);
+    buildTermTable(titleTokens, bodyTokens, terms, entry->terms, entry->frequencies,
+                   entry->positions, entry->position_starts);
+    // Kept for as long as the note is indexed, so don't keep the slack
+    entry->terms.shrink_to_fit();
+    entry->frequencies.shrink_to_fit();
+    entry->position_starts.shrink_to_fit();
+    entry->fingerprint = NoteFingerprint::of(*note);
+    entry->setAttributes(*note);
+    entry->note = std::move(note);
+    entries.push_back(std::move(entry));
+}
+
+std::pair<size_t, size_t> SearchIndex::Segment::prefixRange(const TermArena& arena, std::string_view prefix,
+                                                            QueryNode::Field field) const {
+    const auto& terms = termsFor(field);
+    auto it = lowerBoundTerm(terms, arena, prefix);
+    const auto begin = static_cast<size_t>(it - terms.begin());
+    while (it != terms.end() && startsWith(arena.term(*it), prefix)) {
+        ++it;
+    }
+    return {begin, static_cast<size_t>(it - terms.begin())};
+}
+
+std::optional<PostingRef> SearchIndex::Segment::trigramPostings(Trigram gram) const {
+    auto it = std::lower_bound(trigrams.begin(), trigrams.end(), gram);
+    if (it == trigrams.end() || *it != gram) {
+        return std::nullopt;
+    }
+    return PostingRef{&trigram_postings, static_cast<uint32_t>(it - trigrams.begin())};
+}
+
+const AttributeBitmap& SearchIndex::Segment::attribute(const QueryNode& filter) const {
+    if (filter.kind == QueryNode::Kind::Type) {
+        return types[static_cast<size_t>(filter.noteType)];
+    }
+    return filter.item == QueryNode::Item::Unchecked ? unchecked : checked;
+}
+
+std::pair<size_t, size_t> SearchIndex::Segment::modifiedRange(int64_t from, int64_t to) const {
+    constexpr NoteOrdinal kFirst = 0;
+    auto begin = std::lower_bound(by_modified.begin(), by_modified.end(), std::make_pair(from, kFirst));
+    auto end = std::lower_bound(begin, by_modified.end(), std::make_pair(to, kFirst));
+    return {static_cast<size_t>(begin - by_modified.begin()), static_cast<size_t>(end - by_modified.begin())};
+}
+
+std::shared_ptr<SearchIndex::Segment> SearchIndex::Segment::build(
+    NoteOrdinal first, std::vector<std::shared_ptr<const IndexedNote>> notes,
+    OrdinalTable ordinals, const std::vector<TermId>& candidates,
+    const TermArena& arena, bool withTrigrams, const Segment* previous) {
+    auto segment = std::make_shared<Segment>();
+    segment->first = first;
+    segment->notes = std::move(notes);
+    segment->ordinals = std::move(ordinals);
+
+    // Counting sort of (term, ordinal) pairs: count each candidate's notes,
+    // then fill every list in ordinal order. slot maps a term id to its
+    // candidate index; only entries of candidates are ever read.
+    thread_local std::vector<uint32_t> slot;
+    if (slot.size() < arena.size()) {
+        slot.resize(arena.size());
+    }
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        slot[candidates[i]] = static_cast<uint32_t>(i);
+    }
+    // The title dictionary is sorted the same way, over title occurrences.
+    auto sortPostings = [&segment, &candidates](bool titleOnly, std::vector<TermId>& terms,
+                                                CompressedPostings& postings) {
+        std::vector<uint32_t> starts(candidates.size() + 1, 0);
+        for (const auto& note : segment->notes) {
+            if (note) {
+                for (size_t k = 0; k < note->terms.size(); ++k) {
+                    if (!titleOnly || note->frequencies[k].title > 0) {
+                        ++starts[slot[note->terms[k]] + 1];
+                    }
                 }
             }
-            note_to_terms_.erase(noteTermsIt);
+        }
+        for (size_t i = 1; i < starts.size(); ++i) {
+            starts[i] += starts[i - 1];
+        }
+        PostingList flat(starts.back());
+        std::vector<uint32_t> fill(starts.begin(), starts.end() - 1);
+        for (NoteOrdinal ordinal = segment->first; ordinal < segment->end(); ++ordinal) {
+            if (const IndexedNote* note = segment->entry(ordinal)) {
+                for (size_t k = 0; k < note->terms.size(); ++k) {
+                    if (!titleOnly || note->frequencies[k].title > 0) {
+                        flat[fill[slot[note->terms[k]]]++] = ordinal;
+                    }
+                }
+            }
+        }
+
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if (starts[i + 1] > starts[i]) {
+                terms.push_back(candidates[i]);
+                postings.append(PostingSpan(flat.data() + starts[i], starts[i + 1] - starts[i]));
+            }
+        }
+        terms.shrink_to_fit();
+        postings.shrinkToFit();
+    };
+    sortPostings(false, segment->terms, segment->postings);
+    sortPostings(true, segment->title_terms, segment->title_postings);
+    segment->buildAttributes();
+    if (withTrigrams) {
+        segment->buildTrigrams(arena, previous);
+    }
+    return segment;
+}
+
+void SearchIndex::Segment::buildTrigrams(const TermArena& arena, const Segment* previous) {
+    // Only notes previous doesn't cover have to be split into trigrams.
+    // (trigram, ordinal) pairs are packed so that sorting groups them by
+    // trigram, each group in ordinal order.
+    const NoteOrdinal from = previous ? previous->end() : first;
+    std::vector<uint64_t> pairs;
+    std::vector<Trigram> grams;
+    for (NoteOrdinal ordinal = from; ordinal < end(); ++ordinal) {
+        const IndexedNote* note = entry(ordinal);
+        if (!note) {
+            continue;
+        }
+        grams.clear();
+        for (TermId term : note->terms) {
+            appendTrigrams(arena.term(term), grams);
+        }
+        std::sort(grams.begin(), grams.end());
+        grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+        for (Trigram gram : grams) {
+            pairs.push_back(uint64_t{gram} << 32 | ordinal);
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    // Walk previous's trigrams and the new ones together; previous lists
+    // lose the notes removed since, new ordinals come after all of them.
+    static const std::vector<Trigram> kNone;
+    const std::vector<Trigram>& old = previous ? previous->trigrams : kNone;
+    std::vector<Trigram> merged;
+    CompressedPostings postings;
+    PostingList decoded;
+    PostingList list;
+    size_t i = 0;
+    size_t k = 0;
+    while (i < old.size() || k < pairs.size()) {
+        const Trigram gram = k == pairs.size() ||
+            (i < old.size() && old[i] <= static_cast<Trigram>(pairs[k] >> 32))
+            ? old[i] : static_cast<Trigram>(pairs[k] >> 32);
+        list.clear();
+        if (i < old.size() && old[i] == gram) {
+            previous->trigram_postings.decode(static_cast<uint32_t>(i++), decoded);
+            for (NoteOrdinal ordinal : decoded) {
+                if (entry(ordinal)) {
+                    list.push_back(ordinal);
+                }
+            }
+        }
+        for (; k < pairs.size() && static_cast<Trigram>(pairs[k] >> 32) == gram; ++k) {
+            list.push_back(static_cast<NoteOrdinal>(pairs[k]));
+        }
+        if (!list.empty()) {
+            merged.push_back(gram);
+            postings.append(list);
+        }
+    }
+    merged.shrink_to_fit();
+    postings.shrinkToFit();
+    trigrams = std::move(merged);
+    trigram_postings = std::move(postings);
+}
+
+void SearchIndex::Segment::buildAttributes() {
+    const AttributeBitmap empty{std::vector<uint64_t>(bitmapWords(notes.size()), 0), 0};
+    types.fill(empty);
+    unchecked = empty;
+    checked = empty;
+    by_modified.clear();
+    for (NoteOrdinal offset = 0; offset < notes.size(); ++offset) {
+        const IndexedNote* note = notes[offset].get();
+        if (!note) {
+            continue;
+        }
+        types[static_cast<size_t>(note->type)].add(offset);
+        if (note->unchecked) {
+            unchecked.add(offset);
+        }
+        if (note->checked) {
+            checked.add(offset);
+        }
+        by_modified.emplace_back(note->fingerprint.modifiedMillis, first + offset);
+    }
+    std::sort(by_modified.begin(), by_modified.end());
+    by_modified.shrink_to_fit();
+}
+
+std::shared_ptr<SearchIndex::Segment> SearchIndex::Segment::merge(
+    const Segment& base, const Segment& delta, const std::vector<uint64_t>& deleted,
+    const TermArena& arena, bool withTrigrams) {
+    // Old ordinal -> new ordinal. The mapping is monotonic, so rewritten
+    // posting lists remain sorted.
+    constexpr NoteOrdinal kDropped = ~NoteOrdinal{0};
+    std::vector<NoteOrdinal> remap(delta.end(), kDropped);
+
+    auto merged = std::make_shared<Segment>();
+    merged->notes.reserve(base.notes.size() + delta.notes.size());
+    merged->ordinals.reserve(base.notes.size() + delta.notes.size());
+    auto keep = [&remap, &merged](NoteOrdinal ordinal, const std::shared_ptr<const IndexedNote>& entry) {
+        if (!entry) {
+            return;
+        }
+        remap[ordinal] = merged->end();
+        merged->notes.push_back(entry);
+        merged->addOrdinal(remap[ordinal]);
+    };
+    for (NoteOrdinal ordinal = base.first; ordinal < base.end(); ++ordinal) {
+        if (!testBit(deleted, ordinal)) {
+            keep(ordinal, base.notes[ordinal - base.first]);
+        }
+    }
+    for (NoteOrdinal ordinal = delta.first; ordinal < delta.end(); ++ordinal) {
+        keep(ordinal, delta.notes[ordinal - delta.first]);
+    }
+
+    PostingList decoded;
+    PostingList list;
+    auto rewrite = [&remap, &decoded, &list](const CompressedPostings& from, uint32_t index) {
+        from.decode(index, decoded);
+        for (NoteOrdinal ordinal : decoded) {
+            if (remap[ordinal] != kDropped) {
+                list.push_back(remap[ordinal]);
+            }
+        }
+    };
+
+    // Walk both sorted dictionaries together; delta ordinals all come after
+    // base ordinals, so a term's delta list is appended to its base list.
+    auto mergeTerms = [&](const std::vector<TermId>& baseTerms, const CompressedPostings& basePostings,
+                          const std::vector<TermId>& deltaTerms, const CompressedPostings& deltaPostings,
+                          std::vector<TermId>& terms, CompressedPostings& postings) {
+        size_t i = 0;
+        size_t j = 0;
+        while (i < baseTerms.size() || j < deltaTerms.size()) {
+            const bool fromBase = j == deltaTerms.size() ||
+                (i < baseTerms.size() && arena.term(baseTerms[i]) <= arena.term(deltaTerms[j]));
+            const TermId term = fromBase ? baseTerms[i] : deltaTerms[j];
+            list.clear();
+            if (i < baseTerms.size() && baseTerms[i] == term) {
+                rewrite(basePostings, static_cast<uint32_t>(i++));
+            }
+            if (j < deltaTerms.size() && deltaTerms[j] == term) {
+                rewrite(deltaPostings, static_cast<uint32_t>(j++));
+            }
+            if (!list.empty()) {
+                terms.push_back(term);
+                postings.append(list);
+            }
+        }
+        terms.shrink_to_fit();
+        postings.shrinkToFit();
+    };
+    mergeTerms(base.terms, base.postings, delta.terms, delta.postings, merged->terms, merged->postings);
+    mergeTerms(base.title_terms, base.title_postings, delta.title_terms, delta.title_postings,
+               merged->title_terms, merged->title_postings);
+    merged->buildAttributes();
+
+    if (withTrigrams) {
+        size_t i = 0;
+        size_t j = 0;
+        while (i < base.trigrams.size() || j < delta.trigrams.size()) {
+            const Trigram gram = j == delta.trigrams.size() ||
+                (i < base.trigrams.size() && base.trigrams[i] <= delta.trigrams[j])
+                ? base.trigrams[i] : delta.trigrams[j];
+            list.clear();
+            if (i < base.trigrams.size() && base.trigrams[i] == gram) {
+                rewrite(base.trigram_postings, static_cast<uint32_t>(i++));
+            }
+            if (j < delta.trigrams.size() && delta.trigrams[j] == gram) {
+                rewrite(delta.trigram_postings, static_cast<uint32_t>(j++));
+            }
+            if (!list.empty()) {
+                merged->trigrams.push_back(gram);
+                merged->trigram_postings.append(list);
+            }
+        }
+        merged->trigrams.shrink_to_fit();
+        merged->trigram_postings.shrinkToFit();
+    }
+    return merged;
+}
+
+void SearchIndex::Transaction::buildDelta() {
+    if (!delta_dirty) {
+        return;
+    }
+    // The built delta's terms plus the new ones, sorted by text. Terms of
+    // removed notes may linger here; build() leaves them out.
+    std::vector<bool> seen(arena->size(), false);
+    for (TermId term : delta_terms) {
+        seen[term] = true;
+    }
+    std::vector<TermId> fresh;
+    for (TermId term : added_terms) {
+        if (!seen[term]) {
+            seen[term] = true;
+            fresh.push_back(term);
+        }
+    }
+    const TermArena& terms = *arena;
+    auto byText = [&terms](TermId a, TermId b) { return terms.term(a) < terms.term(b); };
+    std::sort(fresh.begin(), fresh.end(), byText);
+    std::vector<TermId> candidates;
+    candidates.reserve(delta_terms.size() + fresh.size());
+    std::merge(delta_terms.begin(), delta_terms.end(), fresh.begin(), fresh.end(),
+               std::back_inserter(candidates), byText);
+
+    // The built delta covers a prefix of delta_notes (later changes only
+    // append notes or leave holes), so its trigram lists can be extended
+    delta = Segment::build(base->end(), delta_notes, delta_ordinals, candidates, *arena,
+                           substring_matching, delta.get());
+    delta_terms = delta->terms;
+    added_terms.clear();
+    delta_dirty = false;
+}
+
+SearchIndex::SearchIndex() {
+    Transaction txn;
+    txn.arena = std::make_shared<TermArena>();
+    txn.reset(std::make_shared<Segment>());
+    publish(txn);
+}
+
+SearchIndex::~SearchIndex() = default;
+
+std::shared_ptr<const SearchIndex::Version> SearchIndex::current() const {
+    return std::atomic_load(&current_);
+}
+
+void SearchIndex::publish(Transaction& txn) {
+    // The delta is rebuilt by every write, so it is folded into a new base
+    // once it grows; likewise once removed notes make up most of the base.
+    const bool deltaFull = txn.delta_notes.size() >= kMaxDeltaNotes;
+    const bool baseSparse = txn.deleted_count >= kMinCompactionHoles &&
+                            txn.deleted_count * 2 >= txn.base->notes.size();
+    if (deltaFull || baseSparse) {
+        txn.fold();
+    } else {
+        txn.buildDelta();
+    }
+
+    auto version = std::make_shared<Version>();
+    version->base = txn.base;
+    version->delta = txn.delta;
+    version->deleted = txn.deleted;
+    version->arena = txn.arena;
+    version->deleted_count = txn.deleted_count;
+    version->live_count = txn.live_count;
+    version->total_length = txn.total_length;
+    version->substring_matching = txn.substring_matching;
+    version->max_edits = txn.max_edits;
+    version->generation = ++generation_;
+    std::atomic_store(&current_, std::shared_ptr<const Version>(std::move(version)));
+}
+
+void SearchIndex::indexTokenized(Transaction& txn, TokenizedNotes& notes) {
+    // Each distinct term is interned once per batch, not once per note.
+    // A note's private ids are in text order, so its mapped ids are too.
+    std::vector<TermId> ids(notes.terms.size());
+    for (TermId id = 0; id < ids.size(); ++id) {
+        ids[id] = txn.arena->intern(notes.terms.term(id));
+    }
+    for (auto& entry : notes.entries) {
+        for (TermId& term : entry->terms) {
+            term = ids[term];
+        }
+        indexNoteInternal(txn, std::move(entry));
+    }
+    notes.entries.clear();
+    txn.added_terms.insert(txn.added_terms.end(), ids.begin(), ids.end());
+}
+
+void SearchIndex::indexNoteInternal(Transaction& txn, std::shared_ptr<const IndexedNote> entry) {
+    // Re-indexing a note moves it to the end, like a fresh insertion
+    removeNoteInternal(txn, entry->note->uuid());
+    ++txn.live_count;
+    txn.total_length += entry->length;
+    txn.append(std::move(entry));
+}
+
+bool SearchIndex::removeNoteInternal(Transaction& txn, const NoteUUID& uuid) {
+    const uint32_t tag = OrdinalTable::tag(uuid);
+    const NoteOrdinal deltaFirst = txn.base->end();
+    auto inDelta = txn.delta_ordinals.find(tag, [&txn, &uuid, deltaFirst](NoteOrdinal ordinal) {
+        const auto& entry = txn.delta_notes[ordinal - deltaFirst];
+        return entry && entry->note->uuid() == uuid;
+    });
+    if (inDelta) {
+        // The delta's notes are our own copy, so they can be edited in place
+        --txn.live_count;
+        txn.total_length -= txn.delta_notes[*inDelta - deltaFirst]->length;
+        txn.erase(*inDelta);
+        return true;
+    }
+
+    // The base is shared with readers; just mark the note as gone
+    const Segment& base = *txn.base;
+    auto inBase = base.ordinals.find(tag, [&base, &uuid](NoteOrdinal ordinal) {
+        return base.entry(ordinal)->note->uuid() == uuid;
+    });
+    if (!inBase || testBit(*txn.deleted, *inBase)) {
+        return false;
+    }
+    setBit(*txn.deleted, *inBase);
+    ++txn.deleted_count;
+    --txn.live_count;
+    txn.total_length -= base.entry(*inBase)->length;
+    return true;
+}
+
+void SearchIndex::indexNote(std::shared_ptr<const Note> note) {
+    // Tokenizing doesn't touch the index, so it happens outside the lock
+    TokenizedNotes tokenized;
+    tokenized.add(std::move(note));
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    Transaction txn(*current());
+    indexTokenized(txn, tokenized);
+    publish(txn);
+}
+
+void SearchIndex::indexNotes(const std::vector<std::shared_ptr<const Note>>& notes) {
+    indexNotes(notes.data(), notes.size());
+}
+
+void SearchIndex::indexNotes(const std::shared_ptr<const Note>* notes, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    // Tokenize contiguous slices on separate threads, each into its own
+    // arena; only merging the arenas and publishing happen under the lock.
+    // Notes are indexed in their given order whatever the thread count.
+    const size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+    const size_t threads = std::clamp<size_t>(count / kMinNotesPerThread, 1, hardware);
+    std::vector<TokenizedNotes> slices(threads);
+    auto tokenize = [&slices, notes, count, threads](size_t slice) {
+        const size_t begin = count * slice / threads;
+        const size_t end = count * (slice + 1) / threads;
+        slices[slice].entries.reserve(end - begin);
+        for (size_t i = begin; i < end; ++i) {
+            slices[slice].add(notes[i]);
+        }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (size_t slice = 1; slice < threads; ++slice) {
+        workers.emplace_back(tokenize, slice);
+    }
+    tokenize(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    Transaction txn(*current());
+    for (auto& slice : slices) {
+        indexTokenized(txn, slice);
+    }
+    publish(txn);
+}
+
+void SearchIndex::removeNote(const NoteUUID& uuid) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    Transaction txn(*current());
+    // Unknown notes leave the generation (and cached results) alone
+    if (removeNoteInternal(txn, uuid)) {
+        publish(txn);
+    }
+}
+
+void SearchIndex::updateNote(std::shared_ptr<const Note> note) {
+    const Note& source = *note;
+    const NoteFingerprint fingerprint = NoteFingerprint::of(source);
+    std::unique_lock<std::mutex> lock(write_mutex_);
+    auto version = current();
+    const IndexedNote* indexed = nullptr;
+    if (auto ordinal = version->find(source.uuid())) {
+        indexed = version->entry(*ordinal);
+    }
+
+    if (!indexed || indexed->fingerprint.bodyHash != fingerprint.bodyHash) {
+        // The body changed: tokenize it outside the lock, like indexNote.
+        // Removal and re-insertion are published together, so no search
+        // ever sees the note missing.
+        lock.unlock();
+        TokenizedNotes tokenized;
+        tokenized.add(std::move(note));
+        lock.lock();
+        // Another update or a removal may have landed meanwhile. A removed
+        // note stays removed, and a newer version isn't replaced by this
+        // one. (version keeps the entry seen above alive, so its address
+        // can't be reused.)
+        auto latestVersion = current();
+        const IndexedNote* latest = nullptr;
+        if (auto ordinal = latestVersion->find(source.uuid())) {
+            latest = latestVersion->entry(*ordinal);
+        }
+        if (latest != indexed && (!latest || latest->note->modified() > source.modified())) {
+            return;
+        }
+        Transaction txn(*latestVersion);
+        indexTokenized(txn, tokenized);
+        publish(txn);
+        return;
+    }
+
+    // Saving an unchanged note changes nothing searchable; keeping the
+    // version keeps cached results valid (and the note in its place)
+    if (indexed->note == note && indexed->fingerprint == fingerprint && indexed->type == source.noteType()) {
+        return;
+    }
+    auto entry = std::make_shared<IndexedNote>(*indexed);
+    Transaction txn(*version);
+    if (!indexed->fingerprint.sameContent(fingerprint)) {
+        entry->replaceTitle(source.title(), *txn.arena);
+    }
+    entry->fingerprint = fingerprint;
+    entry->type = source.noteType();
+    entry->note = std::move(note);
+    txn.added_terms.insert(txn.added_terms.end(), entry->terms.begin(), entry->terms.end());
+    indexNoteInternal(txn, std::move(entry));
+    publish(txn);
+}
+
+void SearchIndex::setSubstringMatching(bool enabled) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    Transaction txn(*current());
+    if (enabled == txn.substring_matching) {
+        return;
+    }
+
+    auto merged = Segment::merge(*txn.base, *txn.delta, *txn.deleted, *txn.arena, false);
+    if (enabled) {
+        merged->buildTrigrams(*txn.arena);
+    }
+    txn.substring_matching = enabled;
+    txn.reset(std::move(merged));
+    publish(txn);
+}
+
+bool SearchIndex::substringMatching() const {
+    return current()->substring_matching;
+}
+
+void SearchIndex::setFuzzyMatching(int maxEdits) {
+    // Nothing to rebuild: the automaton runs over the existing dictionary
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    Transaction txn(*current());
+    if (txn.max_edits == std::clamp(maxEdits, 0, 2)) {
+        return;
+    }
+    txn.max_edits = std::clamp(maxEdits, 0, 2);
+    publish(txn);
+}
+
+int SearchIndex::fuzzyMatching() const {
+    return current()->max_edits;
+}
+
+IndexMemoryUsage SearchIndex::memoryUsage() const {
+    // The arena's bookkeeping is only stable while no writer interns
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    auto version = current();
+
+    IndexMemoryUsage usage;
+    usage.termArena = version->arena->memoryUsage();
+    usage.noteTables = version->deleted->capacity() * sizeof(uint64_t);
+    for (const Segment* segment : {version->base.get(), version->delta.get()}) {
+        usage.termTables += (segment->terms.capacity() + segment->title_terms.capacity()) * sizeof(TermId);
+        usage.postings += segment->postings.memoryUsage() + segment->title_postings.memoryUsage();
+        for (const auto& type : segment->types) {
+            usage.filters += type.memoryUsage();
+        }
+        usage.filters += segment->unchecked.memoryUsage() + segment->checked.memoryUsage() +
+                         segment->by_modified.capacity() * sizeof(segment->by_modified[0]);
+        usage.trigramPostings += segment->trigrams.capacity() * sizeof(Trigram) +
+                                 segment->trigram_postings.memoryUsage();
+        usage.noteTables += segment->notes.capacity() * sizeof(segment->notes[0]) +
+                            segment->ordinals.memoryUsage();
+        for (const auto& note : segment->notes) {
+            if (!note) {
+                continue;
+            }
+            usage.noteTables += sizeof(IndexedNote);
+            usage.noteTerms += note->terms.capacity() * sizeof(TermId);
+            usage.notePositions += note->frequencies.capacity() * sizeof(TermFrequency) +
+                                   note->positions.capacity() * sizeof(uint32_t) +
+                                   note->position_starts.capacity() * sizeof(uint32_t);
+        }
+    }
+    return usage;
+}
+
+std::optional<NoteOrdinal> SearchIndex::Version::find(const NoteUUID& uuid) const {
+    const uint32_t tag = OrdinalTable::tag(uuid);
+    auto inDelta = delta->ordinals.find(tag, [this, &uuid](NoteOrdinal ordinal) {
+        const IndexedNote* note = delta->entry(ordinal);
+        return note && note->note->uuid() == uuid;
+    });
+    if (inDelta) {
+        return inDelta;
+    }
+    auto inBase = base->ordinals.find(tag, [this, &uuid](NoteOrdinal ordinal) {
+        return base->entry(ordinal)->note->uuid() == uuid;
+    });
+    if (inBase && !isDeleted(*inBase)) {
+        return inBase;
+    }
+    return std::nullopt;
+}
+
+bool SearchIndex::Version::usesSubstringMatch(const std::string& token) const {
+    return substring_matching && token.size() >= kNgramSize;
+}
+
+int SearchIndex::Version::editsFor(const std::string& word) const {
+    if (word.size() >= kMinLengthTwoEdits) {
+        return std::min(max_edits, 2);
+    }
+    return word.size() >= kMinLengthOneEdit ? std::min(max_edits, 1) : 0;
+}
+
+bool SearchIndex::Version::termsMatch(const std::vector<TermId>& terms, const std::string& token) const {
+    if (usesSubstringMatch(token)) {
+        return std::any_of(terms.begin(), terms.end(), [this, &token](TermId term) {
+            return arena->term(term).find(token) != std::string_view::npos;
+        });
+    }
+    // terms is sorted, so the first term >= token is the only candidate
+    // that can start with it.
+    auto it = lowerBoundTerm(terms, *arena, token);
+    return it != terms.end() && startsWith(arena->term(*it), token);
+}
+
+bool SearchIndex::Version::wordMatches(const IndexedNote& note, const std::string& word,
+                                       QueryNode::Field field) const {
+    if (field != QueryNode::Field::Any) {
+        thread_local std::vector<TermMatch> terms;
+        matchTerms(note, word, field, terms);
+        return !terms.empty();
+    }
+    if (termsMatch(note.terms, word)) {
+        return true;
+    }
+    const int edits = editsFor(word);
+    if (edits == 0) {
+        return false;
+    }
+    bool found = false;
+    forEachFuzzyTerm(note.terms, *arena, LevenshteinAutomaton(word, edits), [&found](size_t, size_t) {
+        found = true;
+        return false;
+    });
+    return found;
+}
+
+void SearchIndex::Version::matchTerms(const IndexedNote& note, const std::string& word,
+                                      QueryNode::Field field, std::vector<TermMatch>& out) const {
+    out.clear();
+    const auto& terms = note.terms;
+    const auto length = static_cast<uint32_t>(word.size());
+    if (usesSubstringMatch(word)) {
+        for (size_t i = 0; i < terms.size(); ++i) {
+            const size_t at = arena->term(terms[i]).find(word);
+            if (at != std::string_view::npos) {
+                out.push_back(TermMatch{static_cast<uint32_t>(i), static_cast<uint32_t>(at), length, true});
+            }
+        }
+    } else {
+        auto it = lowerBoundTerm(terms, *arena, word);
+        for (; it != terms.end() && startsWith(arena->term(*it), word); ++it) {
+            out.push_back(TermMatch{static_cast<uint32_t>(it - terms.begin()), 0, length, true});
+        }
+    }
+
+    const int edits = editsFor(word);
+    if (edits > 0) {
+        const size_t exactCount = out.size();
+        auto byTerm = [](const TermMatch& a, const TermMatch& b) { return a.term < b.term; };
+        forEachFuzzyTerm(terms, *arena, LevenshteinAutomaton(word, edits), [&](size_t index, size_t matched) {
+            const TermMatch match{static_cast<uint32_t>(index), 0, static_cast<uint32_t>(matched), false};
+            if (!std::binary_search(out.begin(), out.begin() + exactCount, match, byTerm)) {
+                out.push_back(match);
+            }
+            return true;
+        });
+        std::inplace_merge(out.begin(), out.begin() + exactCount, out.end(), byTerm);
+    }
+
+    if (field != QueryNode::Field::Any) {
+        out.erase(std::remove_if(out.begin(), out.end(), [&note, field](const TermMatch& match) {
+            return !occursIn(note.frequencies[match.term], field);
+        }), out.end());
+    }
+}
+
+void SearchIndex::Version::prefixRanges(const std::string& token, QueryNode::Field field,
+                                        std::vector<PostingRef>& out) const {
+    // All terms sharing the prefix sort contiguously from lower_bound(token)
+    out.clear();
+    for (const Segment* segment : {base.get(), delta.get()}) {
+        const auto [begin, end] = segment->prefixRange(*arena, token, field);
+        for (size_t i = begin; i < end; ++i) {
+            out.push_back(PostingRef{&segment->postingsFor(field), static_cast<uint32_t>(i)});
+        }
+    }
+}
+
+void SearchIndex::Version::fuzzyRanges(const std::string& word, int edits, QueryNode::Field field,
+                                       std::vector<PostingRef>& out) const {
+    out.clear();
+    const LevenshteinAutomaton automaton(word, edits);
+    for (const Segment* segment : {base.get(), delta.get()}) {
+        const auto& postings = segment->postingsFor(field);
+        forEachFuzzyTerm(segment->termsFor(field), *arena, automaton, [&out, &postings](size_t index, size_t) {
+            out.push_back(PostingRef{&postings, static_cast<uint32_t>(index)});
+            return true;
+        });
+    }
+}
+
+void SearchIndex::Version::substringPostings(const std::string& token, const PostingSpan* within,
+                                             PostingList& out, const SearchOptions& options) const {
+    out.clear();
+
+    thread_local std::vector<Trigram> grams;
+    thread_local std::vector<PostingRef> lists;
+    thread_local PostingList current;
+    thread_local PostingList next;
+    grams.clear();
+    appendTrigrams(token, grams);
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+
+    // Segments are visited in ordinal order, so appending keeps out sorted
+    for (const Segment* segment : {base.get(), delta.get()}) {
+        // Prefilter: a note can only contain token if it has all of its trigrams.
+        lists.clear();
+        for (Trigram gram : grams) {
+            auto list = segment->trigramPostings(gram);
+            if (!list) {
+                lists.clear();
+                break;
+            }
+            lists.push_back(*list);
+        }
+        if (lists.empty()) {
+            continue;
+        }
+        std::sort(lists.begin(), lists.end(),
+                  [](const PostingRef& a, const PostingRef& b) { return a.size() < b.size(); });
+
+        // Decode the rarest list (only where the rest of the query still
+        // allows notes), then look the survivors up in the others.
+        readPostings(lists.front(), within, current);
+        for (size_t i = 1; i < lists.size() && !current.empty(); ++i) {
+            const PostingSpan candidates(current);
+            readPostings(lists[i], &candidates, next);
+            std::swap(current, next);
+        }
+
+        // Verify: sharing all trigrams doesn't mean they are adjacent in one term.
+        for (size_t i = 0; i < current.size(); ++i) {
+            if (i % kCancelCheckInterval == 0 && isCancelled(options)) {
+                out.clear();
+                return;
+            }
+            const NoteOrdinal ordinal = current[i];
+            const IndexedNote* note = entry(ordinal);
+            if (note && termsMatch(note->terms, token)) {
+                out.push_back(ordinal);
+            }
+        }
+    }
+}
+
+std::vector<std::shared_ptr<const Note>> SearchIndex::filter(const std::string& query,
+                                                             const SearchOptions& options) const {
+    // The version stays alive (and unchanged) until this search is done,
+    // whatever writers do meanwhile.
+    auto version = current();
+    const std::string key = QueryResultCache::normalize(query) + '\0' + std::to_string(options.rankLimit);
+    if (auto cached = result_cache_.find(key, version->generation)) {
+        return *cached;
+    }
+
+    auto parsed = QueryParser::parse(query);
+    auto results = version->filter(parsed, options);
+    // Cancelled searches return partial results, and relative dates match
+    // different notes as time passes
+    if (!isCancelled(options) && !(parsed && dependsOnTime(*parsed))) {
+        result_cache_.insert(key, version->generation, results);
+    }
+    return results;
+}
+
+void SearchIndex::setResultCacheCapacity(size_t capacity) {
+    result_cache_.setCapacity(capacity);
+}
+
+QueryCacheStats SearchIndex::resultCacheStats() const {
+    return result_cache_.stats();
+}
+
+uint64_t SearchIndex::generation() const {
+    return current()->generation;
+}
+
+std::vector<std::shared_ptr<const Note>> SearchIndex::Version::filter(const std::optional<QueryNode>& parsed,
+                                                                      const SearchOptions& options) const {
+    if (!parsed) {
+        std::vector<std::shared_ptr<const Note>> all;
+        all.reserve(live_count);
+        for (NoteOrdinal ordinal = 0; ordinal < end(); ++ordinal) {
+            if (const IndexedNote* note = entry(ordinal)) {
+                all.push_back(note->note);
+            }
+        }
+        return all;
+    }
+
+    // Reused across searches on the same worker thread, so steady-state
+    // typing doesn't allocate for the result set.
+    thread_local PostingList storage;
+    thread_local PostingList live;
+    PostingSpan matches = evaluate(*parsed, nullptr, storage, options);
+    if (isCancelled(options)) {
+        return {};
+    }
+
+    // Base posting lists still list notes removed since the base was built
+    if (deleted_count > 0) {
+        live.clear();
+        for (size_t i = 0; i < matches.size; ++i) {
+            if (!isDeleted(matches.data[i])) {
+                live.push_back(matches.data[i]);
+            }
+        }
+        matches = PostingSpan(live);
+    }
+
+    std::vector<QueryNode::Word> words;
+    parsed->collectWords(words);
+    return collectResults(matches, words, options);
+}
+
+void SearchIndex::Version::allOrdinals(const PostingSpan* within, PostingList& out) const {
+    if (within) {
+        out.assign(within->data, within->data + within->size);
+        return;
+    }
+    out.clear();
+    out.reserve(live_count);
+    for (NoteOrdinal ordinal = 0; ordinal < end(); ++ordinal) {
+        if (entry(ordinal)) {
+            out.push_back(ordinal);
+        }
+    }
+}
+
+double SearchIndex::Version::estimate(const QueryNode& node) const {
+    const double live = static_cast<double>(live_count);
+    switch (node.kind) {
+    case QueryNode::Kind::Term:
+        return documentFrequency(node.words.front(), node.field);
+    case QueryNode::Kind::Phrase: {
+        double rarest = live;
+        for (const auto& word : node.words) {
+            rarest = std::min(rarest, documentFrequency(word, node.field));
+        }
+        return rarest;
+    }
+    case QueryNode::Kind::And: {
+        double rarest = live;
+        for (const auto& child : node.children) {
+            if (child.kind != QueryNode::Kind::Not) {
+                rarest = std::min(rarest, estimate(child));
+            }
+        }
+        return rarest;
+    }
+    case QueryNode::Kind::Or: {
+        double sum = 0.0;
+        for (const auto& child : node.children) {
+            sum += estimate(child);
+        }
+        return std::min(sum, live);
+    }
+    case QueryNode::Kind::Not:
+        return live - estimate(node.children.front());
+    case QueryNode::Kind::Type:
+    case QueryNode::Kind::Has:
+        return std::min(live, static_cast<double>(base->attribute(node).count + delta->attribute(node).count));
+    case QueryNode::Kind::Modified: {
+        size_t count = 0;
+        for (const Segment* segment : {base.get(), delta.get()}) {
+            const auto [begin, end] = segment->modifiedRange(node.modifiedFrom, node.modifiedTo);
+            count += end - begin;
+        }
+        return std::min(live, static_cast<double>(count));
+    }
+    }
+    return live;
+}
+
+PostingSpan SearchIndex::Version::evaluate(const QueryNode& node, const PostingSpan* within,
+                                           PostingList& out, const SearchOptions& options) const {
+    out.clear();
+    if (isCancelled(options)) {
+        return out;
+    }
+
+    switch (node.kind) {
+    case QueryNode::Kind::Term:
+        return evaluateTerm(node.words.front(), node.field, within, out, options);
+
+    case QueryNode::Kind::Phrase: {
+        // Every word must occur; whether they occur in a row is checked on
+        // the (usually few) notes that have them all.
+        QueryNode words;
+        words.kind = QueryNode::Kind::And;
+        for (const auto& word : node.words) {
+            QueryNode term;
+            term.words.push_back(word);
+            term.field = node.field;
+            words.children.push_back(std::move(term));
+        }
+        PostingList candidates;
+        PostingSpan span = evaluateAnd(words, within, candidates, options);
+        for (size_t i = 0; i < span.size; ++i) {
+            if (i % kCancelCheckInterval == 0 && isCancelled(options)) {
+                out.clear();
+                return out;
+            }
+            const IndexedNote* note = entry(span.data[i]);
+            if (note && phraseMatches(*note, node.words, node.field)) {
+                out.push_back(span.data[i]);
+            }
+        }
+        return out;
+    }
+
+    case QueryNode::Kind::And:
+        return evaluateAnd(node, within, out, options);
+
+    case QueryNode::Kind::Or: {
+        std::vector<PostingList> results(node.children.size());
+        std::vector<PostingSpan> spans;
+        for (size_t i = 0; i < node.children.size(); ++i) {
+            PostingSpan span = evaluate(node.children[i], within, results[i], options);
+            if (span.size > 0) {
+                spans.push_back(span);
+            }
+        }
+        unionPostings(spans, end(), out);
+        return out;
+    }
+
+    case QueryNode::Kind::Not: {
+        // Only reached outside an AND, e.g. "a OR -b"
+        PostingList universe;
+        allOrdinals(within, universe);
+        const PostingSpan candidates(universe);
+        PostingList excludedStorage;
+        PostingSpan excluded = evaluate(node.children.front(), &candidates, excludedStorage, options);
+        differencePostings(universe, excluded, out);
+        return out;
+    }
+
+    case QueryNode::Kind::Type:
+    case QueryNode::Kind::Has:
+    case QueryNode::Kind::Modified:
+        return evaluateFilter(node, within, out);
+    }
+    return out;
+}
+
+PostingSpan SearchIndex::Version::evaluateTerm(const std::string& word, QueryNode::Field field,
+                                               const PostingSpan* within, PostingList& out,
+                                               const SearchOptions& options) const {
+    const bool infix = usesSubstringMatch(word);
+    if (field == QueryNode::Field::Body || (field == QueryNode::Field::Title && infix)) {
+        // No index of its own (the trigram index covers both fields): find
+        // the notes with the word anywhere, then check where it occurs
+        PostingList candidates;
+        const PostingSpan span = evaluateTerm(word, QueryNode::Field::Any, within, candidates, options);
+        for (size_t i = 0; i < span.size; ++i) {
+            if (i % kCancelCheckInterval == 0 && isCancelled(options)) {
+                out.clear();
+                return out;
+            }
+            const IndexedNote* note = entry(span.data[i]);
+            if (note && wordMatches(*note, word, field)) {
+                out.push_back(span.data[i]);
+            }
+        }
+        return out;
+    }
+    const int edits = editsFor(word);
+
+    // Infix matching: "base" finds "database" through the trigram index.
+    if (infix) {
+        substringPostings(word, within, out, options);
+        if (edits == 0) {
+            return out;
         }
     }
-    
-    all_notes_.push_back(note);
-    
-    // Tokenize title and body
-    std::string text = note->title() + " " + note->body();
-    auto tokens = tokenize(text);
-    
-    note_to_terms_[note.get()] = tokens;
-    
-    for (const auto& token : tokens) {
-        terms_to_notes_[token].push_back(note.get());
+
+    // Prefix partial matching: query word "proj" matches indexed term
+    // "project". In fuzzy mode, so do "porj" and "prjo". title: words are
+    // looked up in the title dictionaries.
+    thread_local std::vector<PostingRef> ranges;
+    if (edits > 0) {
+        fuzzyRanges(word, edits, field, ranges);
+    } else {
+        prefixRanges(word, field, ranges);
+    }
+    PostingList infixMatches;
+    if (infix) {
+        infixMatches.swap(out);
+    }
+    if (ranges.size() == 1 && infixMatches.empty()) {
+        readPostings(ranges.front(), within, out);
+        return out;
+    }
+
+    // Decode every list (only where it meets within) into one buffer, then
+    // merge them
+    thread_local PostingList decoded;
+    thread_local PostingList list;
+    thread_local std::vector<std::pair<size_t, size_t>> bounds;
+    decoded.clear();
+    bounds.clear();
+    for (const auto& range : ranges) {
+        readPostings(range, within, list);
+        if (!list.empty()) {
+            bounds.emplace_back(decoded.size(), list.size());
+            decoded.insert(decoded.end(), list.begin(), list.end());
+        }
     }
+    std::vector<PostingSpan> spans;
+    spans.reserve(bounds.size() + 1);
+    for (const auto& [offset, size] : bounds) {
+        spans.emplace_back(decoded.data() + offset, size);
+    }
+    // Already restricted to within
+    if (!infixMatches.empty()) {
+        spans.emplace_back(infixMatches);
+    }
+    unionPostings(spans, end(), out);
+    return out;
 }
 
-void SearchIndex::indexNote(std::shared_ptr<Note> note) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    indexNoteInternal(note);
+PostingSpan SearchIndex::Version::evaluateAnd(const QueryNode& node, const PostingSpan* within,
+                                              PostingList& out, const SearchOptions& options) const {
+    // Plan: required operands rarest-first, each evaluated only among the
+    // notes that survived the previous ones, then the exclusions. The first
+    // empty intermediate result ends the evaluation.
+    std::vector<std::pair<double, const QueryNode*>> required;
+    std::vector<const QueryNode*> excluded;
+    for (const auto& child : node.children) {
+        if (child.kind == QueryNode::Kind::Not) {
+            excluded.push_back(&child.children.front());
+        } else {
+            required.emplace_back(estimate(child), &child);
+        }
+    }
+    std::stable_sort(required.begin(), required.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    PostingList buffers[2];
+    size_t next = 0;
+    PostingSpan current;
+    const PostingSpan* scope = within;
+    for (const auto& operand : required) {
+        current = evaluate(*operand.second, scope, buffers[next], options);
+        next ^= 1;
+        scope = &current;
+        if (current.size == 0) {
+            out.clear();
+            return out;
+        }
+    }
+    if (!scope) {
+        // Nothing but exclusions: start from every note
+        allOrdinals(nullptr, buffers[next]);
+        current = buffers[next];
+        next ^= 1;
+    } else if (required.empty()) {
+        current = *within;
+    }
+
+    for (const QueryNode* operand : excluded) {
+        PostingList storage;
+        PostingSpan remove = evaluate(*operand, &current, storage, options);
+        if (remove.size == 0) {
+            continue;
+        }
+        differencePostings(current, remove, buffers[next]);
+        current = buffers[next];
+        next ^= 1;
+        if (current.size == 0) {
+            out.clear();
+            return out;
+        }
+    }
+
+    // Hand over the final buffer; a result borrowed from the index or from
+    // within stays a view.
+    for (auto& buffer : buffers) {
+        if (current.size > 0 && current.data == buffer.data()) {
+            out.swap(buffer);
+            return out;
+        }
+    }
+    return current;
 }
 
-void SearchIndex::removeNoteInternal(const NoteUUID& uuid) {
-    // This version does NOT lock the mutex - caller must lock if needed
-    
-    auto it = std::find_if(all_notes_.begin(), all_notes_.end(),
-        [&uuid](const std::shared_ptr<Note>& n) { return n->uuid() == uuid; });
-    
-    if (it == all_notes_.end()) return;
-    
-    Note* notePtr = it->get();
-    
-    // Remove from all_notes_
-    all_notes_.erase(it);
-    
-    // Remove from note_to_terms_
-    auto noteTermsIt = note_to_terms_.find(notePtr);
-    if (noteTermsIt != note_to_terms_.end()) {
-        for (const auto& term : noteTermsIt->second) {
-            auto& notes = terms_to_notes_[term];
-            notes.erase(std::remove(notes.begin(), notes.end(), notePtr), notes.end());
-            if (notes.empty()) {
-                terms_to_notes_.erase(term);
+PostingSpan SearchIndex::Version::evaluateFilter(const QueryNode& node, const PostingSpan* within,
+                                                 PostingList& out) const {
+    if (node.kind == QueryNode::Kind::Modified) {
+        size_t count = 0;
+        for (const Segment* segment : {base.get(), delta.get()}) {
+            const auto [begin, end] = segment->modifiedRange(node.modifiedFrom, node.modifiedTo);
+            count += end - begin;
+        }
+        // Checking the few notes that are left beats sorting a wide range
+        if (within && within->size <= count) {
+            for (size_t i = 0; i < within->size; ++i) {
+                const IndexedNote* note = entry(within->data[i]);
+                if (note && filterMatches(node, *note)) {
+                    out.push_back(within->data[i]);
+                }
+            }
+            return out;
+        }
+        PostingList range;
+        range.reserve(count);
+        for (const Segment* segment : {base.get(), delta.get()}) {
+            const auto [begin, end] = segment->modifiedRange(node.modifiedFrom, node.modifiedTo);
+            for (size_t i = begin; i < end; ++i) {
+                const NoteOrdinal ordinal = segment->by_modified[i].second;
+                if (!isDeleted(ordinal)) {
+                    range.push_back(ordinal);
+                }
+            }
+        }
+        std::sort(range.begin(), range.end());
+        if (within) {
+            std::set_intersection(range.begin(), range.end(), within->data, within->data + within->size,
+                                  std::back_inserter(out));
+        } else {
+            out.swap(range);
+        }
+        return out;
+    }
+
+    // type: and has: read their segment's bitmap
+    if (within) {
+        for (size_t i = 0; i < within->size; ++i) {
+            const NoteOrdinal ordinal = within->data[i];
+            const Segment& segment = ordinal >= delta->first ? *delta : *base;
+            if (testBit(segment.attribute(node).bits, ordinal - segment.first)) {
+                out.push_back(ordinal);
+            }
+        }
+        return out;
+    }
+    for (const Segment* segment : {base.get(), delta.get()}) {
+        const auto& bits = segment->attribute(node).bits;
+        for (size_t w = 0; w < bits.size(); ++w) {
+            for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+                const auto ordinal = segment->first + static_cast<NoteOrdinal>(w * 64 + lowestSetBit(word));
+                if (!isDeleted(ordinal)) {
+                    out.push_back(ordinal);
+                }
             }
         }
-        note_to_terms_.erase(noteTermsIt);
     }
+    return out;
 }
 
-void SearchIndex::removeNote(const NoteUUID& uuid) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    removeNoteInternal(uuid);
+bool SearchIndex::Version::filterMatches(const QueryNode& node, const IndexedNote& note) const {
+    switch (node.kind) {
+    case QueryNode::Kind::Type:
+        return note.type == node.noteType;
+    case QueryNode::Kind::Has:
+        return node.item == QueryNode::Item::Unchecked ? note.unchecked : note.checked;
+    case QueryNode::Kind::Modified:
+        return note.fingerprint.modifiedMillis >= node.modifiedFrom &&
+               note.fingerprint.modifiedMillis < node.modifiedTo;
+    default:
+        return false;
+    }
 }
 
-void SearchIndex::updateNote(std::shared_ptr<Note> note) {
-    // Lock once and do both operations without releasing the lock
-    std::lock_guard<std::mutex> lock(mutex_);
-    removeNoteInternal(note->uuid());
-    indexNoteInternal(note);
+bool SearchIndex::Version::matchesNode(const QueryNode& node, const IndexedNote& note) const {
+    switch (node.kind) {
+    case QueryNode::Kind::Term:
+        return wordMatches(note, node.words.front(), node.field);
+    case QueryNode::Kind::Phrase:
+        return std::all_of(node.words.begin(), node.words.end(), [this, &note, &node](const std::string& word) {
+                   return wordMatches(note, word, node.field);
+               }) &&
+               phraseMatches(note, node.words, node.field);
+    case QueryNode::Kind::And:
+        return std::all_of(node.children.begin(), node.children.end(),
+                           [this, &note](const QueryNode& child) { return matchesNode(child, note); });
+    case QueryNode::Kind::Or:
+        return std::any_of(node.children.begin(), node.children.end(),
+                           [this, &note](const QueryNode& child) { return matchesNode(child, note); });
+    case QueryNode::Kind::Not:
+        return !matchesNode(node.children.front(), note);
+    case QueryNode::Kind::Type:
+    case QueryNode::Kind::Has:
+    case QueryNode::Kind::Modified:
+        return filterMatches(node, note);
+    }
+    return false;
 }
 
-std::vector<std::shared_ptr<Note>> SearchIndex::filter(const std::string& query) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    if (query.empty()) {
-        return all_notes_;
+bool SearchIndex::Version::phraseMatches(const IndexedNote& note, const std::vector<std::string>& words,
+                                         QueryNode::Field field) const {
+    // matching[w][t]: word w matches the note's term t
+    std::vector<std::vector<bool>> matching(words.size(), std::vector<bool>(note.terms.size(), false));
+    std::vector<TermMatch> terms;
+    for (size_t w = 0; w < words.size(); ++w) {
+        matchTerms(note, words[w], field, terms);
+        for (const auto& term : terms) {
+            matching[w][term.term] = true;
+        }
+    }
+
+    // Rebuild each field's token sequence from the recorded offsets and
+    // look for the words in a row. Phrases don't span title and body.
+    std::vector<std::pair<uint32_t, uint32_t>> fields[2];  // (offset, term)
+    for (uint32_t t = 0; t < note.terms.size(); ++t) {
+        const uint32_t begin = note.position_starts[t];
+        const uint32_t titleEnd = begin + note.frequencies[t].title;
+        for (uint32_t k = begin; k < note.position_starts[t + 1]; ++k) {
+            fields[k < titleEnd ? 0 : 1].emplace_back(note.positions[k], t);
+        }
     }
-    
-    auto tokens = tokenize(query);
-    if (tokens.empty()) {
-        return all_notes_;
+    for (int f = 0; f < 2; ++f) {
+        if ((f == 0 && field == QueryNode::Field::Body) || (f == 1 && field == QueryNode::Field::Title)) {
+            continue;
+        }
+        auto& tokens = fields[f];
+        std::sort(tokens.begin(), tokens.end());
+        for (size_t start = 0; start + words.size() <= tokens.size(); ++start) {
+            size_t w = 0;
+            while (w < words.size() && matching[w][tokens[start + w].second]) {
+                ++w;
+            }
+            if (w == words.size()) {
+                return true;
+            }
+        }
     }
-    
-    // Find notes matching all tokens (AND semantics), allowing prefix partial matches.
-    std::set<Note*> matchingNotes;
+    return false;
+}
 
-    for (size_t i = 0; i < tokens.size(); ++i) {
-        const auto& token = tokens[i];
-        std::set<Note*> tokenMatches;
+double SearchIndex::Version::documentFrequency(const std::string& token, QueryNode::Field field) const {
+    // Estimated without materializing the token's posting union, so that
+    // filter() and refine() rank identically.
+    size_t df = 0;
+    const int edits = editsFor(token);
+    if (edits > 0) {
+        // Approximate matches include the prefix matches
+        thread_local std::vector<PostingRef> ranges;
+        fuzzyRanges(token, edits, field, ranges);
+        for (const auto& range : ranges) {
+            df += range.size();
+        }
+    }
 
-        // Prefix partial matching: query token "proj" matches indexed term "project".
-        for (const auto& [indexedTerm, notes] : terms_to_notes_) {
-            if (indexedTerm.rfind(token, 0) == 0) {
-                tokenMatches.insert(notes.begin(), notes.end());
+    if (usesSubstringMatch(token)) {
+        // Upper bound: notes containing the rarest of the token's trigrams
+        std::vector<Trigram> grams;
+        appendTrigrams(token, grams);
+        size_t rarest = live_count;
+        for (Trigram gram : grams) {
+            size_t count = 0;
+            for (const Segment* segment : {base.get(), delta.get()}) {
+                if (auto list = segment->trigramPostings(gram)) {
+                    count += list->size();
+                }
+            }
+            rarest = std::min(rarest, count);
+        }
+        df += rarest;
+    } else if (edits == 0) {
+        for (const Segment* segment : {base.get(), delta.get()}) {
+            const auto [begin, end] = segment->prefixRange(*arena, token, field);
+            for (size_t i = begin; i < end && df < live_count; ++i) {
+                df += segment->postingsFor(field).count(static_cast<uint32_t>(i));
             }
         }
+    }
+    return static_cast<double>(std::min(df, live_count));
+}
+
+double SearchIndex::Version::weightedFrequency(const IndexedNote& entry, const std::string& token,
+                                               QueryNode::Field field) const {
+    thread_local std::vector<TermMatch> matches;
+    matchTerms(entry, token, field, matches);
+
+    double tf = 0.0;
+    for (const auto& match : matches) {
+        const TermFrequency& freq = entry.frequencies[match.term];
+        const double body = field == QueryNode::Field::Title ? 0.0 : freq.body;
+        const double title = field == QueryNode::Field::Body ? 0.0 : kTitleBoost * freq.title;
+        tf += (body + title) * (match.exact ? 1.0 : kFuzzyWeight);
+    }
+    return tf;
+}
+
+std::vector<std::shared_ptr<const Note>> SearchIndex::Version::collectResults(
+    PostingSpan matches, const std::vector<QueryNode::Word>& tokens, const SearchOptions& options) const {
+    std::vector<std::shared_ptr<const Note>> result;
+    result.reserve(matches.size);
+
+    if (options.rankLimit == 0 || matches.size == 0) {
+        // Ordinals follow insertion order, so this matches the all-notes order
+        for (size_t i = 0; i < matches.size; ++i) {
+            result.push_back(entry(matches.data[i])->note);
+        }
+        return result;
+    }
+
+    struct RankedToken {
+        const QueryNode::Word* token;
+        double idf;
+        double maxScore;  // BM25 saturates below idf * (k1 + 1)
+    };
+
+    const double live = static_cast<double>(live_count);
+    const double averageLength = std::max(1.0, static_cast<double>(total_length) / std::max(1.0, live));
+
+    std::vector<RankedToken> ranked;
+    ranked.reserve(tokens.size());
+    for (const auto& token : tokens) {
+        const double df = documentFrequency(token.text, token.field);
+        const double idf = std::log(1.0 + (live - df + 0.5) / (df + 0.5));
+        ranked.push_back(RankedToken{&token, idf, idf * (kBm25K1 + 1.0)});
+    }
+    // Score the most valuable tokens first so hopeless candidates are
+    // abandoned as early as possible.
+    std::sort(ranked.begin(), ranked.end(),
+              [](const RankedToken& a, const RankedToken& b) { return a.maxScore > b.maxScore; });
+
+    // remaining[j]: the most tokens j.. can still add to a score
+    std::vector<double> remaining(ranked.size() + 1, 0.0);
+    for (size_t j = ranked.size(); j-- > 0;) {
+        remaining[j] = remaining[j + 1] + ranked[j].maxScore;
+    }
+
+    // Bounded min-heap of the best rankLimit candidates; the front is the
+    // weakest one kept. Candidates arrive in ordinal order, so on equal
+    // scores the earlier (already kept) note wins.
+    using Scored = std::pair<double, NoteOrdinal>;
+    auto better = [](const Scored& a, const Scored& b) {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    };
+    std::vector<Scored> heap;
+    heap.reserve(std::min(options.rankLimit, matches.size));
 
-        if (tokenMatches.empty()) {
+    for (size_t i = 0; i < matches.size; ++i) {
+        if (i % kCancelCheckInterval == 0 && isCancelled(options)) {
             return {};
         }
+        const bool full = heap.size() == options.rankLimit;
+        // Once even a perfect score can't displace the weakest kept
+        // candidate, the top-k is settled.
+        if (full && remaining[0] <= heap.front().first) {
+            break;
+        }
 
-        if (i == 0) {
-            matchingNotes = std::move(tokenMatches);
-        } else {
-            std::set<Note*> temp;
-            std::set_intersection(matchingNotes.begin(), matchingNotes.end(),
-                                  tokenMatches.begin(), tokenMatches.end(),
-                                  std::inserter(temp, temp.begin()));
-            matchingNotes = std::move(temp);
+        const NoteOrdinal ordinal = matches.data[i];
+        const IndexedNote& note = *entry(ordinal);
+        const double norm = kBm25K1 * (1.0 - kBm25B + kBm25B * note.length / averageLength);
+
+        double score = 0.0;
+        bool pruned = false;
+        for (size_t j = 0; j < ranked.size(); ++j) {
+            if (full && score + remaining[j] <= heap.front().first) {
+                pruned = true;
+                break;
+            }
+            const double tf = weightedFrequency(note, ranked[j].token->text, ranked[j].token->field);
+            score += ranked[j].idf * (tf * (kBm25K1 + 1.0)) / (tf + norm);
+        }
+        if (pruned) {
+            continue;
+        }
+
+        const Scored candidate{score, ordinal};
+        if (!full) {
+            heap.push_back(candidate);
+            std::push_heap(heap.begin(), heap.end(), better);
+        } else if (better(candidate, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            heap.back() = candidate;
+            std::push_heap(heap.begin(), heap.end(), better);
         }
     }
-    
-    // Build result by finding matching notes in all_notes_
-    std::vector<std::shared_ptr<Note>> result;
-    for (const auto& note : all_notes_) {
-        if (matchingNotes.count(note.get())) {
-            result.push_back(note);
+
+    // Best first, then every other match in insertion order
+    std::sort_heap(heap.begin(), heap.end(), better);
+    std::vector<NoteOrdinal> top;
+    top.reserve(heap.size());
+    for (const auto& scored : heap) {
+        result.push_back(entry(scored.second)->note);
+        top.push_back(scored.second);
+    }
+    std::sort(top.begin(), top.end());
+    for (size_t i = 0; i < matches.size; ++i) {
+        if (!std::binary_search(top.begin(), top.end(), matches.data[i])) {
+            result.push_back(entry(matches.data[i])->note);
         }
     }
-    
+
     return result;
 }
 
+NoteMatches SearchIndex::matchSpans(const std::string& query, const Note& note) const {
+    return current()->matchSpans(query, note.uuid());
+}
+
+NoteMatches SearchIndex::Version::matchSpans(const std::string& query, const NoteUUID& uuid) const {
+    NoteMatches matches;
+    auto ordinal = find(uuid);
+    if (!ordinal) {
+        return matches;
+    }
+    const IndexedNote& note = *entry(*ordinal);
+
+    // Highlights cover the characters the token matched, not the whole
+    // term, and only in the word's field
+    auto addTerm = [&note, &matches](size_t index, uint32_t shift, uint32_t length, QueryNode::Field field) {
+        const uint32_t begin = note.position_starts[index];
+        const uint32_t titleEnd = begin + note.frequencies[index].title;
+        const uint32_t from = field == QueryNode::Field::Body ? titleEnd : begin;
+        const uint32_t to = field == QueryNode::Field::Title ? titleEnd : note.position_starts[index + 1];
+        for (uint32_t k = from; k < to; ++k) {
+            auto& spans = k < titleEnd ? matches.title : matches.body;
+            spans.push_back(MatchSpan{note.positions[k] + shift, length});
+        }
+    };
+
+    // Excluded words are not highlighted
+    std::vector<QueryNode::Word> words;
+    if (auto parsed = QueryParser::parse(query)) {
+        parsed->collectWords(words);
+    }
+
+    std::vector<TermMatch> terms;
+    for (const auto& word : words) {
+        matchTerms(note, word.text, word.field, terms);
+        for (const auto& term : terms) {
+            addTerm(term.term, term.offset, term.length, word.field);
+        }
+    }
+
+    normalizeSpans(matches.title);
+    normalizeSpans(matches.body);
+    return matches;
+}
+
+bool SearchIndex::canRefine(const std::string& query, const std::string& previous) const {
+    if (!QueryParser::isRefinementOf(query, previous)) {
+        return false;
+    }
+    auto version = current();
+    if (!version->substring_matching && version->max_edits == 0) {
+        return true;
+    }
+
+    // Growing the last token past the n-gram size switches it from prefix
+    // to substring matching, and growing it past a fuzzy length threshold
+    // allows another edit. Both can match notes the shorter token didn't.
+    // Field prefixes ("title:") aren't part of the word.
+    auto previousWords = queryWords(previous);
+    auto words = queryWords(query);
+    if (previousWords.empty() || words.size() < previousWords.size()) {
+        return false;
+    }
+    const size_t last = previousWords.size() - 1;
+    const std::string& before = previousWords[last];
+    const std::string& after = words[last];
+    if (version->usesSubstringMatch(after) && !version->usesSubstringMatch(before)) {
+        return false;
+    }
+    return version->editsFor(after) == version->editsFor(before);
+}
+
+std::vector<std::shared_ptr<const Note>> SearchIndex::refine(
+    const std::string& query, const std::vector<std::shared_ptr<const Note>>& candidates,
+    const SearchOptions& options) const {
+    return current()->refine(query, candidates, options);
+}
+
+std::vector<std::shared_ptr<const Note>> SearchIndex::Version::refine(
+    const std::string& query, const std::vector<std::shared_ptr<const Note>>& candidates,
+    const SearchOptions& options) const {
+    auto parsed = QueryParser::parse(query);
+
+    PostingList matches;
+    matches.reserve(candidates.size());
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (i % kCancelCheckInterval == 0 && isCancelled(options)) {
+            return {};
+        }
+        const auto& candidate = candidates[i];
+        if (!candidate) {
+            continue;
+        }
+        auto ordinal = find(candidate->uuid());
+        if (!ordinal) {
+            continue;
+        }
+        if (!parsed || matchesNode(*parsed, *entry(*ordinal))) {
+            matches.push_back(*ordinal);
+        }
+    }
+
+    // Candidates may come in ranked order; results are built the same way
+    // filter() builds them.
+    std::sort(matches.begin(), matches.end());
+    matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+
+    std::vector<QueryNode::Word> words;
+    if (parsed) {
+        parsed->collectWords(words);
+    }
+    return collectResults(matches, words, options);
+}
+
 void SearchIndex::clear() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    terms_to_notes_.clear();
-    note_to_terms_.clear();
-    all_notes_.clear();
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    // A fresh arena drops the terms of every note indexed so far
+    Transaction txn;
+    txn.arena = std::make_shared<TermArena>();
+    txn.substring_matching = current()->substring_matching;
+    txn.max_edits = current()->max_edits;
+    txn.reset(std::make_shared<Segment>());
+    publish(txn);
+}
+
+std::string SearchIndex::serialize() const {
+    // Written from a dense copy, so removed notes and the delta/base split
+    // never reach the file.
+    auto version = current();
+    auto merged = Segment::merge(*version->base, *version->delta, *version->deleted, *version->arena, false);
+    const TermArena& arena = *version->arena;
+
+    std::string out;
+    SnapshotWriter writer(out);
+    writer.write(kSnapshotMagic);
+    writer.write(kSnapshotVersion);
+    writer.write(static_cast<uint32_t>(merged->notes.size()));
+    writer.write(static_cast<uint32_t>(merged->terms.size()));
+
+    for (const auto& entry : merged->notes) {
+        writer.write(entry->note->uuid().high());
+        writer.write(entry->note->uuid().low());
+        writer.write(entry->fingerprint.modifiedMillis);
+        writer.write(entry->fingerprint.size);
+        writer.write(entry->fingerprint.titleHash);
+        writer.write(entry->fingerprint.bodyHash);
+        writer.write(entry->length);
+        writer.write(static_cast<uint8_t>(entry->unchecked));
+        writer.write(static_cast<uint8_t>(entry->checked));
+    }
+
+    // Each term: its posting list, the matching per-note frequencies and
+    // then each note's offsets (as many as its title + body frequency)
+    PostingList postings;
+    std::vector<uint32_t> indices;
+    for (size_t t = 0; t < merged->terms.size(); ++t) {
+        const std::string_view term = arena.term(merged->terms[t]);
+        merged->postings.decode(static_cast<uint32_t>(t), postings);
+        writer.writeString(std::string(term));
+        writer.write(static_cast<uint32_t>(postings.size()));
+        indices.clear();
+        for (NoteOrdinal ordinal : postings) {
+            writer.write(ordinal);
+            const IndexedNote& entry = *merged->entry(ordinal);
+            indices.push_back(static_cast<uint32_t>(
+                lowerBoundTerm(entry.terms, arena, term) - entry.terms.begin()));
+        }
+        for (size_t k = 0; k < postings.size(); ++k) {
+            writer.write(merged->entry(postings[k])->frequencies[indices[k]]);
+        }
+        for (size_t k = 0; k < postings.size(); ++k) {
+            const IndexedNote& entry = *merged->entry(postings[k]);
+            for (uint32_t p = entry.position_starts[indices[k]]; p < entry.position_starts[indices[k] + 1]; ++p) {
+                writer.write(entry.positions[p]);
+            }
+        }
+    }
+    return out;
 }
 
-std::vector<std::string> SearchIndex::tokenize(const std::string& s) const {
-    return QueryParser::tokenize(s);
+std::optional<std::vector<std::shared_ptr<const Note>>> SearchIndex::restore(
+    const char* data, size_t size, const std::vector<std::shared_ptr<const Note>>& notes) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    // Terms are interned into a fresh arena, as after clear()
+    Transaction txn;
+    txn.arena = std::make_shared<TermArena>();
+    txn.substring_matching = current()->substring_matching;
+    txn.max_edits = current()->max_edits;
+    auto fail = [this, &txn]() {
+        txn.reset(std::make_shared<Segment>());
+        publish(txn);
+        return std::nullopt;
+    };
+
+    SnapshotReader reader(data, size);
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint32_t noteCount = 0;
+    uint32_t termCount = 0;
+    if (!reader.read(magic) || magic != kSnapshotMagic ||
+        !reader.read(version) || version != kSnapshotVersion ||
+        !reader.read(noteCount) || !reader.read(termCount)) {
+        return fail();
+    }
+
+    std::unordered_map<NoteUUID, std::shared_ptr<const Note>> loaded;
+    loaded.reserve(notes.size());
+    for (const auto& note : notes) {
+        loaded[note->uuid()] = note;
+    }
+
+    // Snapshot ordinal -> ordinal in this index, or kDropped for notes that
+    // were deleted or changed since the snapshot was written.
+    constexpr NoteOrdinal kDropped = ~NoteOrdinal{0};
+    std::vector<NoteOrdinal> remap;
+    remap.reserve(std::min<size_t>(noteCount, notes.size()));
+    std::vector<std::shared_ptr<IndexedNote>> entries;
+    auto base = std::make_shared<Segment>();
+
+    for (uint32_t i = 0; i < noteCount; ++i) {
+        uint64_t uuidHigh = 0;
+        uint64_t uuidLow = 0;
+        uint8_t unchecked = 0;
+        uint8_t checked = 0;
+        auto entry = std::make_shared<IndexedNote>();
+        if (!reader.read(uuidHigh) || !reader.read(uuidLow) ||
+            !reader.read(entry->fingerprint.modifiedMillis) ||
+            !reader.read(entry->fingerprint.size) ||
+            !reader.read(entry->fingerprint.titleHash) ||
+            !reader.read(entry->fingerprint.bodyHash) ||
+            !reader.read(entry->length) ||
+            !reader.read(unchecked) || !reader.read(checked)) {
+            return fail();
+        }
+        const NoteUUID uuid(uuidHigh, uuidLow);
+        auto it = loaded.find(uuid);
+        if (it == loaded.end() || !NoteFingerprint::metadataOf(*it->second).sameMetadata(entry->fingerprint)) {
+            remap.push_back(kDropped);
+            continue;
+        }
+        remap.push_back(static_cast<NoteOrdinal>(entries.size()));
+        base->ordinals.insert(OrdinalTable::tag(uuid), remap.back());
+        txn.total_length += entry->length;
+        // The checklist markers come from the snapshot, so the body isn't read
+        entry->type = it->second->noteType();
+        entry->unchecked = unchecked != 0;
+        entry->checked = checked != 0;
+        entry->note = std::move(it->second);
+        loaded.erase(it);
+        entries.push_back(std::move(entry));
+    }
+
+    // Terms come out of the dictionary in sorted order, so appending them
+    // keeps every note's term list sorted as well.
+    PostingList postings;
+    PostingList titlePostings;
+    std::string previous;
+    for (uint32_t t = 0; t < termCount; ++t) {
+        std::string term;
+        uint32_t count = 0;
+        const char* ordinals = nullptr;
+        const char* frequencies = nullptr;
+        if (!reader.readString(term) || !reader.read(count) ||
+            !reader.readArray<NoteOrdinal>(count, ordinals) ||
+            !reader.readArray<TermFrequency>(count, frequencies)) {
+            return fail();
+        }
+        // Segments rely on a sorted dictionary
+        if (t > 0 && term <= previous) {
+            return fail();
+        }
+        uint64_t positionCount = 0;
+        for (uint32_t k = 0; k < count; ++k) {
+            TermFrequency freq;
+            std::memcpy(&freq, frequencies + k * sizeof(TermFrequency), sizeof(freq));
+            positionCount += uint64_t{freq.title} + freq.body;
+        }
+        const char* positions = nullptr;
+        if (positionCount > std::numeric_limits<uint32_t>::max() ||
+            !reader.readArray<uint32_t>(static_cast<uint32_t>(positionCount), positions)) {
+            return fail();
+        }
+
+        const TermId id = txn.arena->intern(term);
+        postings.clear();
+        titlePostings.clear();
+        for (uint32_t k = 0; k < count; ++k) {
+            NoteOrdinal old;
+            TermFrequency freq;
+            std::memcpy(&old, ordinals + k * sizeof(NoteOrdinal), sizeof(old));
+            std::memcpy(&freq, frequencies + k * sizeof(TermFrequency), sizeof(freq));
+            const char* notePositions = positions;
+            positions += (size_t{freq.title} + freq.body) * sizeof(uint32_t);
+            if (old >= remap.size()) {
+                return fail();
+            }
+            const NoteOrdinal ordinal = remap[old];
+            if (ordinal == kDropped) {
+                continue;
+            }
+            IndexedNote& entry = *entries[ordinal];
+            entry.terms.push_back(id);
+            entry.frequencies.push_back(freq);
+            entry.position_starts.push_back(static_cast<uint32_t>(entry.positions.size()));
+            const size_t first = entry.positions.size();
+            entry.positions.resize(first + freq.title + freq.body);
+            std::memcpy(entry.positions.data() + first, notePositions,
+                        (size_t{freq.title} + freq.body) * sizeof(uint32_t));
+            postings.push_back(ordinal);
+            if (freq.title > 0) {
+                titlePostings.push_back(ordinal);
+            }
+        }
+        if (!postings.empty()) {
+            base->terms.push_back(id);
+            base->postings.append(postings);
+        }
+        if (!titlePostings.empty()) {
+            base->title_terms.push_back(id);
+            base->title_postings.append(titlePostings);
+        }
+        previous = std::move(term);
+    }
+    if (!reader.atEnd()) {
+        return fail();
+    }
+
+    for (auto& entry : entries) {
+        entry->position_starts.push_back(static_cast<uint32_t>(entry->positions.size()));
+    }
+    base->notes.assign(entries.begin(), entries.end());
+    base->terms.shrink_to_fit();
+    base->postings.shrinkToFit();
+    base->title_terms.shrink_to_fit();
+    base->title_postings.shrinkToFit();
+    base->buildAttributes();
+    if (txn.substring_matching) {
+        base->buildTrigrams(*txn.arena);
+    }
+    txn.live_count = entries.size();
+    txn.reset(std::move(base));
+    publish(txn);
+
+    // Whatever wasn't claimed by a snapshot entry is new or changed
+    std::vector<std::shared_ptr<const Note>> stale;
+    for (const auto& note : notes) {
+        if (loaded.count(note->uuid()) != 0) {
+            stale.push_back(note);
+        }
+    }
+    return stale;
 }
 
 std::vector<std::string> QueryParser::tokenize(const std::string& s) {
     std::vector<std::string> tokens;
-    std::string token;
-    
-    for (char c : s) {
-        if (std::isalnum(c) || std::ispunct(c)) {
-            token += std::tolower(c);
+    forEachToken(s, [&tokens](const std::string& token, size_t) { tokens.push_back(token); });
+    return tokens;
+}
+
+namespace {
+
+struct QueryToken {
+    enum class Type { Word, Phrase, Open, Close, Not, Or, Filter };
+
+    Type type;
+    std::vector<std::string> words;  // one for Word, any number for Phrase
+    QueryNode::Field field = QueryNode::Field::Any;  // for Word and Phrase
+    QueryNode filter = {};                           // for Filter
+};
+
+bool isQueryChar(char c) {
+    return std::isalnum(c) || std::ispunct(c);
+}
+
+std::string lowered(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return s;
+}
+
+// "title:" or "body:" at the start of a word, or nullopt
+std::optional<QueryNode::Field> fieldPrefix(const std::string& name) {
+    if (name == "title") {
+        return QueryNode::Field::Title;
+    }
+    if (name == "body") {
+        return QueryNode::Field::Body;
+    }
+    return std::nullopt;
+}
+
+int64_t toMillis(std::chrono::system_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+}
+
+// Local midnight starting the YYYY-MM-DD day in s, and the next one
+std::optional<std::pair<int64_t, int64_t>> parseDay(const std::string& s) {
+    if (s.size() != 10 || s[4] != '-' || s[7] != '-') {
+        return std::nullopt;
+    }
+    for (size_t i : {0, 1, 2, 3, 5, 6, 8, 9}) {
+        if (!std::isdigit(static_cast<unsigned char>(s[i]))) {
+            return std::nullopt;
+        }
+    }
+    std::tm day{};
+    day.tm_year = std::stoi(s.substr(0, 4)) - 1900;
+    day.tm_mon = std::stoi(s.substr(5, 2)) - 1;
+    day.tm_mday = std::stoi(s.substr(8, 2));
+    day.tm_isdst = -1;
+    std::tm next = day;
+    ++next.tm_mday;  // mktime normalizes month ends
+    const int month = day.tm_mon;
+    const int dayOfMonth = day.tm_mday;
+    const std::time_t begin = std::mktime(&day);
+    const std::time_t end = std::mktime(&next);
+    // Rejects 2026-02-30 and the like, which mktime would move on
+    if (begin == -1 || end == -1 || day.tm_mon != month || day.tm_mday != dayOfMonth) {
+        return std::nullopt;
+    }
+    return std::make_pair(int64_t{begin} * 1000, int64_t{end} * 1000);
+}
+
+// modified: values: 7d, 12h, 2w, or a day with an optional comparison
+bool parseModified(const std::string& value, QueryNode& node) {
+    if (value.size() >= 2 && std::all_of(value.begin(), value.end() - 1,
+                                         [](unsigned char c) { return std::isdigit(c); })) {
+        int64_t unit = 0;
+        switch (value.back()) {
+        case 'h': unit = 3600; break;
+        case 'd': unit = 24 * 3600; break;
+        case 'w': unit = 7 * 24 * 3600; break;
+        default: return false;
+        }
+        if (value.size() > 7) {
+            return false;
+        }
+        const int64_t count = std::stoll(value.substr(0, value.size() - 1));
+        node.modifiedFrom = toMillis(std::chrono::system_clock::now()) - count * unit * 1000;
+        node.relativeTime = true;
+        return true;
+    }
+
+    size_t start = 0;
+    if (!value.empty() && (value[0] == '<' || value[0] == '>')) {
+        start = value.size() > 1 && value[1] == '=' ? 2 : 1;
+    }
+    const std::string op = value.substr(0, start);
+    auto day = parseDay(value.substr(start));
+    if (!day) {
+        return false;
+    }
+    if (op.empty()) {
+        node.modifiedFrom = day->first;
+        node.modifiedTo = day->second;
+    } else if (op == ">") {
+        node.modifiedFrom = day->second;
+    } else if (op == ">=") {
+        node.modifiedFrom = day->first;
+    } else if (op == "<") {
+        node.modifiedTo = day->first;
+    } else {
+        node.modifiedTo = day->second;
+    }
+    return true;
+}
+
+// type:, has: and modified: filters; nullopt if word isn't a valid one
+std::optional<QueryNode> parseFilter(const std::string& word) {
+    const size_t colon = word.find(':');
+    if (colon == std::string::npos) {
+        return std::nullopt;
+    }
+    const std::string name = lowered(word.substr(0, colon));
+    const std::string value = lowered(word.substr(colon + 1));
+    QueryNode node;
+    if (name == "type" && (value == "checklist" || value == "text")) {
+        node.kind = QueryNode::Kind::Type;
+        node.noteType = value == "checklist" ? NoteType::CHECKLIST : NoteType::TEXT;
+    } else if (name == "has" && (value == "unchecked" || value == "checked")) {
+        node.kind = QueryNode::Kind::Has;
+        node.item = value == "unchecked" ? QueryNode::Item::Unchecked : QueryNode::Item::Checked;
+    } else if (name == "modified") {
+        node.kind = QueryNode::Kind::Modified;
+        if (!parseModified(value, node)) {
+            return std::nullopt;
+        }
+    } else {
+        return std::nullopt;
+    }
+    return node;
+}
+
+std::vector<QueryToken> lexQuery(const std::string& query) {
+    std::vector<QueryToken> tokens;
+    // Set by title: or body: right before a quote
+    auto phraseField = QueryNode::Field::Any;
+    size_t i = 0;
+    while (i < query.size()) {
+        const char c = query[i];
+        if (!isQueryChar(c)) {
+            ++i;
+        } else if (c == '"') {
+            // An unterminated phrase runs to the end of the query
+            const size_t close = std::min(query.find('"', i + 1), query.size());
+            tokens.push_back({QueryToken::Type::Phrase,
+                              QueryParser::tokenize(query.substr(i + 1, close - i - 1)), phraseField});
+            phraseField = QueryNode::Field::Any;
+            i = close + 1;
+        } else if (c == '(' || c == ')') {
+            tokens.push_back({c == '(' ? QueryToken::Type::Open : QueryToken::Type::Close, {}});
+            ++i;
+        } else if (c == '-' && i + 1 < query.size() && isQueryChar(query[i + 1]) && query[i + 1] != '-') {
+            // "-word", -"phrase" or -(group); a lone "-" or "--x" is a word
+            tokens.push_back({QueryToken::Type::Not, {}});
+            ++i;
         } else {
-            if (!token.empty()) {
-                tokens.push_back(token);
-                token.clear();
+            size_t end = i;
+            while (end < query.size() && isQueryChar(query[end]) && query[end] != '"') {
+                ++end;
+            }
+            // Closing parentheses glued to a word end a group
+            size_t wordEnd = end;
+            while (wordEnd > i && query[wordEnd - 1] == ')') {
+                --wordEnd;
+            }
+            const std::string word = query.substr(i, wordEnd - i);
+            const size_t colon = word.find(':');
+            auto field = colon == std::string::npos ? std::nullopt
+                                                    : fieldPrefix(lowered(word.substr(0, colon)));
+            if (word == "OR") {
+                tokens.push_back({QueryToken::Type::Or, {}});
+            } else if (field && colon + 1 == word.size() && end < query.size() && query[end] == '"') {
+                // title:"some phrase"
+                phraseField = *field;
+            } else if (field && colon + 1 < word.size()) {
+                tokens.push_back({QueryToken::Type::Word, QueryParser::tokenize(word.substr(colon + 1)), *field});
+            } else if (auto filter = parseFilter(word)) {
+                tokens.push_back({QueryToken::Type::Filter, {}, QueryNode::Field::Any, std::move(*filter)});
+            } else if (!word.empty()) {
+                tokens.push_back({QueryToken::Type::Word, QueryParser::tokenize(word)});
+            }
+            for (size_t k = wordEnd; k < end; ++k) {
+                tokens.push_back({QueryToken::Type::Close, {}});
             }
+            i = end;
         }
     }
-    
-    if (!token.empty()) {
-        tokens.push_back(token);
-    }
-    
     return tokens;
 }
 
-std::string SearchIndex::generateUUID() {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<uint8_t> dis(0, 255);
-    
-    std::array<uint8_t, 16> bytes;
-    for (int i = 0; i < 16; i++) {
-        bytes[i] = dis(gen);
-    }
-    
-    // Set version to 4 (bits 12-15 of time_hi_and_version)
-    bytes[6] = (bytes[6] & 0x0F) | 0x40;
-    
-    // Set variant to RFC 4122 (bits 6-7 of clock_seq_hi_and_reserved)
-    bytes[8] = (bytes[8] & 0x3F) | 0x80;
-    
-    std::stringstream ss;
-    ss << std::hex << std::setfill('0');
-    
-    // Format: 8-4-4-4-12
-    for (int i = 0; i < 4; i++) ss << std::setw(2) << static_cast<int>(bytes[i]);
-    ss << "-";
-    for (int i = 4; i < 6; i++) ss << std::setw(2) << static_cast<int>(bytes[i]);
-    ss << "-";
-    for (int i = 6; i < 8; i++) ss << std::setw(2) << static_cast<int>(bytes[i]);
-    ss << "-";
-    for (int i = 8; i < 10; i++) ss << std::setw(2) << static_cast<int>(bytes[i]);
-    ss << "-";
-    for (int i = 10; i < 16; i++) ss << std::setw(2) << static_cast<int>(bytes[i]);
-    
-    return ss.str();
+// The words of query's word tokens in order, without their field prefixes
+std::vector<std::string> queryWords(const std::string& query) {
+    std::vector<std::string> words;
+    for (const auto& token : lexQuery(query)) {
+        if (token.type == QueryToken::Type::Word) {
+            words.insert(words.end(), token.words.begin(), token.words.end());
+        }
+    }
+    return words;
+}
+
+// Recursive descent over the tokens:
+//   query   := or (')' or)*        stray ')' are skipped
+//   or      := and ('OR' and)*
+//   and     := unary*
+//   unary   := '-' primary | primary
+//   primary := '(' or ')'? | word | phrase | filter
+class QueryTreeBuilder {
+public:
+    explicit QueryTreeBuilder(const std::vector<QueryToken>& tokens)
+        : tokens_(tokens) {
+    }
+
+    std::optional<QueryNode> parseQuery() {
+        std::vector<QueryNode> parts;
+        while (pos_ < tokens_.size()) {
+            append(parts, parseOr());
+            if (at(QueryToken::Type::Close)) {
+                ++pos_;
+            }
+        }
+        return combine(QueryNode::Kind::And, std::move(parts));
+    }
+
+private:
+    bool at(QueryToken::Type type) const {
+        return pos_ < tokens_.size() && tokens_[pos_].type == type;
+    }
+
+    static void append(std::vector<QueryNode>& parts, std::optional<QueryNode> node) {
+        if (node) {
+            parts.push_back(std::move(*node));
+        }
+    }
+
+    // Drops empty operands and flattens nested nodes of the same kind, so
+    // the planner sees every operand of "a (b c)" at once.
+    static std::optional<QueryNode> combine(QueryNode::Kind kind, std::vector<QueryNode> parts) {
+        if (parts.empty()) {
+            return std::nullopt;
+        }
+        if (parts.size() == 1) {
+            return std::move(parts.front());
+        }
+        QueryNode node;
+        node.kind = kind;
+        for (auto& part : parts) {
+            if (part.kind == kind) {
+                for (auto& child : part.children) {
+                    node.children.push_back(std::move(child));
+                }
+            } else {
+                node.children.push_back(std::move(part));
+            }
+        }
+        return node;
+    }
+
+    std::optional<QueryNode> parseOr() {
+        std::vector<QueryNode> alternatives;
+        append(alternatives, parseAnd());
+        while (at(QueryToken::Type::Or)) {
+            ++pos_;
+            append(alternatives, parseAnd());
+        }
+        return combine(QueryNode::Kind::Or, std::move(alternatives));
+    }
+
+    std::optional<QueryNode> parseAnd() {
+        std::vector<QueryNode> parts;
+        while (pos_ < tokens_.size() && !at(QueryToken::Type::Or) && !at(QueryToken::Type::Close)) {
+            append(parts, parseUnary());
+        }
+        return combine(QueryNode::Kind::And, std::move(parts));
+    }
+
+    std::optional<QueryNode> parseUnary() {
+        if (!at(QueryToken::Type::Not)) {
+            return parsePrimary();
+        }
+        ++pos_;
+        auto operand = parsePrimary();
+        if (!operand) {
+            return std::nullopt;
+        }
+        QueryNode node;
+        node.kind = QueryNode::Kind::Not;
+        node.children.push_back(std::move(*operand));
+        return node;
+    }
+
+    std::optional<QueryNode> parsePrimary() {
+        if (pos_ >= tokens_.size() || at(QueryToken::Type::Or) || at(QueryToken::Type::Close)) {
+            return std::nullopt;
+        }
+        const QueryToken& token = tokens_[pos_];
+        if (token.type == QueryToken::Type::Not) {
+            return parseUnary();
+        }
+        ++pos_;
+        if (token.type == QueryToken::Type::Open) {
+            auto group = parseOr();
+            if (at(QueryToken::Type::Close)) {
+                ++pos_;
+            }
+            return group;
+        }
+
+        if (token.type == QueryToken::Type::Filter) {
+            return token.filter;
+        }
+        if (token.words.empty()) {
+            return std::nullopt;
+        }
+        QueryNode node;
+        node.kind = token.words.size() == 1 ? QueryNode::Kind::Term : QueryNode::Kind::Phrase;
+        node.words = token.words;
+        node.field = token.field;
+        return node;
+    }
+
+    const std::vector<QueryToken>& tokens_;
+    size_t pos_ = 0;
+};
+
+} // namespace
+
+void QueryNode::collectWords(std::vector<Word>& out) const {
+    switch (kind) {
+    case Kind::Term:
+    case Kind::Phrase:
+        for (const auto& word : words) {
+            out.push_back(Word{word, field});
+        }
+        break;
+    case Kind::And:
+    case Kind::Or:
+        for (const auto& child : children) {
+            child.collectWords(out);
+        }
+        break;
+    case Kind::Not:
+    case Kind::Type:
+    case Kind::Has:
+    case Kind::Modified:
+        break;
+    }
+}
+
+std::optional<QueryNode> QueryParser::parse(const std::string& query) {
+    return QueryTreeBuilder(lexQuery(query)).parseQuery();
+}
+
+bool QueryParser::isRefinementOf(const std::string& query, const std::string& previous) {
+    // Appending characters either extends the last word or adds new ones.
+    // Words match as prefixes, so every note matching query also matched
+    // previous. An empty previous query matched everything, so refining it
+    // would not save any work.
+    if (query.size() < previous.size() || query.compare(0, previous.size(), previous) != 0) {
+        return false;
+    }
+    // Operators break that: "a" -> "a OR b" and "-b" -> "-bc" both widen
+    // the result set, and a phrase only narrows once it is closed. So does
+    // a word turning into a field ("title" -> "title:a") or a filter.
+    const auto tokens = lexQuery(query);
+    const bool plain = std::all_of(tokens.begin(), tokens.end(),
+        [](const QueryToken& token) { return token.type == QueryToken::Type::Word; });
+    if (!plain || tokenize(previous).empty()) {
+        return false;
+    }
+    const auto before = lexQuery(previous);
+    for (size_t i = 0; i < before.size(); ++i) {
+        if (i >= tokens.size() || before[i].type != QueryToken::Type::Word || before[i].field != tokens[i].field) {
+            return false;
+        }
+    }
+    return true;
 }
 
 } // namespace nv
@@ -1,6 +1,8 @@
 #include "nv/storage.h"
+#include "nv/note_history.h"
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QTextStream>
 #include <QStandardPaths>
 #include <QCoreApplication>
@@ -14,25 +16,236 @@
 #include <QJsonObject>
 #include <QJsonArray>
 #include <iostream>
+#include <algorithm>
+#include <unordered_set>
 
 namespace nv {
 
+namespace {
+
+// Bytes after the title line read at startup, for the preview and to tell
+// checklists from text notes
+constexpr qint64 kBodyHeadBytes = 4096;
+
+// Text-mode reads drop every '\r'; bodies read raw do the same
+void dropCarriageReturns(std::string& text) {
+    text.erase(std::remove(text.begin(), text.end(), '\r'), text.end());
+}
+
+// The file's size and modification time, to tell whether it was rewritten
+struct FileStamp {
+    qint64 size = -1;
+    qint64 modifiedMillis = 0;
+
+    static FileStamp of(const QFileInfo& info) {
+        return FileStamp{info.size(), info.lastModified().toMSecsSinceEpoch()};
+    }
+    bool operator==(const FileStamp& other) const {
+        return size == other.size && modifiedMillis == other.modifiedMillis;
+    }
+    bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+// Everything from offset to the end, through a memory map where the
+// platform allows it
+std::string readFrom(QFile& file, qint64 offset) {
+    std::string text;
+    const qint64 length = file.size() - offset;
+    if (length > 0) {
+        if (uchar* mapped = file.map(offset, length)) {
+            text.assign(reinterpret_cast<const char*>(mapped), static_cast<size_t>(length));
+            file.unmap(mapped);
+        } else if (file.seek(offset)) {
+            QByteArray data = file.readAll();
+            text.assign(data.constData(), static_cast<size_t>(data.size()));
+        }
+    }
+    dropCarriageReturns(text);
+    return text;
+}
+
+} // namespace
+
+// A note file's body: everything after the title line, read each time the
+// cache doesn't have it. Before LocalStorage rewrites or deletes the file,
+// it pins the body: the text is read once more and kept here, outside the
+// cache budget, so versions of the note that still refer to it (e.g. the
+// one a rename copied) keep their content. The version written replaces
+// them in the store (storedVersion), so a pinned text lives only as long
+// as older versions are held elsewhere. If another program changed the
+// file since it was read, the title line is parsed again rather than
+// trusting the old offset, and the body reflects that edit.
+class FileBody : public NoteBodySource {
+public:
+    FileBody(std::shared_ptr<NoteBodyCache> cache, QString path, qint64 offset, FileStamp stamp)
+        : cache_(std::move(cache))
+        , path_(std::move(path))
+        , offset_(offset)
+        , stamp_(stamp) {
+    }
+
+    ~FileBody() override {
+        cache_->erase(this);
+    }
+
+    std::shared_ptr<const std::string> load() const override {
+        // Held while reading, so the file isn't rewritten halfway through
+        std::lock_guard<std::mutex> lock(pin_mutex_);
+        if (pinned_) {
+            return pinned_;
+        }
+        if (auto body = cache_->find(this)) {
+            return body;
+        }
+        auto body = read();
+        if (body) {
+            cache_->insert(this, body);
+        }
+        return body;
+    }
+
+    uint64_t storedSize() const override {
+        return static_cast<uint64_t>(std::max<qint64>(0, stamp_.size - offset_));
+    }
+
+    // Called before the file is rewritten or removed
+    void pin() {
+        std::lock_guard<std::mutex> lock(pin_mutex_);
+        if (pinned_) {
+            return;
+        }
+        pinned_ = cache_->find(this);
+        if (!pinned_) {
+            pinned_ = read();
+        }
+        cache_->erase(this);
+    }
+
+private:
+    std::shared_ptr<const std::string> read() const {
+        QFile file(path_);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return nullptr;
+        }
+        qint64 offset = offset_;
+        if (FileStamp::of(QFileInfo(path_)) != stamp_) {
+            file.readLine();
+            offset = file.pos();
+        }
+        return std::make_shared<const std::string>(readFrom(file, offset));
+    }
+
+    std::shared_ptr<NoteBodyCache> cache_;
+    QString path_;
+    qint64 offset_;
+    FileStamp stamp_;
+    mutable std::mutex pin_mutex_;
+    std::shared_ptr<const std::string> pinned_;
+};
+
 LocalStorage::LocalStorage(const QString& directory)
-    : directory_(directory) {
+    : directory_(directory)
+    , body_cache_(std::make_shared<NoteBodyCache>())
+    , history_(std::make_unique<NoteHistory>(directory)) {
+}
+
+LocalStorage::~LocalStorage() = default;
+
+void LocalStorage::setBodyCacheBudget(size_t bytes) {
+    body_cache_->setBudget(bytes);
+}
+
+NoteBodyCacheStats LocalStorage::bodyCacheStats() const {
+    return body_cache_->stats();
+}
+
+QString LocalStorage::notePath(const NoteUUID& uuid) {
+    std::string name;
+    if (uuid.isNamed()) {
+        std::lock_guard<std::mutex> lock(stored_mutex_);
+        auto it = names_.find(uuid);
+        if (it != names_.end()) {
+            name = it->second;
+        }
+    }
+    if (name.empty()) {
+        name = uuid.toString();
+    }
+    return QDir(directory_).filePath(QString::fromStdString(name + ".txt"));
+}
+
+QString LocalStorage::notePath(const Note& note) {
+    if (note.uuid().isNamed()) {
+        std::lock_guard<std::mutex> lock(stored_mutex_);
+        names_[note.uuid()] = note.storageName();
+    }
+    return notePath(note.uuid());
 }
 
-QString LocalStorage::notePath(const NoteUUID& uuid) const {
-    return QDir(directory_).filePath(QString::fromStdString(uuid + ".txt"));
+void LocalStorage::remember(const NoteUUID& uuid, uint64_t contentHash, const QString& path, bool recorded) {
+    QFileInfo info(path);
+    std::lock_guard<std::mutex> lock(stored_mutex_);
+    stored_[uuid] = StoredFile{contentHash, info.size(), info.lastModified().toMSecsSinceEpoch(), recorded};
 }
 
-std::string LocalStorage::readFile(const QString& path) const {
+std::optional<LocalStorage::StoredFile> LocalStorage::unchangedFile(const NoteUUID& uuid, const QString& path) {
+    StoredFile stored;
+    {
+        std::lock_guard<std::mutex> lock(stored_mutex_);
+        auto it = stored_.find(uuid);
+        if (it == stored_.end()) {
+            return std::nullopt;
+        }
+        stored = it->second;
+    }
+    // A stat is much cheaper than a rewrite, and catches edits made by
+    // other programs since
+    QFileInfo info(path);
+    if (!info.exists() || info.size() != stored.size ||
+        info.lastModified().toMSecsSinceEpoch() != stored.modifiedMillis) {
+        return std::nullopt;
+    }
+    return stored;
+}
+
+bool LocalStorage::isStored(const NoteUUID& uuid, uint64_t contentHash, const QString& path) {
+    auto stored = unchangedFile(uuid, path);
+    return stored && stored->contentHash == contentHash;
+}
+
+void LocalStorage::recordFileVersion(const NoteUUID& uuid, const QString& path) {
+    auto stored = unchangedFile(uuid, path);
+    if (stored && stored->recorded) {
+        return;
+    }
     QFile file(path);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        throw std::runtime_error("Failed to open file: " + path.toStdString());
+    if (!file.exists() || !file.open(QIODevice::ReadOnly)) {
+        return;
     }
-    
     QByteArray data = file.readAll();
-    return std::string(data.constData(), data.size());
+    std::string content(data.constData(), data.size());
+    dropCarriageReturns(content);
+    const NoteTimestamp saved =
+        std::chrono::system_clock::from_time_t(QFileInfo(path).lastModified().toSecsSinceEpoch());
+    if (!isSuccess(history_->record(uuid, content, saved))) {
+        std::cerr << "Warning: Failed to record history of " << path.toStdString() << std::endl;
+    }
+}
+
+void LocalStorage::pinFileBody(const NoteUUID& uuid) {
+    std::shared_ptr<FileBody> body;
+    {
+        std::lock_guard<std::mutex> lock(stored_mutex_);
+        auto it = file_bodies_.find(uuid);
+        if (it == file_bodies_.end()) {
+            return;
+        }
+        body = it->second.lock();
+        file_bodies_.erase(it);
+    }
+    if (body) {
+        body->pin();
+    }
 }
 
 void LocalStorage::writeFile(const QString& path, const std::string& content) const {
@@ -46,8 +259,8 @@ void LocalStorage::writeFile(const QString& path, const std::string& content) co
     out << QString::fromStdString(content);
 }
 
-Result<std::vector<std::shared_ptr<Note>>> LocalStorage::readAllNotes() {
-    std::vector<std::shared_ptr<Note>> notes;
+Result<std::vector<std::shared_ptr<const Note>>> LocalStorage::readAllNotes() {
+    std::vector<std::shared_ptr<const Note>> notes;
     
     QDir dir(directory_);
     QFileInfoList files = dir.entryInfoList({"*.txt"}, QDir::Files);
@@ -55,32 +268,44 @@ Result<std::vector<std::shared_ptr<Note>>> LocalStorage::readAllNotes() {
     for (const auto& fileInfo : files) {
         try {
             QString path = fileInfo.absoluteFilePath();
-            std::string content = readFile(path);
+            QFile file(path);
+            if (!file.open(QIODevice::ReadOnly)) {
+                throw std::runtime_error("Failed to open file: " + path.toStdString());
+            }
             
-            // Parse note: first line is title, rest is body
-            size_t newlinePos = content.find('\n');
-            std::string title = (newlinePos == std::string::npos) ? content : content.substr(0, newlinePos);
-            std::string body = (newlinePos == std::string::npos) ? "" : content.substr(newlinePos + 1);
+            // Parse note: first line is title, rest is body. Only the start
+            // of the body is read now; the rest when the body is needed.
+            QByteArray titleLine = file.readLine();
+            if (titleLine.endsWith('\n')) {
+                titleLine.chop(1);
+            }
+            std::string title(titleLine.constData(), titleLine.size());
+            dropCarriageReturns(title);
+            const qint64 bodyOffset = file.pos();
+            QByteArray headData = file.read(kBodyHeadBytes);
+            std::string head(headData.constData(), headData.size());
+            dropCarriageReturns(head);
             
             // Extract UUID from filename
             QString fileName = fileInfo.fileName();
-            QString uuidStr = fileName.left(fileName.length() - 4); // Remove .txt
+            const std::string name = fileName.left(fileName.length() - 4).toStdString(); // Remove .txt
             
             // Use actual file modification time for the note's timestamps
             // QFileInfo::lastModified() returns the modification time as a QDateTime
             auto fileMtime = fileInfo.lastModified();
             NoteTimestamp fileTime = std::chrono::system_clock::from_time_t(fileMtime.toSecsSinceEpoch());
             
-            // Detect if this is a checkbox note by checking for checkbox patterns
+            // Detect if this is a checkbox note by checking for checkbox
+            // patterns near the start of the body
             NoteType noteType = NoteType::TEXT;
-            if (body.find("[x]") != std::string::npos || body.find("[ ]") != std::string::npos) {
+            if (head.find("[x]") != std::string::npos || head.find("[ ]") != std::string::npos) {
                 noteType = NoteType::CHECKLIST;
             }
             
             auto note = std::make_shared<Note>(
-                uuidStr.toStdString(),
+                NoteUUID::fromString(name),
                 title,
-                body,
+                "",
                 fileTime,  // created = file creation/modification time
                 fileTime,  // modified = file modification time
                 noteType,  // noteType = detected type
@@ -90,6 +315,19 @@ Result<std::vector<std::shared_ptr<Note>>> LocalStorage::readAllNotes() {
                 ""         // deviceId
             );
             
+            auto body = std::make_shared<FileBody>(body_cache_, path, bodyOffset, FileStamp::of(QFileInfo(path)));
+            note->setBody(body, Note::previewOf(head));
+            note->setStorageName(name);
+            
+            // The content hash would need the whole body; unknown for now
+            remember(note->uuid(), 0, path);
+            {
+                std::lock_guard<std::mutex> lock(stored_mutex_);
+                file_bodies_[note->uuid()] = body;
+                if (note->uuid().isNamed()) {
+                    names_[note->uuid()] = name;
+                }
+            }
             notes.push_back(note);
         } catch (const std::exception& e) {
             std::cerr << "Warning: Failed to load note from " << fileInfo.absoluteFilePath().toStdString() << ": " << e.what() << std::endl;
@@ -97,26 +335,92 @@ Result<std::vector<std::shared_ptr<Note>>> LocalStorage::readAllNotes() {
         }
     }
     
-    return Result<std::vector<std::shared_ptr<Note>>>{notes};
+    // Histories of notes deleted since are thinned and aged here; nothing
+    // appends to them any more
+    std::unordered_set<NoteUUID> live;
+    live.reserve(notes.size());
+    for (const auto& note : notes) {
+        live.insert(note->uuid());
+    }
+    if (!isSuccess(history_->pruneDeleted(live))) {
+        std::cerr << "Warning: Failed to prune the history of deleted notes" << std::endl;
+    }
+    
+    return Result<std::vector<std::shared_ptr<const Note>>>{notes};
 }
 
 VoidResult LocalStorage::writeNote(const Note& note) {
     try {
-        QString path = notePath(note.uuid());
+        QString path = notePath(note);
+        const uint64_t hash = note.contentHash();
+        if (isStored(note.uuid(), hash, path)) {
+            return VoidResult{SuccessType{}};
+        }
         
-        std::string content = note.title() + "\n" + note.body();
+        std::string content = note.title() + "\n" + *note.body();
+        recordFileVersion(note.uuid(), path);
+        pinFileBody(note.uuid());
         writeFile(path, content);
+        const bool recorded = isSuccess(history_->record(note.uuid(), content, std::chrono::system_clock::now()));
+        if (!recorded) {
+            std::cerr << "Warning: Failed to record history of " << path.toStdString() << std::endl;
+        }
+        remember(note.uuid(), hash, path, recorded);
         
         return VoidResult{SuccessType{}};
     } catch (const std::exception& e) {
-        std::cerr << "Error writing note " << note.uuid() << ": " << e.what() << std::endl;
+        std::cerr << "Error writing note " << note.uuid().toString() << ": " << e.what() << std::endl;
+        {
+            std::lock_guard<std::mutex> lock(stored_mutex_);
+            stored_.erase(note.uuid());
+        }
         return VoidResult{StorageError::WriteFailed};
     }
 }
 
+std::shared_ptr<const Note> LocalStorage::storedVersion(const Note& note) {
+    const QString path = notePath(note.uuid());
+    auto stored = unchangedFile(note.uuid(), path);
+    if (!stored || stored->contentHash != note.contentHash()) {
+        return nullptr;
+    }
+    
+    // A body already read from this file is reused; a second one wouldn't
+    // be pinned when the file is rewritten
+    std::shared_ptr<FileBody> body;
+    {
+        std::lock_guard<std::mutex> lock(stored_mutex_);
+        std::weak_ptr<FileBody>& registered = file_bodies_[note.uuid()];
+        body = registered.lock();
+        if (!body) {
+            const qint64 offset = static_cast<qint64>(note.title().size()) + 1;
+            body = std::make_shared<FileBody>(body_cache_, path, offset, FileStamp{stored->size, stored->modifiedMillis});
+            registered = body;
+        }
+    }
+    // The text just written is the most recently used body, and from now
+    // on counts against the cache budget
+    body_cache_->insert(body.get(), note.body());
+    
+    auto version = std::make_shared<Note>(note);
+    version->setBody(body, note.preview(), note.bodyHash());
+    return version;
+}
+
 VoidResult LocalStorage::deleteNote(const NoteUUID& uuid) {
+    // The note's last content stays restorable
+    recordFileVersion(uuid, notePath(uuid));
+    if (!isSuccess(history_->prune(uuid))) {
+        std::cerr << "Warning: Failed to prune the history of " << uuid.toString() << std::endl;
+    }
+    pinFileBody(uuid);
+    QString path = notePath(uuid);
+    {
+        std::lock_guard<std::mutex> lock(stored_mutex_);
+        stored_.erase(uuid);
+        names_.erase(uuid);
+    }
     try {
-        QString path = notePath(uuid);
         QFile file(path);
         
         if (!file.exists()) {
@@ -129,7 +433,7 @@ VoidResult LocalStorage::deleteNote(const NoteUUID& uuid) {
         
         return VoidResult{SuccessType{}};
     } catch (const std::exception& e) {
-        std::cerr << "Error deleting note " << uuid << ": " << e.what() << std::endl;
+        std::cerr << "Error deleting note " << uuid.toString() << ": " << e.what() << std::endl;
         return VoidResult{StorageError::WriteFailed};
     }
 }
@@ -262,8 +566,8 @@ QString WebDAVStorage::lastError() const {
     return QString();
 }
 
-Result<std::vector<std::shared_ptr<Note>>> WebDAVStorage::readAllNotes() {
-    std::vector<std::shared_ptr<Note>> notes;
+Result<std::vector<std::shared_ptr<const Note>>> WebDAVStorage::readAllNotes() {
+    std::vector<std::shared_ptr<const Note>> notes;
     
     QString url = serverAddress_;
     if (!url.endsWith("/")) {
@@ -274,7 +578,7 @@ Result<std::vector<std::shared_ptr<Note>>> WebDAVStorage::readAllNotes() {
     std::string response = sendRequest(url, "PROPFIND", "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<propfind xmlns=\"DAV:\"><prop><getlastmodified/><getcontentlength/></prop></propfind>");
     
     if (response.empty()) {
-        return Result<std::vector<std::shared_ptr<Note>>>{StorageError::ReadFailed};
+        return Result<std::vector<std::shared_ptr<const Note>>>{StorageError::ReadFailed};
     }
     
     // Parse XML response to extract file URLs
@@ -366,6 +670,9 @@ Result<std::vector<std::shared_ptr<Note>>> WebDAVStorage::readAllNotes() {
         if (!fileResponse.empty()) {
             try {
                 auto note = parseJsonNote(fileResponse, fileName);
+                if (note.uuid().isNamed()) {
+                    names_[note.uuid()] = note.storageName();
+                }
                 notes.push_back(std::make_shared<Note>(note));
             } catch (const std::exception& e) {
                 std::cerr << "Warning: Failed to parse note from " << fileName.toStdString() << ": " << e.what() << std::endl;
@@ -375,11 +682,14 @@ Result<std::vector<std::shared_ptr<Note>>> WebDAVStorage::readAllNotes() {
         pos = end + closingResponse.length();
     }
     
-    return Result<std::vector<std::shared_ptr<Note>>>{notes};
+    return Result<std::vector<std::shared_ptr<const Note>>>{notes};
 }
 
 VoidResult WebDAVStorage::writeNote(const Note& note) {
-    QString fileName = QString::fromStdString(note.uuid() + ".json");
+    QString fileName = QString::fromStdString(note.storageName() + ".json");
+    if (note.uuid().isNamed()) {
+        names_[note.uuid()] = note.storageName();
+    }
     QString url = buildUrl(fileName);
     
     std::string json = noteToJson(note);
@@ -432,7 +742,8 @@ VoidResult WebDAVStorage::writeNote(const Note& note) {
 }
 
 VoidResult WebDAVStorage::deleteNote(const NoteUUID& uuid) {
-    QString fileName = QString::fromStdString(uuid + ".json");
+    auto name = names_.find(uuid);
+    QString fileName = QString::fromStdString((name != names_.end() ? name->second : uuid.toString()) + ".json");
     QString url = buildUrl(fileName);
     
     QNetworkRequest request{QUrl(url)};
@@ -476,6 +787,7 @@ VoidResult WebDAVStorage::deleteNote(const NoteUUID& uuid) {
     
     // DELETE returns 204 No Content on success
     if (statusCode == 204) {
+        names_.erase(uuid);
         return VoidResult{SuccessType{}};
     }
     
@@ -484,7 +796,7 @@ VoidResult WebDAVStorage::deleteNote(const NoteUUID& uuid) {
 
 std::string WebDAVStorage::noteToJson(const Note& note) const {
     QJsonObject jsonObj;
-    jsonObj["content"] = QString::fromStdString(note.body());
+    jsonObj["content"] = QString::fromStdString(*note.body());
     
     // Convert time_point to milliseconds since epoch
     auto createdAtEpoch = std::chrono::time_point_cast<std::chrono::milliseconds>(note.created());
@@ -492,7 +804,7 @@ std::string WebDAVStorage::noteToJson(const Note& note) const {
     
     jsonObj["createdAt"] = static_cast<qint64>(createdAtEpoch.time_since_epoch().count());
     jsonObj["deviceId"] = QString::fromStdString(note.deviceId());
-    jsonObj["id"] = QString::fromStdString(note.uuid());
+    jsonObj["id"] = QString::fromStdString(note.storageName());
     
     // Note type: TEXT or CHECKLIST
     jsonObj["noteType"] = note.noteType() == NoteType::TEXT ? "TEXT" : "CHECKLIST";
@@ -509,7 +821,9 @@ Note WebDAVStorage::parseJsonNote(const std::string& jsonStr, const QString& fil
     QJsonDocument doc = QJsonDocument::fromJson(QByteArray(jsonStr.c_str(), jsonStr.size()));
     QJsonObject jsonObj = doc.object();
     
-    std::string uuid = fileName.left(fileName.length() - 5).toStdString();  // Remove .json extension
+    // Remove .json extension
+    const std::string name = fileName.left(fileName.length() - 5).toStdString();
+    NoteUUID uuid = NoteUUID::fromString(name);
     
     std::string title = jsonObj["title"].toString().toStdString();
     std::string content = jsonObj["content"].toString().toStdString();
@@ -531,8 +845,10 @@ Note WebDAVStorage::parseJsonNote(const std::string& jsonStr, const QString& fil
     QString noteTypeStr = jsonObj["noteType"].toString();
     NoteType noteType = (noteTypeStr == "CHECKLIST") ? NoteType::CHECKLIST : NoteType::TEXT;
     
-    return Note(uuid, title, content, createdAt, modifiedAt, 
-                noteType, syncStatus, createdAtMillis, updatedAtMillis, deviceId);
+    Note note(uuid, title, content, createdAt, modifiedAt, 
+              noteType, syncStatus, createdAtMillis, updatedAtMillis, deviceId);
+    note.setStorageName(name);
+    return note;
 }
 
 } // namespace nv
@@ -0,0 +1,90 @@
+#include "nv/term_arena.h"
+#include <algorithm>
+#include <cstring>
+
+namespace nv {
+
+uint64_t TermArena::hash(std::string_view s) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+TermId TermArena::intern(std::string_view term) {
+    // Keep the table at most half full
+    if ((size_ + 1) * 2 > slots_.size()) {
+        grow();
+    }
+
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = hash(term) & mask;; i = (i + 1) & mask) {
+        if (slots_[i] == kEmptySlot) {
+            const auto id = static_cast<TermId>(size_);
+            const size_t v = size_ + kFirstChunkTerms;
+            const int chunk = highestBit(v) - kFirstChunkBits;
+            if (!chunks_[chunk]) {
+                chunks_[chunk] = std::make_unique<Entry[]>(size_t{1} << (chunk + kFirstChunkBits));
+            }
+            chunks_[chunk][v - (size_t{1} << (chunk + kFirstChunkBits))] =
+                Entry{store(term), static_cast<uint32_t>(term.size())};
+            ++size_;
+            slots_[i] = id;
+            return id;
+        }
+        if (this->term(slots_[i]) == term) {
+            return slots_[i];
+        }
+    }
+}
+
+const char* TermArena::store(std::string_view term) {
+    if (term.size() > kCharBlockSize / 4) {
+        // Unusually long terms get a block of their own, so they don't
+        // waste the rest of the current one
+        char_blocks_.emplace_back(new char[term.size()]);
+        char_block_bytes_ += term.size();
+        std::memcpy(char_blocks_.back().get(), term.data(), term.size());
+        return char_blocks_.back().get();
+    }
+    if (term.size() > free_size_) {
+        // Not zeroed: only the bytes handed out are ever read
+        char_blocks_.emplace_back(new char[kCharBlockSize]);
+        char_block_bytes_ += kCharBlockSize;
+        free_ = char_blocks_.back().get();
+        free_size_ = kCharBlockSize;
+    }
+    char* data = free_;
+    std::memcpy(data, term.data(), term.size());
+    free_ += term.size();
+    free_size_ -= term.size();
+    return data;
+}
+
+void TermArena::grow() {
+    std::vector<TermId> slots(std::max<size_t>(1024, slots_.size() * 2), kEmptySlot);
+    const size_t mask = slots.size() - 1;
+    for (TermId id = 0; id < size_; ++id) {
+        size_t i = hash(term(id)) & mask;
+        while (slots[i] != kEmptySlot) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = id;
+    }
+    slots_ = std::move(slots);
+}
+
+size_t TermArena::memoryUsage() const {
+    size_t entries = 0;
+    for (int chunk = 0; chunk < kMaxChunks; ++chunk) {
+        if (chunks_[chunk]) {
+            entries += size_t{1} << (chunk + kFirstChunkBits);
+        }
+    }
+    return entries * sizeof(Entry) + char_block_bytes_ + slots_.capacity() * sizeof(TermId);
+}
+
+} // namespace nv
@@ -5,6 +5,7 @@
 #include <algorithm>
 #include <chrono>
 #include <filesystem>
+#include <unordered_set>
 
 namespace nv {
 
@@ -97,6 +98,7 @@ void WebDAVSyncManager::refreshConfigurationFromAppState() {
 
     if (connectionConfigChanged || !webdav_storage_) {
         webdav_storage_ = createWebDAVStorage();
+        upload_cursor_ = 0;
     }
 
     const int intervalMs = sync_interval_minutes_ * 60000;
@@ -114,6 +116,7 @@ void WebDAVSyncManager::syncStart() {
     
     // Create WebDAV storage with current configuration
     webdav_storage_ = createWebDAVStorage();
+    upload_cursor_ = 0;
     
     // Start periodic sync timer
     sync_timer_.start(sync_interval_minutes_ * 60000);  // Convert to milliseconds
@@ -180,8 +183,17 @@ void WebDAVSyncManager::performSync() {
     
     emit syncStarted();
     
-    // Step 1: Get remote notes
-    auto remoteNotes = getRemoteNoteTimestamps();
+    // Step 1: Get remote notes, with their content; fetched once for both
+    // steps below
+    std::unordered_map<NoteUUID, std::shared_ptr<const Note>> remoteNotes;
+    auto notesResult = webdav_storage_->readAllNotes();
+    if (nv::isSuccess(notesResult)) {
+        for (const auto& note : nv::getSuccess(notesResult)) {
+            remoteNotes[note->uuid()] = note;
+        }
+    } else {
+        qWarning() << "WebDAV sync: failed to read notes from storage";
+    }
     if (kWebDAVSyncDebugLogging) {
         qInfo() << "WebDAV sync: retrieved" << remoteNotes.size() << "remote notes";
     }
@@ -191,7 +203,7 @@ void WebDAVSyncManager::performSync() {
     downloadMissingOrUpdatedNotes(remoteNotes);
     
     // Step 3: Upload local notes that have changed
-    uploadChangedNotes();
+    uploadChangedNotes(remoteNotes);
     
     // Update last sync time
     last_sync_time_ = QDateTime::currentDateTime().toString("yyyy-MM-dd HH:mm:ss");
@@ -199,8 +211,8 @@ void WebDAVSyncManager::performSync() {
     emit syncFinished(true);
 }
 
-std::unordered_map<std::string, NoteTimestamp> WebDAVSyncManager::getRemoteNoteTimestamps() {
-    std::unordered_map<std::string, NoteTimestamp> result;
+std::unordered_map<NoteUUID, NoteTimestamp> WebDAVSyncManager::getRemoteNoteTimestamps() {
+    std::unordered_map<NoteUUID, NoteTimestamp> result;
     
     if (!webdav_storage_) {
         return result;
@@ -223,153 +235,178 @@ std::unordered_map<std::string, NoteTimestamp> WebDAVSyncManager::getRemoteNoteT
     return result;
 }
 
-void WebDAVSyncManager::downloadMissingOrUpdatedNotes(const std::unordered_map<std::string, NoteTimestamp>& remoteNotes) {
+void WebDAVSyncManager::downloadMissingOrUpdatedNotes(
+    const std::unordered_map<NoteUUID, std::shared_ptr<const Note>>& remoteNotes) {
     if (!note_store_ || !webdav_storage_) {
         return;
     }
     
     // Get all local notes
-    auto localNotes = note_store_->getAllNotes();
-    std::unordered_map<std::string, NoteTimestamp> localTimestamps;
-    
-    for (const auto& note : localNotes) {
-        localTimestamps[note->uuid()] = note->modified();
-    }
-    
-    // Fetch all remote notes once (instead of fetching for each comparison)
-    auto allRemoteNotes = webdav_storage_->readAllNotes();
-    std::vector<std::shared_ptr<Note>> remoteNoteList;
-    if (nv::isSuccess(allRemoteNotes)) {
-        remoteNoteList = nv::getSuccess(allRemoteNotes);
+    std::unordered_map<NoteUUID, std::shared_ptr<const Note>> localNotes;
+    for (const auto& note : *note_store_->getAllNotes()) {
+        localNotes[note->uuid()] = note;
     }
     
     // Tolerance: 3 seconds
     const auto tolerance = std::chrono::seconds(3);
     
+    // Downloads go to the store as one change set, so the index and the
+    // note list are refreshed once per sync instead of once per note
+    NoteChangeSet downloads;
+    // Returns the version to store: once saved, one that reads its body
+    // from the local file
+    auto saveLocally = [this](const std::shared_ptr<const Note>& note) {
+        auto saveResult = storage_->writeNote(*note);
+        if (nv::isSuccess(saveResult)) {
+            if (kWebDAVSyncDebugLogging) {
+                qInfo() << "WebDAV sync: saved downloaded note to local storage" << note->uuid().toString().c_str();
+            }
+            if (auto stored = storage_->storedVersion(*note)) {
+                return stored;
+            }
+        } else {
+            qWarning() << "WebDAV sync: failed to save downloaded note to local storage" << note->uuid().toString().c_str();
+        }
+        return note;
+    };
+    
     // Check each remote note
-    for (const auto& [uuid, remoteTime] : remoteNotes) {
-        auto localIt = localTimestamps.find(uuid);
+    for (const auto& [uuid, note] : remoteNotes) {
+        const auto remoteTime = note->modified();
+        auto localIt = localNotes.find(uuid);
         
-        if (localIt == localTimestamps.end()) {
+        if (localIt == localNotes.end()) {
             // Note doesn't exist locally - download it
             if (kWebDAVSyncDebugLogging) {
-                qInfo() << "WebDAV sync: note" << QString::fromStdString(uuid) << "not found locally, downloading from remote";
-            }
-            for (const auto& note : remoteNoteList) {
-                if (note->uuid() == uuid) {
-                    note_store_->addNote(note);
-                    // Save to local storage as well
-                    auto saveResult = storage_->writeNote(*note);
-                    if (nv::isSuccess(saveResult)) {
-                        if (kWebDAVSyncDebugLogging) {
-                            qInfo() << "WebDAV sync: saved downloaded note to local storage" << uuid.c_str();
-                        }
-                    } else {
-                        qWarning() << "WebDAV sync: failed to save downloaded note to local storage" << uuid.c_str();
-                    }
-                    emit noteDownloaded(note);
-                    break;
-                }
+                qInfo() << "WebDAV sync: note" << QString::fromStdString(uuid.toString()) << "not found locally, downloading from remote";
             }
+            downloads.added.push_back(saveLocally(note));
         } else {
             // Note exists locally - check if remote is newer
-            auto localTime = localIt->second;
+            auto localTime = localIt->second->modified();
             auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(remoteTime - localTime);
             
-            if (remoteTime > localTime + tolerance) {
+            if (remoteTime > localTime + tolerance && sameContent(*localIt->second, *note)) {
+                if (kWebDAVSyncDebugLogging) {
+                    qInfo() << "WebDAV sync: note" << QString::fromStdString(uuid.toString())
+                            << "- content unchanged, skipping download";
+                }
+            } else if (remoteTime > localTime + tolerance) {
                 // Remote is newer - download it
                 if (kWebDAVSyncDebugLogging) {
-                    qInfo() << "WebDAV sync: remote note" << QString::fromStdString(uuid)
+                    qInfo() << "WebDAV sync: remote note" << QString::fromStdString(uuid.toString())
                             << "is" << (diff.count() / 1000.0) << "seconds newer, downloading";
                 }
-                for (const auto& note : remoteNoteList) {
-                    if (note->uuid() == uuid) {
-                        note_store_->updateNote(note);
-                        // Save to local storage as well
-                        auto saveResult = storage_->writeNote(*note);
-                        if (nv::isSuccess(saveResult)) {
-                            if (kWebDAVSyncDebugLogging) {
-                                qInfo() << "WebDAV sync: saved updated note to local storage" << uuid.c_str();
-                            }
-                        } else {
-                            qWarning() << "WebDAV sync: failed to save updated note to local storage" << uuid.c_str();
-                        }
-                        emit noteDownloaded(note);
-                        break;
-                    }
-                }
+                downloads.updated.push_back(saveLocally(note));
             } else {
                 if (kWebDAVSyncDebugLogging) {
-                    qInfo() << "WebDAV sync: note" << QString::fromStdString(uuid)
+                    qInfo() << "WebDAV sync: note" << QString::fromStdString(uuid.toString())
                             << "- remote time within" << (diff.count() / 1000.0) << "seconds of local, skipping download";
                 }
             }
         }
     }
+    
+    if (downloads.empty()) {
+        return;
+    }
+    note_store_->applyChanges(downloads);
+    for (const auto& note : downloads.added) {
+        emit noteDownloaded(note);
+    }
+    for (const auto& note : downloads.updated) {
+        emit noteDownloaded(note);
+    }
 }
 
-void WebDAVSyncManager::uploadChangedNotes() {
+void WebDAVSyncManager::uploadChangedNotes(
+    const std::unordered_map<NoteUUID, std::shared_ptr<const Note>>& remoteNotes) {
     if (!note_store_ || !storage_) {
         return;
     }
     
-    // Get remote notes timestamps to compare
-    auto remoteNotes = getRemoteNoteTimestamps();
-    
-    // Get all local notes
-    auto localNotes = note_store_->getAllNotes();
+    // Only notes changed since the last upload pass (all of them on the
+    // first one) and notes missing on the remote can need uploading
+    NoteJournalChanges changes = note_store_->changesSince(upload_cursor_);
+    std::vector<std::shared_ptr<const Note>> localNotes;
+    std::unordered_set<NoteUUID> changed;
+    for (auto& entry : changes.entries) {
+        if (entry.note) {
+            changed.insert(entry.uuid);
+            localNotes.push_back(std::move(entry.note));
+        }
+    }
+    for (const auto& note : *note_store_->getAllNotes()) {
+        if (!remoteNotes.count(note->uuid()) && !changed.count(note->uuid())) {
+            localNotes.push_back(note);
+        }
+    }
+    if (kWebDAVSyncDebugLogging) {
+        qInfo() << "WebDAV sync:" << localNotes.size() << "notes to check for upload since change"
+                << upload_cursor_;
+    }
     
     // Tolerance: 3 seconds
     //const auto tolerance = std::chrono::seconds(3);
     const auto tolerance = std::chrono::seconds(0);
 
-    
+    // Failed uploads keep the cursor, so they're retried on the next sync
+    bool uploaded = true;
     for (const auto& localNote : localNotes) {
         auto remoteIt = remoteNotes.find(localNote->uuid());
         
         if (remoteIt == remoteNotes.end()) {
             // Note doesn't exist on WebDAV - upload it
             if (kWebDAVSyncDebugLogging) {
-                qInfo() << "WebDAV sync: uploading note" << QString::fromStdString(localNote->uuid()) << "- note does not exist on remote";
+                qInfo() << "WebDAV sync: uploading note" << QString::fromStdString(localNote->uuid().toString()) << "- note does not exist on remote";
             }
-            uploadNote(*localNote);
+            uploaded = uploadNote(*localNote) && uploaded;
         } else {
-            // Note exists on WebDAV - only upload if local is newer (with tolerance)
+            // Note exists on WebDAV - only upload if local is newer (with
+            // tolerance) and its content differs
             auto localTime = localNote->modified();
-            auto remoteTime = remoteIt->second;
+            auto remoteTime = remoteIt->second->modified();
             auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(localTime - remoteTime);
             
             if (kWebDAVSyncDebugLogging) {
-                qInfo() << "WebDAV sync: comparing note" << QString::fromStdString(localNote->uuid())
+                qInfo() << "WebDAV sync: comparing note" << QString::fromStdString(localNote->uuid().toString())
                         << "- local:" << localTime.time_since_epoch().count()
                         << "remote:" << remoteTime.time_since_epoch().count()
                         << "diff:" << diff.count() << "ms";
             }
             
-            if (localTime > remoteTime + tolerance) {
+            if (localTime > remoteTime + tolerance && sameContent(*localNote, *remoteIt->second)) {
                 if (kWebDAVSyncDebugLogging) {
-                    qInfo() << "WebDAV sync: uploading note" << QString::fromStdString(localNote->uuid())
+                    qInfo() << "WebDAV sync: note" << QString::fromStdString(localNote->uuid().toString())
+                            << "- content unchanged, skipping upload";
+                }
+            } else if (localTime > remoteTime + tolerance) {
+                if (kWebDAVSyncDebugLogging) {
+                    qInfo() << "WebDAV sync: uploading note" << QString::fromStdString(localNote->uuid().toString())
                             << "- local time is" << (diff.count() / 1000.0) << "seconds newer than remote";
                 }
-                uploadNote(*localNote);
+                uploaded = uploadNote(*localNote) && uploaded;
             } else if (localTime < remoteTime - tolerance) {
                 if (kWebDAVSyncDebugLogging) {
-                    qInfo() << "WebDAV sync: note" << QString::fromStdString(localNote->uuid())
+                    qInfo() << "WebDAV sync: note" << QString::fromStdString(localNote->uuid().toString())
                             << "- remote is newer, will download on next sync";
                 }
             } else {
                 if (kWebDAVSyncDebugLogging) {
-                    qInfo() << "WebDAV sync: note" << QString::fromStdString(localNote->uuid())
+                    qInfo() << "WebDAV sync: note" << QString::fromStdString(localNote->uuid().toString())
                             << "- times are within tolerance (" << diff.count() << "ms), skipping upload";
                 }
             }
         }
     }
+    if (uploaded) {
+        upload_cursor_ = changes.sequence;
+    }
 }
 
-void WebDAVSyncManager::uploadNote(const Note& note) {
+bool WebDAVSyncManager::uploadNote(const Note& note) {
     if (!webdav_storage_) {
-        return;
+        return false;
     }
     
     // Upload the note
@@ -377,12 +414,13 @@ void WebDAVSyncManager::uploadNote(const Note& note) {
     
     if (nv::isSuccess(result)) {
         if (kWebDAVSyncDebugLogging) {
-            qInfo() << "WebDAV sync: uploaded note" << note.uuid().c_str();
+            qInfo() << "WebDAV sync: uploaded note" << note.uuid().toString().c_str();
         }
         emit noteUploaded(note_store_->getNote(note.uuid()));
-    } else {
-        qWarning() << "WebDAV sync: failed to upload note" << note.uuid().c_str();
+        return true;
     }
+    qWarning() << "WebDAV sync: failed to upload note" << note.uuid().toString().c_str();
+    return false;
 }
 
 bool WebDAVSyncManager::resolveConflict(const Note& localNote, const Note& remoteNote) {
@@ -390,7 +428,11 @@ bool WebDAVSyncManager::resolveConflict(const Note& localNote, const Note& remot
     return remoteNote.updatedAtMillis() > localNote.updatedAtMillis();
 }
 
-std::vector<std::shared_ptr<Note>> WebDAVSyncManager::listRemoteNotes() {
+bool WebDAVSyncManager::sameContent(const Note& localNote, const Note& remoteNote) {
+    return localNote.contentHash() == remoteNote.contentHash() && localNote.noteType() == remoteNote.noteType();
+}
+
+std::vector<std::shared_ptr<const Note>> WebDAVSyncManager::listRemoteNotes() {
     if (!webdav_storage_) {
         return {};
     }
@@ -408,7 +450,7 @@ bool WebDAVSyncManager::isNoteFile(const QString& fileName) {
     return fileName.endsWith(".json", Qt::CaseInsensitive);
 }
 
-bool WebDAVSyncManager::checkRemoteNoteForUpdate(const std::string& uuid) {
+bool WebDAVSyncManager::checkRemoteNoteForUpdate(const NoteUUID& uuid) {
     if (!webdav_storage_ || !note_store_) {
         return false;
     }
@@ -426,7 +468,7 @@ bool WebDAVSyncManager::checkRemoteNoteForUpdate(const std::string& uuid) {
     }
     
     auto remoteNotes = nv::getSuccess(remoteNotesResult);
-    std::shared_ptr<Note> remoteNote;
+    std::shared_ptr<const Note> remoteNote;
     for (const auto& note : remoteNotes) {
         if (note->uuid() == uuid) {
             remoteNote = note;
@@ -440,7 +482,8 @@ bool WebDAVSyncManager::checkRemoteNoteForUpdate(const std::string& uuid) {
     
     // Compare timestamps with 3-second tolerance
     const auto tolerance = std::chrono::seconds(3);
-    bool isRemoteNewer = remoteNote->modified() > localNote->modified() + tolerance;
+    bool isRemoteNewer = remoteNote->modified() > localNote->modified() + tolerance &&
+                         !sameContent(*localNote, *remoteNote);
     
     // Emit signal with the check result
     emit remoteNoteChecked(localNote, remoteNote, isRemoteNewer);
@@ -448,7 +491,7 @@ bool WebDAVSyncManager::checkRemoteNoteForUpdate(const std::string& uuid) {
     return isRemoteNewer;
 }
 
-void WebDAVSyncManager::downloadNoteIfRemoteNewer(const std::string& uuid) {
+void WebDAVSyncManager::downloadNoteIfRemoteNewer(const NoteUUID& uuid) {
     if (!webdav_storage_ || !note_store_) {
         return;
     }
@@ -467,7 +510,7 @@ void WebDAVSyncManager::downloadNoteIfRemoteNewer(const std::string& uuid) {
     }
     
     auto remoteNotes = nv::getSuccess(remoteNotesResult);
-    std::shared_ptr<Note> remoteNote;
+    std::shared_ptr<const Note> remoteNote;
     for (const auto& note : remoteNotes) {
         if (note->uuid() == uuid) {
             remoteNote = note;
@@ -481,31 +524,34 @@ void WebDAVSyncManager::downloadNoteIfRemoteNewer(const std::string& uuid) {
     
     // Compare timestamps with 3-second tolerance
     const auto tolerance = std::chrono::seconds(3);
-    if (remoteNote->modified() > localNote->modified() + tolerance) {
+    if (remoteNote->modified() > localNote->modified() + tolerance && !sameContent(*localNote, *remoteNote)) {
         // Remote is newer - download it
         if (kWebDAVSyncDebugLogging) {
-            qInfo() << "WebDAV sync: remote note" << QString::fromStdString(uuid)
+            qInfo() << "WebDAV sync: remote note" << QString::fromStdString(uuid.toString())
                     << "is newer, updating local copy";
         }
         note_store_->updateNote(remoteNote);
         auto saveResult = storage_->writeNote(*remoteNote);
         if (nv::isSuccess(saveResult)) {
             if (kWebDAVSyncDebugLogging) {
-                qInfo() << "WebDAV sync: updated local note from WebDAV" << uuid.c_str();
+                qInfo() << "WebDAV sync: updated local note from WebDAV" << uuid.toString().c_str();
+            }
+            if (auto stored = storage_->storedVersion(*remoteNote)) {
+                note_store_->updateNote(stored);
             }
         } else {
-            qWarning() << "WebDAV sync: failed to save updated note" << uuid.c_str();
+            qWarning() << "WebDAV sync: failed to save updated note" << uuid.toString().c_str();
         }
     } else {
         if (kWebDAVSyncDebugLogging) {
-            qInfo() << "WebDAV sync: local note" << QString::fromStdString(uuid)
+            qInfo() << "WebDAV sync: local note" << QString::fromStdString(uuid.toString())
                     << "is up to date";
         }
     }
 }
 
-std::unordered_map<std::string, NoteTimestamp> WebDAVSyncManager::parsePropfindResponse(const std::string& xmlResponse) {
-    std::unordered_map<std::string, NoteTimestamp> result;
+std::unordered_map<NoteUUID, NoteTimestamp> WebDAVSyncManager::parsePropfindResponse(const std::string& xmlResponse) {
+    std::unordered_map<NoteUUID, NoteTimestamp> result;
     
     QXmlStreamReader reader(QString::fromStdString(xmlResponse));
     
@@ -558,7 +604,7 @@ std::unordered_map<std::string, NoteTimestamp> WebDAVSyncManager::parsePropfindR
                                     auto timePoint = std::chrono::system_clock::from_time_t(
                                         modified.toSecsSinceEpoch()
                                     );
-                                    result[uuid.toStdString()] = timePoint;
+                                    result[NoteUUID::fromString(uuid.toStdString())] = timePoint;
                                 }
                             }
                         }
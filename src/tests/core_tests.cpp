@@ -0,0 +1,281 @@
+// nv_core_tests: checks of the on-disk formats and encodings in nv_core.
+//
+// Covers TextDelta round trips, history files cut short by an interrupted
+// append, CompressedPostings blocks and SearchIndex snapshots. Runs under
+// ctest; exits non-zero if any check fails.
+
+#include "nv/note_history.h"
+#include "nv/note_model.h"
+#include "nv/posting_list.h"
+#include "nv/search_index.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace nv {
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* expression, const char* file, int line) {
+    if (!condition) {
+        ++failures;
+        std::cerr << file << ":" << line << ": check failed: " << expression << "\n";
+    }
+}
+
+#define NV_CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+// A fresh directory under the system temporary directory, removed again
+// when the test is done
+class ScratchDirectory {
+public:
+    explicit ScratchDirectory(const std::string& name)
+        : path_(std::filesystem::temp_directory_path() /
+                (name + "-" + NoteUUID::generate().toString())) {
+        std::filesystem::create_directories(path_);
+    }
+    ~ScratchDirectory() {
+        std::error_code ignored;
+        std::filesystem::remove_all(path_, ignored);
+    }
+
+    const std::filesystem::path& path() const { return path_; }
+    QString qpath() const { return QString::fromStdString(path_.string()); }
+
+private:
+    std::filesystem::path path_;
+};
+
+std::string randomText(std::mt19937& rng, size_t length) {
+    static constexpr char kAlphabet[] = "abcdefgh ijklmnop\nqrstuvwxyz";
+    std::uniform_int_distribution<size_t> pick(0, sizeof(kAlphabet) - 2);
+    std::string text;
+    for (size_t i = 0; i < length; ++i) {
+        text.push_back(kAlphabet[pick(rng)]);
+    }
+    return text;
+}
+
+bool roundTrips(const std::string& from, const std::string& to) {
+    const std::string delta = TextDelta::encode(from, to);
+    auto applied = TextDelta::apply(from, delta.data(), delta.size());
+    return applied && *applied == to;
+}
+
+void testTextDelta() {
+    NV_CHECK(roundTrips("", ""));
+    NV_CHECK(roundTrips("", "new note\nbody"));
+    NV_CHECK(roundTrips("old note\nbody", ""));
+    NV_CHECK(roundTrips("same text", "same text"));
+    NV_CHECK(roundTrips("Title\nfirst line\n", "Title\nfirst line\nsecond line\n"));
+    NV_CHECK(roundTrips("Title\nbody\n", "New title\nbody\n"));
+    NV_CHECK(roundTrips("abcabcabc", "abcXabcabc"));
+    NV_CHECK(roundTrips("aaaa", "aa"));
+
+    // Random edits of random texts
+    std::mt19937 rng(7);
+    for (int i = 0; i < 200; ++i) {
+        const std::string from = randomText(rng, rng() % 300);
+        std::string to = from;
+        const size_t position = to.empty() ? 0 : rng() % to.size();
+        const size_t erased = std::min<size_t>(rng() % 20, to.size() - position);
+        to.replace(position, erased, randomText(rng, rng() % 20));
+        NV_CHECK(roundTrips(from, to));
+        NV_CHECK(roundTrips(to, from));
+    }
+
+    // A damaged delta is rejected rather than producing the wrong text
+    const std::string from = "Title\nsome body text\n";
+    const std::string to = "Title\nsome longer body text\n";
+    const std::string delta = TextDelta::encode(from, to);
+    NV_CHECK(!TextDelta::apply(from, delta.data(), delta.size() - 1));
+    NV_CHECK(!TextDelta::apply("short", delta.data(), delta.size()));
+}
+
+void testHistoryRecovery() {
+    ScratchDirectory notes("nv-history-test");
+    const NoteUUID uuid = NoteUUID::generate();
+    const auto now = std::chrono::system_clock::now();
+    const std::vector<std::string> texts = {
+        "Groceries\nmilk\n",
+        "Groceries\nmilk\neggs\n",
+        "Groceries\nmilk\neggs\nbread\n",
+    };
+    {
+        NoteHistory history(notes.qpath());
+        for (const auto& text : texts) {
+            NV_CHECK(isSuccess(history.record(uuid, text, now)));
+        }
+        auto versions = history.versions(uuid);
+        NV_CHECK(isSuccess(versions) && getSuccess(versions).size() == texts.size());
+    }
+
+    // Cut the last record short, as a crash during the append would
+    std::filesystem::path file;
+    for (const auto& entry : std::filesystem::directory_iterator(notes.path() / ".nv_history")) {
+        file = entry.path();
+    }
+    NV_CHECK(!file.empty());
+    if (file.empty()) {
+        return;
+    }
+    std::filesystem::resize_file(file, std::filesystem::file_size(file) - 3);
+
+    NoteHistory history(notes.qpath());
+    auto versions = history.versions(uuid);
+    NV_CHECK(isSuccess(versions) && getSuccess(versions).size() == texts.size() - 1);
+    for (size_t i = 0; i + 1 < texts.size(); ++i) {
+        auto text = history.text(uuid, i);
+        NV_CHECK(isSuccess(text) && getSuccess(text) == texts[i]);
+    }
+
+    // The next append drops the partial record and continues after the
+    // last intact one
+    const std::string next = "Groceries\nmilk\neggs\ncheese\n";
+    NV_CHECK(isSuccess(history.record(uuid, next, now)));
+    versions = history.versions(uuid);
+    NV_CHECK(isSuccess(versions) && getSuccess(versions).size() == texts.size());
+    auto last = history.text(uuid, texts.size() - 1);
+    NV_CHECK(isSuccess(last) && getSuccess(last) == next);
+}
+
+void testCompressedPostings() {
+    std::mt19937 rng(11);
+    std::vector<PostingList> lists;
+    // Around the block size, and gaps that need several varint bytes
+    for (size_t count : {size_t(1), size_t(2), CompressedPostings::kBlockSize - 1, CompressedPostings::kBlockSize,
+                         CompressedPostings::kBlockSize + 1, size_t(1000)}) {
+        for (uint32_t maxGap : {1u, 200u, 1u << 22}) {
+            PostingList list;
+            NoteOrdinal ordinal = rng() % 5;
+            for (size_t i = 0; i < count; ++i) {
+                list.push_back(ordinal);
+                ordinal += 1 + rng() % maxGap;
+            }
+            lists.push_back(std::move(list));
+        }
+    }
+
+    CompressedPostings postings;
+    for (const auto& list : lists) {
+        postings.append(list);
+    }
+    postings.shrinkToFit();
+    NV_CHECK(postings.size() == lists.size());
+
+    PostingList decoded;
+    PostingList found;
+    PostingList expected;
+    for (uint32_t i = 0; i < lists.size(); ++i) {
+        NV_CHECK(postings.count(i) == lists[i].size());
+        postings.decode(i, decoded);
+        NV_CHECK(decoded == lists[i]);
+
+        // Every other ordinal of the list plus ordinals it doesn't have
+        PostingList within;
+        for (size_t j = 0; j < lists[i].size(); j += 2) {
+            within.push_back(lists[i][j]);
+            within.push_back(lists[i][j] + 1);
+        }
+        within.erase(std::unique(within.begin(), within.end()), within.end());
+        postings.intersect(i, within, found);
+        expected.clear();
+        std::set_intersection(lists[i].begin(), lists[i].end(), within.begin(), within.end(),
+                              std::back_inserter(expected));
+        NV_CHECK(found == expected);
+    }
+}
+
+std::vector<std::shared_ptr<const Note>> sampleNotes() {
+    const auto modified = std::chrono::system_clock::now() - std::chrono::hours(1);
+    std::vector<std::shared_ptr<const Note>> notes;
+    auto add = [&](const std::string& title, const std::string& body, NoteType type) {
+        auto note = std::make_shared<Note>(NoteUUID::generate(), title, body, modified, modified);
+        note->setNoteType(type);
+        notes.push_back(note);
+    };
+    add("Groceries", "[ ] milk\n[x] eggs\n[ ] bread\n", NoteType::CHECKLIST);
+    add("Packing list", "[x] passport\n[x] charger\n", NoteType::CHECKLIST);
+    add("Database notes", "Index the posting lists, then compress them\n", NoteType::TEXT);
+    add("Meeting", "Discuss the snapshot format and the database migration\n", NoteType::TEXT);
+    for (int i = 0; i < 50; ++i) {
+        add("Journal " + std::to_string(i), "entry number " + std::to_string(i) + " about the weather\n",
+            NoteType::TEXT);
+    }
+    return notes;
+}
+
+std::vector<NoteUUID> uuidsOf(const std::vector<std::shared_ptr<const Note>>& notes) {
+    std::vector<NoteUUID> uuids;
+    for (const auto& note : notes) {
+        uuids.push_back(note->uuid());
+    }
+    std::sort(uuids.begin(), uuids.end());
+    return uuids;
+}
+
+void testSnapshotRestore() {
+    const auto notes = sampleNotes();
+    SearchIndex index;
+    index.indexNotes(notes);
+    const std::string snapshot = index.serialize();
+
+    const std::vector<std::string> queries = {
+        "database", "snap", "title:journal", "has:unchecked", "has:checked", "type:checklist", "weather -journal",
+    };
+
+    SearchIndex restored;
+    auto pending = restored.restore(snapshot.data(), snapshot.size(), notes);
+    NV_CHECK(pending && pending->empty());
+    for (const auto& query : queries) {
+        NV_CHECK(uuidsOf(restored.filter(query)) == uuidsOf(index.filter(query)));
+    }
+
+    // A note changed since the snapshot has to be indexed again
+    auto changed = std::make_shared<Note>(*notes[2]);
+    changed->setBody("Nothing about indexes any more\n");
+    changed->setModified(std::chrono::system_clock::now());
+    auto current = notes;
+    current[2] = changed;
+    SearchIndex partial;
+    pending = partial.restore(snapshot.data(), snapshot.size(), current);
+    NV_CHECK(pending && pending->size() == 1 && (*pending)[0]->uuid() == changed->uuid());
+
+    // Snapshots of another format version, or cut short, aren't used
+    std::string otherVersion = snapshot;
+    uint32_t version = 0;
+    std::memcpy(&version, otherVersion.data() + 4, sizeof(version));
+    --version;
+    std::memcpy(&otherVersion[4], &version, sizeof(version));
+    SearchIndex rejected;
+    NV_CHECK(!rejected.restore(otherVersion.data(), otherVersion.size(), notes));
+    NV_CHECK(rejected.filter("database").empty());
+    NV_CHECK(!rejected.restore(snapshot.data(), snapshot.size() / 2, notes));
+}
+
+} // namespace
+} // namespace nv
+
+int main() {
+    nv::testTextDelta();
+    nv::testHistoryRecovery();
+    nv::testCompressedPostings();
+    nv::testSnapshotRestore();
+    if (nv::failures > 0) {
+        std::cerr << nv::failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "All checks passed\n";
+    return 0;
+}
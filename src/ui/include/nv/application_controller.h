@@ -9,6 +9,8 @@
 #include "nv/note_model.h"
 #include "nv/main_window.h"
 #include "nv/search_index.h"
+#include "nv/search_executor.h"
+#include "nv/index_snapshot.h"
 #include "nv/note_store.h"
 #include "nv/storage.h"
 #include "nv/search_field.h"
@@ -18,15 +20,15 @@
 
 namespace nv {
 
-using NoteSelectionCallback = std::function<void(std::shared_ptr<Note>)>;
+using NoteSelectionCallback = std::function<void(std::shared_ptr<const Note>)>;
 
 class ApplicationController : public QObject, public ISearchController, public NoteStoreObserver {
     Q_OBJECT
 
 signals:
-    void searchResultsUpdated(const std::vector<std::shared_ptr<Note>>& notes);
-    void noteSelectedSignal(std::shared_ptr<Note> note);
-    void renameNoteRequested(std::shared_ptr<Note> note);
+    void searchResultsUpdated(const std::vector<std::shared_ptr<const Note>>& notes);
+    void noteSelectedSignal(std::shared_ptr<const Note> note);
+    void renameNoteRequested(std::shared_ptr<const Note> note);
 
 public:
     explicit ApplicationController(MainWindow* win, INoteStore* store, IStorage* storage, QObject* parent = nullptr);
@@ -35,45 +37,60 @@ public:
     void setSearchQuery(const std::string& query) override;
     void selectNote(size_t index) override;
     void createNewNote(const std::string& title, const std::string& body) override;
-    std::vector<std::shared_ptr<Note>> getFilteredNotes() override;
+    std::vector<std::shared_ptr<const Note>> getFilteredNotes() override;
     void addSearchObserver(SearchResultCallback cb) override;
     void addSelectionObserver(NoteSelectionCallback cb) override;
     void setWebDAVSyncManager(WebDAVSyncManager* manager);
 
-    // NoteStoreObserver implementation
-    void onNoteAdded(std::shared_ptr<Note> note) override;
-    void onNoteUpdated(std::shared_ptr<Note> note) override;
+    // NoteStoreObserver implementation. Every change set is indexed and
+    // re-filtered once, however many notes it holds.
+    void onNoteAdded(std::shared_ptr<const Note> note) override;
+    void onNoteUpdated(std::shared_ptr<const Note> note) override;
     void onNoteDeleted(const NoteUUID& uuid) override;
+    void onNotesChanged(const NoteChangeSet& changes) override;
 
     // Keyboard shortcuts
     void focusSearch();
-    void renameNote(std::shared_ptr<Note> note);
+    void renameNote(std::shared_ptr<const Note> note);
     void setupShortcuts();
 
 private slots:
     void onSearchFieldSubmitted(const QString& text);
-    void onNoteListSelected(std::shared_ptr<Note> note);
+    void onNoteListSelected(std::shared_ptr<const Note> note);
     void onEditorTextChanged();
     void onNewNoteRequested(const QString& text);
     void focusEditorAtEnd();
-    void onNoteDoubleClicked(std::shared_ptr<Note> note);
+    void onNoteDoubleClicked(std::shared_ptr<const Note> note);
     void onLayoutModeChanged(int mode);
     void onThemeChanged(int theme);
     void updateUIFromFilteredNotesWithTheme();
+    void onSearchResultsReady(quint64 generation, const std::string& query,
+                              const std::vector<std::shared_ptr<const Note>>& notes);
 
 private:
     void updateSearchResults(const std::string& query);
     void updateUIFromState();
     void updateUIFromFilteredNotes();
+    // Highlights matches of results_query_ in the note open in the editor
+    void updateEditorHighlights();
     
     MainWindow* win_;
     INoteStore* store_;
     IStorage* storage_;
     std::unique_ptr<SearchIndex> search_index_;
+    // Declared after search_index_ so it is destroyed (and its worker
+    // finished) before the index goes away
+    std::unique_ptr<SearchExecutor> search_executor_;
+    IndexSnapshot index_snapshot_;
+    // Set while the initial notes are added to the store
+    bool loading_notes_ = false;
+    SearchOptions search_options_;
     std::string active_query_;
-    std::vector<std::shared_ptr<Note>> filtered_notes_;
+    std::vector<std::shared_ptr<const Note>> filtered_notes_;
+    // Query that produced filtered_notes_; lets a longer query refine them
+    std::string results_query_;
     std::optional<size_t> selected_index_;
-    std::optional<std::shared_ptr<Note>> pending_note_;
+    std::optional<std::shared_ptr<const Note>> pending_note_;
     std::vector<SearchResultCallback> search_observers_;
     std::vector<NoteSelectionCallback> selection_observers_;
     WebDAVSyncManager* webdav_manager_;  // Not owned by this class
@@ -3,8 +3,10 @@
 #include <QPlainTextEdit>
 #include <QTimer>
 #include <memory>
+#include <vector>
 
 #include "nv/note_model.h"
+#include "nv/search_index.h"
 #include "nv/note_store.h"
 #include "nv/storage.h"
 
@@ -20,9 +22,13 @@ class NoteEditor : public QPlainTextEdit {
 public:
     explicit NoteEditor(INoteStore* store, IStorage* storage, QWidget* parent = nullptr);
     ~NoteEditor() override;
-    void setNote(std::shared_ptr<Note> note);
+    void setNote(std::shared_ptr<const Note> note);
     void clearNote();
-    std::shared_ptr<Note> getNote() const { return current_note_; }
+    std::shared_ptr<const Note> getNote() const { return current_note_; }
+    
+    // Highlights search matches in the body (byte spans from
+    // SearchIndex::matchSpans). Cleared by setNote().
+    void setMatchHighlights(std::vector<MatchSpan> bodySpans);
     
     // Set the WebDAV sync manager for bi-directional sync
     void setWebDAVSyncManager(WebDAVSyncManager* manager);
@@ -44,7 +50,7 @@ private slots:
     void onTextChanged();
 
 private:
-    std::shared_ptr<Note> current_note_;
+    std::shared_ptr<const Note> current_note_;
     INoteStore* store_;
     IStorage* storage_;
     WebDAVSyncManager* webdav_manager_;
@@ -52,10 +58,15 @@ private:
     QString current_body_;
     bool is_checkbox_mode_ = false;
     CheckboxWidget* checkbox_widget_ = nullptr;
+    std::vector<MatchSpan> match_spans_;
     
+    void applyMatchHighlights();
     void setupCheckboxMode();
     void setupRegularMode();
     bool isCheckboxNote(const Note& note) const;
+    // After a successful write, swaps current_note_ (here and in the store)
+    // for the version that reads its body from storage
+    void adoptStoredVersion();
 };
 
 } // namespace nv
@@ -5,13 +5,17 @@
 #include <QStyledItemDelegate>
 #include <QPainter>
 #include <QColor>
+#include <algorithm>
 #include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 // Forward declarations to avoid circular dependency
 namespace nv {
 class INoteStore;
 class IStorage;
+class SearchIndex;
 }
 #include "nv/note_model.h"
 
@@ -20,15 +24,25 @@ namespace nv {
 // Custom roles for the model
 enum {
     TitleRole = Qt::UserRole + 1,
+    MatchRangesRole,  // TextRanges of the display text matched by the search
 };
 
+// A character range of a display string
+struct TextRange {
+    int start = 0;
+    int length = 0;
+};
+using TextRanges = QList<TextRange>;
+
 class NoteListModel : public QAbstractTableModel {
     Q_OBJECT
 
 public:
     explicit NoteListModel(QObject* parent = nullptr);
-    void setNotes(const std::vector<std::shared_ptr<Note>>& notes);
-    std::shared_ptr<Note> noteAt(int row) const;
+    // The first rankedCount notes are in relevance order (see
+    // SearchOptions::rankLimit); the rest have no Relevance value
+    void setNotes(const std::vector<std::shared_ptr<const Note>>& notes, size_t rankedCount = 0);
+    std::shared_ptr<const Note> noteAt(int row) const;
     
     void setStore(INoteStore* store);
     void setStorage(IStorage* storage);
@@ -49,16 +63,28 @@ public:
     bool setData(const QModelIndex& index, const QVariant& value, int role = Qt::EditRole) override;
     
     // Get row for a note (returns -1 if not found)
-    int rowForNote(const std::shared_ptr<Note>& note) const;
+    int rowForNote(const std::shared_ptr<const Note>& note) const;
+    
+    // Query whose matches are highlighted; spans come from index
+    void setMatchQuery(const SearchIndex* index, const std::string& query);
 
 private:
-    std::vector<std::shared_ptr<Note>> notes_;
-    std::vector<std::shared_ptr<Note>> sorted_notes_;
+    std::vector<std::shared_ptr<const Note>> notes_;
+    std::vector<std::shared_ptr<const Note>> sorted_notes_;
+    // Parallel to sorted_notes_: 1-based position in the search results,
+    // which SearchIndex orders by relevance
+    std::vector<int> relevance_ranks_;
+    size_t ranked_count_ = 0;
     int sort_column_ = 0;
     Qt::SortOrder sort_order_ = Qt::AscendingOrder;
     INoteStore* store_ = nullptr;
     IStorage* storage_ = nullptr;
+    const SearchIndex* search_index_ = nullptr;
+    std::string match_query_;
+    // Filled as rows are painted; cleared whenever notes or query change
+    mutable std::unordered_map<const Note*, TextRanges> match_ranges_;
     void updateSortOrder();
+    TextRanges matchRanges(const Note& note) const;
 };
 
 class NoteListItemDelegate : public QStyledItemDelegate {
@@ -129,6 +155,13 @@ public:
             QFont previewFont = opt.font;
             previewFont.setPointSizeF(opt.font.pointSizeF() * 0.9);
             
+            // Search matches, in display text positions
+            const TextRanges matches = index.data(MatchRangesRole).value<TextRanges>();
+            QColor matchColor = (opt.state & QStyle::State_Selected)
+                ? palette.color(QPalette::HighlightedText)
+                : palette.color(QPalette::Highlight);
+            matchColor.setAlpha(70);
+            
             // Draw title
             painter->setFont(titleFont);
             painter->setPen(titleColor);
@@ -139,6 +172,9 @@ public:
             int titleWidth = painter->fontMetrics().horizontalAdvance(title);
             int previewX = opt.rect.left() + titleWidth + 10;  // 10px gap
             
+            paintMatches(painter, opt.rect, matches, 0, separatorPos, title,
+                         opt.rect.left(), titleWidth, matchColor);
+            
             // Draw title
             painter->drawText(opt.rect.left(), opt.rect.top() + 2, titleWidth, 
                              opt.rect.height() - 4, Qt::AlignLeft | Qt::AlignVCenter, title);
@@ -152,6 +188,9 @@ public:
             // Calculate available width for preview
             int previewWidth = opt.rect.right() - previewX - 10;
             if (previewWidth > 0) {
+                // preview starts two characters after the separator
+                paintMatches(painter, opt.rect, matches, separatorPos + 2, static_cast<int>(displayText.size()), preview,
+                             previewX, previewWidth, matchColor);
                 QString elidedPreview = painter->fontMetrics().elidedText(
                     preview, Qt::ElideRight, previewWidth);
                 painter->drawText(previewX, opt.rect.top() + 2, previewWidth,
@@ -180,6 +219,27 @@ public:
                       const QModelIndex& index) const override;
     void updateEditorGeometry(QWidget* editor, const QStyleOptionViewItem& option, 
                               const QModelIndex& index) const override;
+
+private:
+    // Fills the background of the matches inside text, which covers display
+    // positions [first, end) and is drawn at x with the painter's font,
+    // clipped to width.
+    void paintMatches(QPainter* painter, const QRect& rowRect, const TextRanges& matches,
+                      int first, int end, const QString& text, int x, int width,
+                      const QColor& color) const {
+        const QFontMetrics metrics = painter->fontMetrics();
+        for (const auto& match : matches) {
+            if (match.start < first || match.start >= end) {
+                continue;
+            }
+            const int start = match.start - first;
+            const int left = x + metrics.horizontalAdvance(text.left(start));
+            const int right = std::min(x + width, left + metrics.horizontalAdvance(text.mid(start, match.length)));
+            if (left < right) {
+                painter->fillRect(QRect(left, rowRect.top() + 2, right - left, rowRect.height() - 4), color);
+            }
+        }
+    }
 };
 
 class NoteList : public QTableView {
@@ -189,8 +249,8 @@ public:
     explicit NoteList(QWidget* parent = nullptr);
 
 signals:
-    void noteSelected(std::shared_ptr<Note> note);
-    void noteDoubleClicked(std::shared_ptr<Note> note);
+    void noteSelected(std::shared_ptr<const Note> note);
+    void noteDoubleClicked(std::shared_ptr<const Note> note);
     void enterPressed();
 
 public:
@@ -213,4 +273,6 @@ private:
     bool suppress_next_release_selection_ = false;
 };
 
-} // namespace nv
\ No newline at end of file
+} // namespace nv
+
+Q_DECLARE_METATYPE(nv::TextRanges)
\ No newline at end of file
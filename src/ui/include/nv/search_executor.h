@@ -0,0 +1,72 @@
+#pragma once
+
+#include <QObject>
+#include <QFutureWatcher>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "nv/note_model.h"
+#include "nv/search_index.h"
+
+namespace nv {
+
+// Runs SearchIndex queries off the UI thread. Every submitted query gets a
+// generation number; at most one search runs at a time and at most one more
+// waits behind it. Submitting a newer query cancels the running search and
+// replaces the waiting one, and only results for the latest generation are
+// delivered, so the list always reflects the last thing the user typed.
+class SearchExecutor : public QObject {
+    Q_OBJECT
+
+public:
+    using Results = std::vector<std::shared_ptr<const Note>>;
+
+    explicit SearchExecutor(SearchIndex* index, QObject* parent = nullptr);
+    ~SearchExecutor() override;
+
+    // Queues a search for query. With candidates, only those notes are
+    // re-checked (see SearchIndex::refine). Returns the query's generation.
+    quint64 submit(const std::string& query, std::optional<Results> candidates = std::nullopt);
+
+    // Options applied to every search from now on (the cancellation flag is
+    // managed by the executor).
+    void setOptions(const SearchOptions& options) { options_ = options; }
+
+    // Drops every submitted search, e.g. because the caller just produced
+    // fresher results for the same query synchronously.
+    void supersede();
+
+    [[nodiscard]] quint64 generation() const { return generation_; }
+
+signals:
+    void resultsReady(quint64 generation, const std::string& query,
+                      const std::vector<std::shared_ptr<const Note>>& notes);
+
+private slots:
+    void onSearchFinished();
+
+private:
+    struct Job {
+        quint64 generation;
+        std::string query;
+        std::optional<Results> candidates;
+    };
+
+    void start(Job job);
+
+    SearchIndex* index_;  // Not owned by this class
+    SearchOptions options_;
+    QFutureWatcher<Results> watcher_;
+    quint64 generation_ = 0;
+    bool running_ = false;
+    quint64 running_generation_ = 0;
+    std::string running_query_;
+    std::shared_ptr<std::atomic<bool>> running_cancel_;
+    std::optional<Job> pending_;
+};
+
+} // namespace nv
@@ -1,28 +1,50 @@
 #include "nv/application_controller.h"
 #include <QTimer>
 #include <QThreadPool>
-#include <QFuture>
-#include <QFutureWatcher>
-#include <QtConcurrent/QtConcurrent>
 #include <QTextCursor>
 #include <QAction>
 #include <QMenuBar>
 #include <QSettings>
+#include <QThread>
+#include <QMetaObject>
+#include <algorithm>
 #include "nv/main_window.h"
 #include "nv/app_state.h"
 
 namespace nv {
 
+namespace {
+// Matches ranked by relevance; roughly a few screens of the note list.
+// Later matches keep index order.
+constexpr size_t kRankedResultCount = 100;
+}
+
 ApplicationController::ApplicationController(MainWindow* win, INoteStore* store, IStorage* storage, QObject* parent)
     : QObject(parent)
     , win_(win)
     , store_(store)
     , storage_(storage)
     , search_index_(std::make_unique<SearchIndex>())
+    , search_executor_(std::make_unique<SearchExecutor>(search_index_.get()))
+    , index_snapshot_(ApplicationState::instance().notesDirectory())
     , webdav_manager_(nullptr) {
     
-    // Register as observer for note store changes
-    store_->addObserver(this);
+    connect(search_executor_.get(), &SearchExecutor::resultsReady, this, &ApplicationController::onSearchResultsReady);
+    search_index_->setSubstringMatching(ApplicationState::instance().substringSearch());
+    search_index_->setFuzzyMatching(ApplicationState::instance().fuzzySearchEdits());
+    search_index_->setResultCacheCapacity(std::max(0, ApplicationState::instance().searchCacheSize()));
+    search_options_.rankLimit = kRankedResultCount;
+    search_executor_->setOptions(search_options_);
+    
+    // Register as observer for note store changes. Changes made on other
+    // threads (sync) are delivered on this object's thread.
+    store_->addObserver(this, [this](std::function<void()> task) {
+        if (QThread::currentThread() == thread()) {
+            task();
+        } else {
+            QMetaObject::invokeMethod(this, std::move(task), Qt::QueuedConnection);
+        }
+    });
     
     // Create editor with store and storage
     NoteEditor* editor = new NoteEditor(store_, storage_);
@@ -74,9 +96,16 @@ ApplicationController::ApplicationController(MainWindow* win, INoteStore* store,
     auto notesResult = storage_->readAllNotes();
     if (nv::isSuccess(notesResult)) {
         auto allNotes = nv::getSuccess(notesResult);
-        for (const auto& note : allNotes) {
-            store_->addNote(note);
-        }
+        // Reuse the index saved on last exit; only new or changed notes
+        // are tokenized again.
+        search_index_->indexNotes(index_snapshot_.load(*search_index_, allNotes));
+        // The index is already complete, so the refresh in onNotesChanged
+        // is skipped; the search below shows everything once.
+        NoteChangeSet loaded;
+        loaded.added = std::move(allNotes);
+        loading_notes_ = true;
+        store_->applyChanges(loaded);
+        loading_notes_ = false;
     } else {
         qWarning() << "Failed to load notes from storage";
     }
@@ -89,6 +118,7 @@ ApplicationController::~ApplicationController() {
     if (store_) {
         store_->removeObserver(this);
     }
+    index_snapshot_.save(*search_index_);
 }
 
 void ApplicationController::setupShortcuts() {
@@ -115,7 +145,7 @@ void ApplicationController::focusSearch() {
     }
 }
 
-void ApplicationController::renameNote(std::shared_ptr<Note> note) {
+void ApplicationController::renameNote(std::shared_ptr<const Note> note) {
     if (!note) return;
     
     NoteListModel* model = qobject_cast<NoteListModel*>(win_->noteList()->model());
@@ -131,7 +161,7 @@ void ApplicationController::renameNote(std::shared_ptr<Note> note) {
     }
 }
 
-void ApplicationController::onNoteDoubleClicked(std::shared_ptr<Note> note) {
+void ApplicationController::onNoteDoubleClicked(std::shared_ptr<const Note> note) {
     if (!note) {
         return;
     }
@@ -155,39 +185,41 @@ void ApplicationController::onThemeChanged(int theme) {
 void ApplicationController::setSearchQuery(const std::string& query) {
     active_query_ = query;
     
-    // Run search in background
-    auto* watcher = new QFutureWatcher<std::vector<std::shared_ptr<Note>>>(this);
-    connect(watcher, &QFutureWatcher<std::vector<std::shared_ptr<Note>>>::finished, this, [this, watcher]() {
-        filtered_notes_ = watcher->result();
-        
-        // Update UI on main thread
-        updateUIFromFilteredNotes();
-        
-        // Clear selection if no results
-        if (filtered_notes_.empty()) {
-            selected_index_.reset();
-        } else if (!selected_index_ || *selected_index_ >= filtered_notes_.size()) {
-            selected_index_ = 0;
-            NoteListModel* model = qobject_cast<NoteListModel*>(win_->noteList()->model());
-            if (model) {
-                win_->noteList()->setCurrentIndex(model->index(0, 0));
-            }
-        }
-        
-        // Notify observers
-        for (auto& cb : search_observers_) {
-            cb(filtered_notes_);
+    // Most keystrokes only make the query longer. In that case the previous
+    // results already contain every possible match, so only they need checking.
+    std::optional<std::vector<std::shared_ptr<const Note>>> candidates;
+    if (search_index_->canRefine(query, results_query_)) {
+        candidates = filtered_notes_;
+    }
+    
+    // Run search in background; stale searches are cancelled by the executor
+    search_executor_->submit(query, std::move(candidates));
+}
+
+void ApplicationController::onSearchResultsReady(quint64 generation, const std::string& query,
+                                                 const std::vector<std::shared_ptr<const Note>>& notes) {
+    Q_UNUSED(generation);
+    filtered_notes_ = notes;
+    results_query_ = query;
+    
+    // Update UI on main thread
+    updateUIFromFilteredNotes();
+    
+    // Clear selection if no results
+    if (filtered_notes_.empty()) {
+        selected_index_.reset();
+    } else if (!selected_index_ || *selected_index_ >= filtered_notes_.size()) {
+        selected_index_ = 0;
+        NoteListModel* model = qobject_cast<NoteListModel*>(win_->noteList()->model());
+        if (model) {
+            win_->noteList()->setCurrentIndex(model->index(0, 0));
         }
-        
-        // Clean up watcher
-        watcher->deleteLater();
-    });
+    }
     
-    // Run search in background
-    QFuture<std::vector<std::shared_ptr<Note>>> future = QtConcurrent::run([this, query]() {
-        return search_index_->filter(query);
-    });
-    watcher->setFuture(future);
+    // Notify observers
+    for (auto& cb : search_observers_) {
+        cb(filtered_notes_);
+    }
 }
 
 void ApplicationController::selectNote(size_t index) {
@@ -198,6 +230,7 @@ void ApplicationController::selectNote(size_t index) {
     
     // Set editor content
     win_->noteEditor()->setNote(note);
+    updateEditorHighlights();
     
     // Clear pending note if exists
     pending_note_.reset();
@@ -210,20 +243,16 @@ void ApplicationController::selectNote(size_t index) {
 
 void ApplicationController::createNewNote(const std::string& title, const std::string& body) {
     auto note = std::make_shared<Note>(
-        SearchIndex::generateUUID(),
+        NoteUUID::generate(),
         title,
         body,
         std::chrono::system_clock::now(),
         std::chrono::system_clock::now()
     );
     
-    // Add to store (this will trigger onNoteAdded which updates filtered_notes_ and UI)
+    // Add to store (this triggers onNotesChanged, which indexes the note
+    // and updates filtered_notes_ and the UI)
     store_->addNote(note);
-    // Also add to search index directly (onNoteAdded will re-index it, but this is faster)
-    search_index_->indexNote(note);
-    
-    // Re-filter based on current query to ensure we have the latest filtered list
-    filtered_notes_ = search_index_->filter(active_query_);
     
     // Set editor content
     win_->noteEditor()->setNote(note);
@@ -246,7 +275,7 @@ void ApplicationController::createNewNote(const std::string& title, const std::s
     updateUIFromFilteredNotes();
 }
 
-std::vector<std::shared_ptr<Note>> ApplicationController::getFilteredNotes() {
+std::vector<std::shared_ptr<const Note>> ApplicationController::getFilteredNotes() {
     return filtered_notes_;
 }
 
@@ -263,7 +292,7 @@ void ApplicationController::onSearchFieldSubmitted(const QString& text) {
     setSearchQuery(query);
 }
 
-void ApplicationController::onNoteListSelected(std::shared_ptr<Note> note) {
+void ApplicationController::onNoteListSelected(std::shared_ptr<const Note> note) {
     // Find the note in filtered_notes_ to get its index
     for (size_t i = 0; i < filtered_notes_.size(); ++i) {
         if (filtered_notes_[i] == note || filtered_notes_[i]->uuid() == note->uuid()) {
@@ -311,7 +340,8 @@ void ApplicationController::updateUIFromState() {
         model = new NoteListModel(win_->noteList());
         win_->noteList()->setModel(model);
     }
-    model->setNotes(filtered_notes_);
+    model->setMatchQuery(search_index_.get(), results_query_);
+    model->setNotes(filtered_notes_, search_options_.rankLimit);
 }
 
 void ApplicationController::updateUIFromFilteredNotes() {
@@ -320,7 +350,9 @@ void ApplicationController::updateUIFromFilteredNotes() {
         model = new NoteListModel(win_->noteList());
         win_->noteList()->setModel(model);
     }
-    model->setNotes(filtered_notes_);
+    model->setMatchQuery(search_index_.get(), results_query_);
+    model->setNotes(filtered_notes_, search_options_.rankLimit);
+    updateEditorHighlights();
     
     // Update selection if valid
     if (selected_index_ && *selected_index_ < filtered_notes_.size()) {
@@ -332,6 +364,14 @@ void ApplicationController::updateUIFromFilteredNotes() {
     }
 }
 
+void ApplicationController::updateEditorHighlights() {
+    NoteEditor* editor = win_->noteEditor();
+    if (!editor || !editor->getNote()) {
+        return;
+    }
+    editor->setMatchHighlights(search_index_->matchSpans(results_query_, *editor->getNote()).body);
+}
+
 void ApplicationController::updateUIFromFilteredNotesWithTheme() {
     updateUIFromFilteredNotes();
     // Refresh the palette to apply theme changes
@@ -344,23 +384,29 @@ void ApplicationController::updateUIFromFilteredNotesWithTheme() {
 }
 
 // NoteStoreObserver implementation
-void ApplicationController::onNoteAdded(std::shared_ptr<Note> note) {
-    // Add to search index
-    search_index_->indexNote(note);
-    
-    // Update filtered notes before notifying observers
-    filtered_notes_ = search_index_->filter(active_query_);
+void ApplicationController::onNoteAdded(std::shared_ptr<const Note> note) {
+    NoteChangeSet changes;
+    changes.added.push_back(std::move(note));
+    onNotesChanged(changes);
+}
 
-    // Refresh list UI so model pointers stay in sync with filtered_notes_
-    updateUIFromFilteredNotes();
-    
-    // Notify observers
-    for (auto& cb : search_observers_) {
-        cb(filtered_notes_);
-    }
+void ApplicationController::onNoteUpdated(std::shared_ptr<const Note> note) {
+    NoteChangeSet changes;
+    changes.updated.push_back(std::move(note));
+    onNotesChanged(changes);
+}
+
+void ApplicationController::onNoteDeleted(const NoteUUID& uuid) {
+    NoteChangeSet changes;
+    changes.deleted.push_back(uuid);
+    onNotesChanged(changes);
 }
 
-void ApplicationController::onNoteUpdated(std::shared_ptr<Note> note) {
+void ApplicationController::onNotesChanged(const NoteChangeSet& changes) {
+    if (loading_notes_) {
+        return;
+    }
+
     std::optional<NoteUUID> selected_uuid;
     if (win_ && win_->noteEditor() && win_->noteEditor()->getNote()) {
         selected_uuid = win_->noteEditor()->getNote()->uuid();
@@ -368,13 +414,22 @@ void ApplicationController::onNoteUpdated(std::shared_ptr<Note> note) {
         selected_uuid = filtered_notes_[*selected_index_]->uuid();
     }
 
-    // Re-index the note
-    search_index_->updateNote(note);
+    // Bring the search index up to date
+    search_index_->indexNotes(changes.added);
+    for (const auto& note : changes.updated) {
+        search_index_->updateNote(note);
+    }
+    for (const auto& uuid : changes.deleted) {
+        search_index_->removeNote(uuid);
+    }
     
-    // Update filtered notes before notifying observers
-    filtered_notes_ = search_index_->filter(active_query_);
+    // Update filtered notes once for the whole set, before notifying observers
+    search_executor_->supersede();
+    filtered_notes_ = search_index_->filter(active_query_, search_options_);
+    results_query_ = active_query_;
 
-    // Keep selection stable across model refreshes
+    // Keep selection stable across model refreshes; a deleted note's
+    // selection goes away
     if (selected_uuid) {
         selected_index_.reset();
         for (size_t i = 0; i < filtered_notes_.size(); ++i) {
@@ -383,6 +438,8 @@ void ApplicationController::onNoteUpdated(std::shared_ptr<Note> note) {
                 break;
             }
         }
+    } else if (selected_index_ && *selected_index_ >= filtered_notes_.size()) {
+        selected_index_.reset();
     }
 
     // Refresh list UI so user sees sync updates immediately
@@ -391,8 +448,15 @@ void ApplicationController::onNoteUpdated(std::shared_ptr<Note> note) {
     // If the currently opened note was updated by sync, reload editor content
     if (win_ && win_->noteEditor()) {
         auto current = win_->noteEditor()->getNote();
-        if (current && current->uuid() == note->uuid()) {
-            win_->noteEditor()->setNote(note);
+        for (const auto& note : changes.updated) {
+            if (current && current->uuid() == note->uuid()) {
+                // The editor's own save is the version it already shows
+                if (current != note) {
+                    win_->noteEditor()->setNote(note);
+                }
+                updateEditorHighlights();
+                break;
+            }
         }
     }
     
@@ -402,27 +466,6 @@ void ApplicationController::onNoteUpdated(std::shared_ptr<Note> note) {
     }
 }
 
-void ApplicationController::onNoteDeleted(const NoteUUID& uuid) {
-    // Remove from search index
-    search_index_->removeNote(uuid);
-
-    // Recompute filtered notes after deletion
-    filtered_notes_ = search_index_->filter(active_query_);
-    
-    // Update selection if needed
-    if (selected_index_ && *selected_index_ >= filtered_notes_.size()) {
-        selected_index_.reset();
-    }
-
-    // Refresh list UI so deleted/remote-pruned notes disappear immediately
-    updateUIFromFilteredNotes();
-    
-    // Notify observers
-    for (auto& cb : search_observers_) {
-        cb(filtered_notes_);
-    }
-}
-
 void ApplicationController::setWebDAVSyncManager(WebDAVSyncManager* manager) {
     webdav_manager_ = manager;
     
@@ -72,7 +72,7 @@ bool NoteEditor::isCheckboxNote(const Note& note) const {
         return true;
     }
 
-    QString body = QString::fromStdString(note.body());
+    QString body = QString::fromStdString(*note.body());
     return body.contains("[x]") || body.contains("[ ]");
 }
 
@@ -92,8 +92,9 @@ void NoteEditor::setupRegularMode() {
     is_checkbox_mode_ = false;
 }
 
-void NoteEditor::setNote(std::shared_ptr<Note> note) {
+void NoteEditor::setNote(std::shared_ptr<const Note> note) {
     current_note_ = note;
+    match_spans_.clear();
     
     if (note) {
         // Check if this is a checkbox note
@@ -102,12 +103,12 @@ void NoteEditor::setNote(std::shared_ptr<Note> note) {
         if (is_checkbox) {
             setupCheckboxMode();
             if (checkbox_widget_) {
-                checkbox_widget_->setContent(QString::fromStdString(current_note_->body()));
+                checkbox_widget_->setContent(QString::fromStdString(*current_note_->body()));
             }
         } else {
             setupRegularMode();
             if (current_note_) {
-                current_body_ = QString::fromStdString(current_note_->body());
+                current_body_ = QString::fromStdString(*current_note_->body());
                 setPlainText(current_body_);
                 // Move cursor to end of text for new note selection via Enter key
                 QTextCursor cursor = textCursor();
@@ -117,20 +118,59 @@ void NoteEditor::setNote(std::shared_ptr<Note> note) {
         }
         
         if (current_note_) {
-            current_body_ = QString::fromStdString(current_note_->body());
+            current_body_ = QString::fromStdString(*current_note_->body());
         }
     } else {
         current_body_.clear();
         setupRegularMode();
         clear();
     }
+    applyMatchHighlights();
 }
 
 void NoteEditor::clearNote() {
     current_note_.reset();
     current_body_.clear();
+    match_spans_.clear();
     setupRegularMode();
     clear();
+    applyMatchHighlights();
+}
+
+void NoteEditor::setMatchHighlights(std::vector<MatchSpan> bodySpans) {
+    match_spans_ = std::move(bodySpans);
+    applyMatchHighlights();
+}
+
+void NoteEditor::applyMatchHighlights() {
+    QList<QTextEdit::ExtraSelection> selections;
+    if (!is_checkbox_mode_ && current_note_) {
+        QColor color = palette().color(QPalette::Highlight);
+        color.setAlpha(90);
+
+        // Spans are sorted byte offsets; only the text between them is
+        // converted to find the matching UTF-16 positions.
+        const auto text = current_note_->body();
+        const std::string& body = *text;
+        size_t byte = 0;
+        int position = 0;
+        for (const auto& span : match_spans_) {
+            if (span.offset < byte || span.offset + span.length > body.size()) {
+                break;
+            }
+            position += static_cast<int>(QString::fromUtf8(body.data() + byte, span.offset - byte).size());
+            const int length = static_cast<int>(QString::fromUtf8(body.data() + span.offset, span.length).size());
+            byte = span.offset;
+
+            QTextEdit::ExtraSelection selection;
+            selection.cursor = QTextCursor(document());
+            selection.cursor.setPosition(position);
+            selection.cursor.setPosition(position + length, QTextCursor::KeepAnchor);
+            selection.format.setBackground(color);
+            selections.append(selection);
+        }
+    }
+    setExtraSelections(selections);
 }
 
 void NoteEditor::keyPressEvent(QKeyEvent* e) {
@@ -153,8 +193,9 @@ void NoteEditor::focusInEvent(QFocusEvent* e) {
     } else {
         QPlainTextEdit::focusInEvent(e);
         if (current_note_) {
-            current_body_ = QString::fromStdString(current_note_->body());
+            current_body_ = QString::fromStdString(*current_note_->body());
             setPlainText(current_body_);
+            applyMatchHighlights();
         }
     }
 }
@@ -189,6 +230,15 @@ QString NoteEditor::getCurrentContent() const {
     return toPlainText();
 }
 
+void NoteEditor::adoptStoredVersion() {
+    // Same content, so the editor text stays; the body now lives in the
+    // file (and the body cache) instead of in this version
+    if (auto stored = storage_->storedVersion(*current_note_)) {
+        current_note_ = stored;
+        store_->updateNote(current_note_);
+    }
+}
+
 void NoteEditor::saveNote() {
     if (!store_ || !storage_) return;
     
@@ -213,15 +263,16 @@ void NoteEditor::saveNote() {
                          (text.find("[x]") != std::string::npos || text.find("[ ]") != std::string::npos);
         
         // Generate UUID and create new note
-        std::string uuid = SearchIndex::generateUUID();
+        NoteUUID uuid = NoteUUID::generate();
         NoteTimestamp now = std::chrono::system_clock::now();
-        current_note_ = std::make_shared<Note>(uuid, title, body, now, now);
+        auto note = std::make_shared<Note>(uuid, title, body, now, now);
         
         // Set note type
         if (isCheckbox) {
-            current_note_->setNoteType(NoteType::CHECKLIST);
-            current_note_->setSyncStatus("CHECKLIST");
+            note->setNoteType(NoteType::CHECKLIST);
+            note->setSyncStatus("CHECKLIST");
         }
+        current_note_ = note;
         
         // Add to store
         store_->addNote(current_note_);
@@ -230,22 +281,25 @@ void NoteEditor::saveNote() {
         auto writeResult = storage_->writeNote(*current_note_);
         if (!nv::isSuccess(writeResult)) {
             qWarning() << "Failed to save new note to disk";
+        } else {
+            adoptStoredVersion();
         }
     } else {
-        // Update existing note content
-        std::string newBody = newText.toStdString();
-        current_note_->body() = newBody;
+        // Edit a new version; readers of the current one keep seeing it unchanged
+        auto note = std::make_shared<Note>(*current_note_);
+        note->setBody(newText.toStdString());
         
         // Determine if this is now a checkbox note
         bool isCheckbox = newText.contains("[x]") || newText.contains("[ ]");
         if (isCheckbox) {
-            current_note_->setNoteType(NoteType::CHECKLIST);
+            note->setNoteType(NoteType::CHECKLIST);
         } else {
-            current_note_->setNoteType(NoteType::TEXT);
+            note->setNoteType(NoteType::TEXT);
         }
         
         // Update modified timestamp
-        current_note_->setModified(std::chrono::system_clock::now());
+        note->setModified(std::chrono::system_clock::now());
+        current_note_ = note;
         
         // Persist to store
         store_->updateNote(current_note_);
@@ -254,6 +308,8 @@ void NoteEditor::saveNote() {
         auto result = storage_->writeNote(*current_note_);
         if (!nv::isSuccess(result)) {
             qWarning() << "Failed to save note to disk";
+        } else {
+            adoptStoredVersion();
         }
     }
     
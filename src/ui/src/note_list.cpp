@@ -7,9 +7,11 @@
 #include <QLineEdit>
 #include <QFocusEvent>
 #include <QTimer>
+#include <algorithm>
 
 #include "nv/storage.h"
 #include "nv/note_store.h"
+#include "nv/search_index.h"
 
 namespace nv {
 
@@ -30,35 +32,102 @@ void NoteListModel::setStorage(IStorage* storage) {
 }
 
 void NoteListModel::updateSortOrder() {
-    // Create a copy of notes for sorting
-    sorted_notes_ = notes_;
+    // Sort positions into notes_ rather than the notes themselves, so each
+    // row still knows its relevance rank (its position in notes_).
+    std::vector<size_t> order(notes_.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
     
-    std::sort(sorted_notes_.begin(), sorted_notes_.end(), 
-        [this](const std::shared_ptr<Note>& a, const std::shared_ptr<Note>& b) {
+    std::stable_sort(order.begin(), order.end(), 
+        [this](size_t ia, size_t ib) {
+            const Note& a = *notes_[ia];
+            const Note& b = *notes_[ib];
             if (sort_column_ == 0) {
                 // Sort by title
-                int result = a->title().compare(b->title());
+                int result = a.title().compare(b.title());
                 if (result == 0) {
                     // If titles are equal, sort by date modified
-                    return a->modified() < b->modified();
+                    return a.modified() < b.modified();
                 }
                 return sort_order_ == Qt::AscendingOrder ? result < 0 : result > 0;
+            } else if (sort_column_ == 2) {
+                // Sort by relevance: notes_ arrives best match first
+                return sort_order_ == Qt::AscendingOrder ? ia < ib : ia > ib;
             } else {
                 // Sort by date modified
-                auto result = a->modified() < b->modified();
+                auto result = a.modified() < b.modified();
                 return sort_order_ == Qt::AscendingOrder ? result : !result;
             }
         });
+    
+    sorted_notes_.clear();
+    sorted_notes_.reserve(order.size());
+    relevance_ranks_.clear();
+    relevance_ranks_.reserve(order.size());
+    for (size_t index : order) {
+        sorted_notes_.push_back(notes_[index]);
+        relevance_ranks_.push_back(static_cast<int>(index) + 1);
+    }
 }
 
-void NoteListModel::setNotes(const std::vector<std::shared_ptr<Note>>& notes) {
+void NoteListModel::setMatchQuery(const SearchIndex* index, const std::string& query) {
+    search_index_ = index;
+    match_query_ = query;
+    match_ranges_.clear();
+}
+
+TextRanges NoteListModel::matchRanges(const Note& note) const {
+    if (!search_index_ || match_query_.empty()) {
+        return {};
+    }
+    auto cached = match_ranges_.find(&note);
+    if (cached != match_ranges_.end()) {
+        return cached->second;
+    }
+
+    // The index reports byte spans of title and body; map them onto the
+    // display text built in data(). Title and preview are short, so the
+    // UTF-8 -> UTF-16 conversions are cheap.
+    const NoteMatches matches = search_index_->matchSpans(match_query_, note);
+    const std::string& title = note.title();
+    const std::string& preview = note.preview();
+    auto toRange = [](const std::string& text, const MatchSpan& span, int base) {
+        TextRange range;
+        range.start = base + static_cast<int>(QString::fromUtf8(text.data(), span.offset).size());
+        range.length = static_cast<int>(QString::fromUtf8(text.data() + span.offset, span.length).size());
+        return range;
+    };
+
+    TextRanges ranges;
+    for (const auto& span : matches.title) {
+        if (span.offset + span.length <= title.size()) {
+            ranges.append(toRange(title, span, 0));
+        }
+    }
+    // " — " is three characters
+    const int previewStart = static_cast<int>(QString::fromStdString(title).size()) + 3;
+    for (const auto& span : matches.body) {
+        if (span.offset + span.length > preview.size()) {
+            break;
+        }
+        ranges.append(toRange(preview, span, previewStart));
+    }
+
+    match_ranges_.emplace(&note, ranges);
+    return ranges;
+}
+
+void NoteListModel::setNotes(const std::vector<std::shared_ptr<const Note>>& notes, size_t rankedCount) {
+    match_ranges_.clear();
     beginResetModel();
     notes_ = notes;
+    ranked_count_ = rankedCount;
     updateSortOrder();
     endResetModel();
 }
 
-std::shared_ptr<Note> NoteListModel::noteAt(int row) const {
+std::shared_ptr<const Note> NoteListModel::noteAt(int row) const {
     if (row < 0 || sorted_notes_.empty()) {
         return nullptr;
     }
@@ -68,7 +137,7 @@ std::shared_ptr<Note> NoteListModel::noteAt(int row) const {
     return sorted_notes_[row];
 }
 
-int NoteListModel::rowForNote(const std::shared_ptr<Note>& note) const {
+int NoteListModel::rowForNote(const std::shared_ptr<const Note>& note) const {
     if (!note) return -1;
     
     for (int row = 0; row < static_cast<int>(sorted_notes_.size()); ++row) {
@@ -87,7 +156,7 @@ int NoteListModel::rowCount(const QModelIndex& parent) const {
 
 int NoteListModel::columnCount(const QModelIndex& parent) const {
     Q_UNUSED(parent);
-    return 2;  // Title and Date Modified columns
+    return 3;  // Title, Date Modified and Relevance columns
 }
 
 QVariant NoteListModel::data(const QModelIndex& index, int role) const {
@@ -107,39 +176,37 @@ QVariant NoteListModel::data(const QModelIndex& index, int role) const {
         return QVariant();
     }
     
-    const auto& note = sorted_notes_[index.row()];
+    const Note& note = *sorted_notes_[index.row()];
     
-    if (role == TitleRole) {
+    if (role == MatchRangesRole) {
+        if (index.column() == 0) {
+            return QVariant::fromValue(matchRanges(note));
+        }
+    } else if (role == TitleRole) {
         // Return just the title for editing
         if (index.column() == 0) {
-            return QString::fromStdString(note->title());
+            return QString::fromStdString(note.title());
         }
     } else if (role == Qt::DisplayRole) {
         if (index.column() == 0) {
             // Title column: show title followed by long hyphen and preview
-            std::string title = note->title();
-            std::string body = note->body();
-            
-            // Get preview - first line or first X characters
-            size_t newlinePos = body.find('\n');
-            std::string preview = (newlinePos == std::string::npos) 
-                ? body.substr(0, 50) 
-                : body.substr(0, newlinePos > 50 ? 50 : newlinePos);
-            
-            // Trim trailing whitespace from preview
-            while (!preview.empty() && std::isspace(preview.back())) {
-                preview.pop_back();
-            }
-            
             // Create display text: "Title — preview"
-            QString display = QString::fromStdString(title + " — " + preview);
+            QString display = QString::fromStdString(note.title() + " — " + note.preview());
             return display;
         } else if (index.column() == 1) {
             // Date Modified column
             auto epoch = std::chrono::duration_cast<std::chrono::milliseconds>(
-                note->modified().time_since_epoch()).count();
+                note.modified().time_since_epoch()).count();
             QDateTime dateTime = QDateTime::fromSecsSinceEpoch(epoch / 1000);
             return dateTime.toString("yyyy-MM-dd HH:mm");
+        } else if (index.column() == 2) {
+            // Relevance column: rank in the search results (1 = best
+            // match); blank past the ranked ones, which are in index order
+            const int rank = relevance_ranks_[index.row()];
+            if (static_cast<size_t>(rank) > ranked_count_) {
+                return QVariant();
+            }
+            return rank;
         }
     }
     
@@ -155,6 +222,8 @@ QVariant NoteListModel::headerData(int section, Qt::Orientation orientation, int
         return QString("Title");
     } else if (section == 1) {
         return QString("Date Modified");
+    } else if (section == 2) {
+        return QString("Relevance");
     }
     
     return QVariant();
@@ -195,12 +264,16 @@ bool NoteListModel::setData(const QModelIndex& index, const QVariant& value, int
         return false;
     }
     
-    auto note = sorted_notes_[index.row()];
+    // Rename a new version; the old one stays intact for other readers
+    const auto& current = sorted_notes_[index.row()];
+    auto note = std::make_shared<Note>(*current);
     QString newText = value.toString();
-    note->title() = newText.toStdString();
+    note->setTitle(newText.toStdString());
+    match_ranges_.erase(current.get());
     
     // Update modified timestamp
     note->setModified(std::chrono::system_clock::now());
+    sorted_notes_[index.row()] = note;
     
     // Notify store of update (this will trigger observer notifications)
     if (store_) {
@@ -212,6 +285,12 @@ bool NoteListModel::setData(const QModelIndex& index, const QVariant& value, int
         auto result = storage_->writeNote(*note);
         if (!nv::isSuccess(result)) {
             qWarning() << "Failed to save note to disk";
+        } else if (auto stored = storage_->storedVersion(*note)) {
+            // Reads the body from the renamed file instead of the old one
+            sorted_notes_[index.row()] = stored;
+            if (store_) {
+                store_->updateNote(stored);
+            }
         }
     }
     
@@ -286,6 +365,7 @@ NoteList::NoteList(QWidget* parent)
     if (headerView) {
         headerView->setSectionResizeMode(0, QHeaderView::Stretch);
         headerView->setSectionResizeMode(1, QHeaderView::ResizeToContents);
+        headerView->setSectionResizeMode(2, QHeaderView::ResizeToContents);
         headerView->setSectionsClickable(true);
         headerView->setSortIndicatorShown(true);
         
@@ -334,7 +414,7 @@ void NoteList::mouseReleaseEvent(QMouseEvent* e) {
     if (index.isValid()) {
         NoteListModel* model = qobject_cast<NoteListModel*>(this->model());
         if (model) {
-            std::shared_ptr<Note> note = model->noteAt(index.row());
+            std::shared_ptr<const Note> note = model->noteAt(index.row());
             if (note) {
                 emit noteSelected(note);
             }
@@ -352,7 +432,7 @@ void NoteList::mouseDoubleClickEvent(QMouseEvent* e) {
     if (index.isValid()) {
         NoteListModel* model = qobject_cast<NoteListModel*>(this->model());
         if (model) {
-            std::shared_ptr<Note> note = model->noteAt(index.row());
+            std::shared_ptr<const Note> note = model->noteAt(index.row());
             if (note) {
                 emit noteDoubleClicked(note);
             }
@@ -394,7 +474,7 @@ void NoteList::keyPressEvent(QKeyEvent* e) {
         // Get the new note at the new position
         int newRow = currentIndex().row();
         NoteListModel* model = qobject_cast<NoteListModel*>(this->model());
-        std::shared_ptr<Note> newNote = model ? model->noteAt(newRow) : nullptr;
+        std::shared_ptr<const Note> newNote = model ? model->noteAt(newRow) : nullptr;
         
         // Emit noteSelected to load the note, but keep focus on note list
         if (newNote) {
@@ -0,0 +1,77 @@
+#include "nv/search_executor.h"
+#include <QtConcurrent/QtConcurrent>
+
+namespace nv {
+
+SearchExecutor::SearchExecutor(SearchIndex* index, QObject* parent)
+    : QObject(parent)
+    , index_(index) {
+    connect(&watcher_, &QFutureWatcher<Results>::finished, this, &SearchExecutor::onSearchFinished);
+}
+
+SearchExecutor::~SearchExecutor() {
+    // The worker reads index_, which may be destroyed right after us
+    pending_.reset();
+    if (running_) {
+        running_cancel_->store(true);
+        watcher_.waitForFinished();
+    }
+}
+
+quint64 SearchExecutor::submit(const std::string& query, std::optional<Results> candidates) {
+    Job job{++generation_, query, std::move(candidates)};
+
+    if (running_) {
+        // Ask the running search to give up and wait behind it. Any search
+        // that was already waiting is obsolete now.
+        running_cancel_->store(true);
+        pending_ = std::move(job);
+    } else {
+        start(std::move(job));
+    }
+
+    return generation_;
+}
+
+void SearchExecutor::supersede() {
+    ++generation_;
+    pending_.reset();
+    if (running_) {
+        running_cancel_->store(true);
+    }
+}
+
+void SearchExecutor::start(Job job) {
+    running_ = true;
+    running_generation_ = job.generation;
+    running_query_ = job.query;
+    running_cancel_ = std::make_shared<std::atomic<bool>>(false);
+
+    watcher_.setFuture(QtConcurrent::run(
+        [index = index_, baseOptions = options_, cancel = running_cancel_, job = std::move(job)]() {
+            SearchOptions options = baseOptions;
+            options.cancelled = cancel.get();
+            if (job.candidates) {
+                return index->refine(job.query, *job.candidates, options);
+            }
+            return index->filter(job.query, options);
+        }));
+}
+
+void SearchExecutor::onSearchFinished() {
+    running_ = false;
+
+    // A cancelled search returns partial results; those only happen for
+    // superseded generations, which are dropped here anyway.
+    if (running_generation_ == generation_ && !running_cancel_->load()) {
+        emit resultsReady(running_generation_, running_query_, watcher_.result());
+    }
+
+    if (pending_) {
+        Job job = std::move(*pending_);
+        pending_.reset();
+        start(std::move(job));
+    }
+}
+
+} // namespace nv